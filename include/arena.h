@@ -0,0 +1,40 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "simd.h"
+
+// Every allocation starts on a cache line, which is also
+// enough for any of the vector types in simd.h
+#define ARENA_ALIGNMENT (SIMD_ALIGNMENT)
+
+typedef enum
+{
+    ARENA_HUGEPAGES = (1 << 0),
+    ARENA_MLOCK = (1 << 1),
+} arena_flags_e;
+
+// Bump allocator for the long-lived sample buffers. The whole arena is
+// mapped (and pre-faulted) once, optionally backed by huge pages and
+// locked in RAM, and released at once when destroyed.
+typedef struct _arena_t arena_t;
+
+// The space `size` bytes take up in the arena, for sizing it up front
+static inline size_t arena_block_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+arena_t *arena_create(size_t size, unsigned int flags);
+void arena_destroy(arena_t **arena_p);
+
+// Returns zeroed memory, or NULL when the arena is exhausted
+void *arena_alloc(arena_t *arena, size_t size);
+
+size_t arena_used(arena_t *arena);
+size_t arena_size(arena_t *arena);
+void arena_print(arena_t *arena);
+
+#endif // __ARENA_H__
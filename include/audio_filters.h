@@ -0,0 +1,45 @@
+#ifndef __AUDIO_FILTERS_H__
+#define __AUDIO_FILTERS_H__
+
+#include <stdbool.h>
+
+// Fixed filters of the demodulated audio, designed for
+// the 12.5 kS/s channel rate
+
+#define AUDIO_FILTERS_RATE (12500U)
+
+#define HP_AUDIO_FILT_TAPS (377)
+#define LP_AUDIO_FILT_TAPS (103)
+#define DEEMPH_FILT_TAPS (101)
+#define DEEMPH_IIR_ORDER (1)
+
+// Separates the voice from the sub-audio CTCSS tones (below ~300Hz)
+extern const float hp_audio_taps[HP_AUDIO_FILT_TAPS];
+// Optional voice band low-pass ('-l')
+extern const float lp_audio_taps[LP_AUDIO_FILT_TAPS];
+// De-emphasis, FIR (APP_FIR_DEEMPH) and IIR variants
+extern const float deemph_taps[DEEMPH_FILT_TAPS];
+extern const float deemph_iir_b[DEEMPH_IIR_ORDER + 1];
+extern const float deemph_iir_a[DEEMPH_IIR_ORDER + 1];
+
+// The same filters for any channel rate: copies of the tables above at
+// AUDIO_FILTERS_RATE, otherwise designed for the rate with the same
+// corner frequencies (the low-pass one capped below the Nyquist
+// frequency). The FIR de-emphasis is then the truncated impulse
+// response of the IIR one.
+typedef struct
+{
+    float *hp;
+    unsigned int hp_len;
+    float *lp;
+    unsigned int lp_len;
+    float *deemph;
+    unsigned int deemph_len;
+    float deemph_b[DEEMPH_IIR_ORDER + 1];
+    float deemph_a[DEEMPH_IIR_ORDER + 1];
+} audio_filters_t;
+
+bool audio_filters_design(audio_filters_t *f, unsigned int rate);
+void audio_filters_free(audio_filters_t *f);
+
+#endif // __AUDIO_FILTERS_H__
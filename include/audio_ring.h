@@ -0,0 +1,49 @@
+#ifndef __AUDIO_RING_H__
+#define __AUDIO_RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wait-free single-producer/single-consumer ring of float samples.
+// The consumer side is meant to be called from the audio callback,
+// so it never blocks, allocates, or takes a lock.
+typedef struct _audio_ring_t audio_ring_t;
+
+typedef struct
+{
+    size_t capacity;
+    size_t used;
+    uint64_t written;
+    uint64_t read;
+    uint64_t overruns;
+    uint64_t overrun_samples;
+    uint64_t underruns;
+    uint64_t underrun_samples;
+} audio_ring_stats_t;
+
+audio_ring_t *audio_ring_create(size_t capacity);
+void audio_ring_destroy(audio_ring_t **ring_p);
+
+// Producer side - returns the number of samples stored,
+// the ones that don't fit are dropped and counted as an overrun
+size_t audio_ring_write(audio_ring_t *ring, const float *x, size_t n);
+
+// Consumer side - always fills `n` samples, padding with
+// silence (counted as an underrun) when the ring runs dry
+size_t audio_ring_read(audio_ring_t *ring, float *y, size_t n);
+
+// Producer side - attaches `tag` (e.g. a timestamp) to the next sample
+// written. One tag is carried at a time, the call is ignored while the
+// previous one hasn't been read yet.
+void audio_ring_tag(audio_ring_t *ring, uint64_t tag);
+
+// Consumer side, after audio_ring_read() - returns true if the tagged
+// sample was among the ones just read, with the tag in `tag`
+bool audio_ring_take_tag(audio_ring_t *ring, uint64_t *tag);
+
+size_t audio_ring_size(audio_ring_t *ring);
+size_t audio_ring_capacity(audio_ring_t *ring);
+void audio_ring_get_stats(audio_ring_t *ring, audio_ring_stats_t *stats);
+
+#endif // __AUDIO_RING_H__
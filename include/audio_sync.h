@@ -0,0 +1,31 @@
+#ifndef __AUDIO_SYNC_H__
+#define __AUDIO_SYNC_H__
+
+#include <stddef.h>
+
+#include "audio_ring.h"
+
+// Adaptive fractional resampler in front of an audio ring. The SDR
+// and the sound card clocks never quite agree, so the resampling
+// rate is steered (by a few hundred ppm at most, in steady state)
+// to keep the ring fill at the target, instead of letting it drift
+// into overruns or underruns.
+typedef struct _audio_sync_t audio_sync_t;
+
+// `target` is the ring fill, in samples, to keep at the time a new
+// block is written, `max_input` the longest block written at once
+audio_sync_t *audio_sync_create(size_t target, size_t max_input);
+void audio_sync_destroy(audio_sync_t **q_p);
+
+// Resamples `n` samples into `ring` and returns the number written.
+// A drained ring (e.g. after a pause in the audio) is first refilled
+// with silence up to the target.
+size_t audio_sync_write(audio_sync_t *q, audio_ring_t *ring, const float *x,
+                        size_t n);
+
+// The current output/input rate
+double audio_sync_rate(audio_sync_t *q);
+// The smoothed ring fill the rate is steered by
+double audio_sync_fill(audio_sync_t *q);
+
+#endif // __AUDIO_SYNC_H__
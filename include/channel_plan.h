@@ -0,0 +1,34 @@
+#ifndef __CHANNEL_PLAN_H__
+#define __CHANNEL_PLAN_H__
+
+#include <stdbool.h>
+
+// The channel mask is a 64-bit word
+#define CHANNEL_PLAN_MAX_CHANNELS (64U)
+
+// A band of equally spaced, adjacent channels. Channel k (from 0) is
+// centred at band_start_hz + (k + 1/2) * channel_width_hz, and its
+// demodulated audio comes at channel_width_hz samples per second.
+typedef struct
+{
+    const char *name;
+    double band_start_hz;
+    unsigned int channel_width_hz;
+    unsigned int num_channels;
+} channel_plan_t;
+
+// Parses either a preset name (e.g. "pmr446", "dpmr446"), or a custom
+// plan given as "START_HZ,WIDTH_HZ,COUNT", e.g. "446.1e6,6250,16".
+// The number of channels has to be even and at most
+// CHANNEL_PLAN_MAX_CHANNELS.
+bool channel_plan_parse(const char *spec, channel_plan_t *plan);
+// Logs the presets, one per line
+void channel_plan_list(void);
+void channel_plan_print(const channel_plan_t *plan);
+
+// The total width of the band, i.e. the channelizer input sample rate
+unsigned long channel_plan_bandwidth(const channel_plan_t *plan);
+double channel_plan_center_hz(const channel_plan_t *plan);
+double channel_plan_channel_hz(const channel_plan_t *plan, unsigned int k);
+
+#endif // __CHANNEL_PLAN_H__
@@ -0,0 +1,53 @@
+#ifndef __CHANNELIZER_H__
+#define __CHANNELIZER_H__
+
+#include <complex.h>
+#include <stddef.h>
+
+// Critically sampled polyphase analysis filterbank working on whole
+// blocks of samples. The input is first shifted by (N - 1) / 2N of the
+// sample rate, so channel 0 is the lowest one in the band, and then
+// split into N channels, written channel-major to the output. Any even
+// N works, 8, 16, 32 and 64 channels get kernels unrolled for them.
+typedef struct _channelizer_t channelizer_t;
+
+// Squelch statistics of the output, see channelizer_set_energy_block()
+typedef struct
+{
+    // The sum of |y|^2 of channel k over block b, at [b * N + k]
+    float *energy;
+    // The index of the sample following block b, in the output of the call
+    size_t *end;
+    size_t max_blocks;
+    // Set by channelizer_execute()
+    size_t num_blocks;
+} channelizer_energy_t;
+
+// `m` is the prototype filter semi-length (in symbols) and `as` its
+// stop-band attenuation, as in `firpfbch_crcf_create_kaiser`
+channelizer_t *channelizer_create(unsigned int num_channels, unsigned int m,
+                                  float as, size_t max_input);
+void channelizer_destroy(channelizer_t **q_p);
+void channelizer_reset(channelizer_t *q);
+void channelizer_print(channelizer_t *q);
+
+// The squelch statistics are summed over blocks of `block_len` output
+// samples, counted across the calls, so a block can span two of them.
+// 0 (the default) makes a block of each call.
+void channelizer_set_energy_block(channelizer_t *q, size_t block_len);
+// The most blocks a call with `nx` input samples can complete
+size_t channelizer_max_energy_blocks(channelizer_t *q, size_t nx);
+
+// Processes `nx` input samples (at most `max_input`) and returns the
+// number of samples produced per channel. Channel `k` is written to
+// `y[k * stride]` and onwards. Samples not filling a whole frame are
+// kept for the next call. Unless `energy` is NULL, the statistics of the
+// blocks completed in the call are stored there. It has to be given
+// either always or never, the partial blocks carry over.
+size_t channelizer_execute(channelizer_t *q, complex float const *x, size_t nx,
+                           complex float *y, size_t stride,
+                           channelizer_energy_t *energy);
+
+unsigned int channelizer_num_channels(channelizer_t *q);
+
+#endif // __CHANNELIZER_H__
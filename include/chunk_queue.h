@@ -0,0 +1,63 @@
+#ifndef __CHUNK_QUEUE_H__
+#define __CHUNK_QUEUE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// A single sample chunk travelling between pipeline stages.
+// The payload is allocated once, when the queue is created,
+// and then recycled between the producer and the consumer.
+typedef struct _chunk_t
+{
+    void *data;
+    size_t len;
+    long long time_ns;
+    // Host clock time the first sample was taken at, 0 if unknown
+    uint64_t capture_ns;
+    int flags;
+    uint64_t seq;
+    // Optional chunk from an upstream queue kept alive
+    // together with this one (released by the final consumer)
+    struct _chunk_t *ref;
+} chunk_t;
+
+typedef struct
+{
+    const char *name;
+    size_t depth;
+    size_t used;
+    size_t high_watermark;
+    uint64_t pushed;
+    uint64_t dropped;
+} chunk_queue_stats_t;
+
+typedef struct _chunk_queue_t chunk_queue_t;
+
+// The chunk payloads come from `arena` (each one aligned),
+// or from the heap if it's NULL
+chunk_queue_t *chunk_queue_create(const char *name, size_t depth,
+                                  size_t chunk_size, arena_t *arena);
+void chunk_queue_destroy(chunk_queue_t **q_p);
+
+// Producer side
+chunk_t *chunk_queue_acquire(chunk_queue_t *q, bool wait);
+void chunk_queue_push(chunk_queue_t *q, chunk_t *c);
+void chunk_queue_count_drop(chunk_queue_t *q);
+
+// Consumer side
+chunk_t *chunk_queue_pop(chunk_queue_t *q);
+// Doesn't wait, NULL if there are no full chunks. Also lets a producer
+// take back the oldest chunk pushed, to drop it and reuse its buffer.
+chunk_t *chunk_queue_try_pop(chunk_queue_t *q);
+void chunk_queue_release(chunk_queue_t *q, chunk_t *c);
+
+// Wakes up all waiters, `chunk_queue_pop` returns NULL
+// once all the pushed chunks are consumed
+void chunk_queue_close(chunk_queue_t *q);
+
+void chunk_queue_get_stats(chunk_queue_t *q, chunk_queue_stats_t *stats);
+
+#endif // __CHUNK_QUEUE_H__
@@ -0,0 +1,65 @@
+#ifndef __CTCSS_H__
+#define __CTCSS_H__
+
+#include <liquid/liquid.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "simd.h"
+
+#define CTCSS_NUM_FREQS (38U)
+// The tone bank is padded to a whole number of 8-float vectors
+#define CTCSS_NUM_LANES (40U)
+
+extern const float ctcss_freqs[CTCSS_NUM_FREQS];
+
+// Bank of Goertzel filters, one per CTCSS tone, running on the sub-audio
+// decimated to around 1kHz. The window is split into hops and the tones
+// are evaluated over the last `window` samples after every hop. The filter
+// state is kept as structure-of-arrays, so all the tones are updated at
+// once with vector instructions.
+typedef struct
+{
+    float coef[CTCSS_NUM_LANES] __attribute__((aligned(SIMD_ALIGNMENT)));
+    float u0[CTCSS_NUM_LANES] __attribute__((aligned(SIMD_ALIGNMENT)));
+    float u1[CTCSS_NUM_LANES] __attribute__((aligned(SIMD_ALIGNMENT)));
+    // Power of each tone over the last window, normalized to its length
+    float power[CTCSS_NUM_FREQS];
+    float max_power;
+    int max_power_index;
+    bool tone_detected;
+
+    float sample_rate;
+    unsigned int decim_factor;
+    firdecim_rrrf decim;
+    float *decim_pending;
+    size_t num_decim_pending;
+    float *sub_buf;
+    size_t hop;
+    size_t samp_processed;
+    double omega[CTCSS_NUM_FREQS];
+    // Phase of each tone at the start of the current hop
+    double phase[CTCSS_NUM_FREQS];
+    // Complex sums of the last `num_segs` hops, per tone
+    float *seg_re;
+    float *seg_im;
+    unsigned int num_segs;
+    unsigned int seg_index;
+    unsigned int segs_filled;
+} ctcss_detector_t;
+
+// `window` and `hop` are in samples at `sample_rate`
+ctcss_detector_t *ctcss_detector_create(float sample_rate, size_t window,
+                                        size_t hop);
+void ctcss_detector_destroy(ctcss_detector_t **ctcss_p);
+void ctcss_detector_reset(ctcss_detector_t *ctcss);
+
+void ctcss_detector_analyze(ctcss_detector_t *ctcss, float const *xs,
+                            size_t nx);
+
+// One tone at a time reference implementation of the above,
+// for benchmarking and verifying the vectorized one
+void ctcss_detector_analyze_scalar(ctcss_detector_t *ctcss, float const *xs,
+                                   size_t nx);
+
+#endif // __CTCSS_H__
@@ -0,0 +1,28 @@
+#ifndef __DECIMATOR_H__
+#define __DECIMATOR_H__
+
+#include <complex.h>
+#include <stddef.h>
+
+// Integer-factor decimator for complex samples. The factor is split into
+// an odd part, handled by a CIC filter running on the input, followed by
+// a chain of halfband filters, one for each factor of two.
+typedef struct _decimator_t decimator_t;
+
+// NULL if the odd part of `factor` is too large, or if the CIC filter
+// would droop by more than 1 dB at the edge of the output band, i.e.
+// without enough halfband stages after it (odd factors have none)
+decimator_t *decimator_create(unsigned int factor, float as, size_t max_input);
+void decimator_destroy(decimator_t **q_p);
+void decimator_reset(decimator_t *q);
+void decimator_print(decimator_t *q);
+
+// Processes `nx` samples (at most `max_input`) into `y` and returns the
+// number of output samples. Input samples not making up a whole output
+// sample are kept for the next call.
+size_t decimator_execute(decimator_t *q, complex float const *x, size_t nx,
+                         complex float *y);
+
+unsigned int decimator_factor(decimator_t *q);
+
+#endif // __DECIMATOR_H__
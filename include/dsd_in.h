@@ -8,20 +8,47 @@
 
 #include <liquid/liquid.h>
 
+#include "decimator.h"
+#include "iq_source.h"
+#include "rational_resampler.h"
+
 #define SDR_SAMPLERATE (1024000UL)
 
+// What the DSP does when the output can't keep up with it
+typedef enum
+{
+    // Wait for the output, the capture drops chunks instead
+    output_policy_block = 0,
+    // Discard the oldest audio not written yet
+    output_policy_drop_oldest,
+    // Discard the newest audio, and log it
+    output_policy_report,
+} output_policy_e;
+
 struct arguments
 {
     char *args[1];
     float gain;
     float frequency;
+    double sample_rate;
+    char *input;
+    iq_format_e input_format;
+    bool realtime;
+    output_policy_e output_policy;
+    size_t queue_depth;
 };
 
 struct _proc_chain_t
 {
     SoapySDRDevice *sdr;
     SoapySDRStream *rxStream;
+    iq_source_t *iq_src;
     iirfilt_crcf dcblock;
+    // Integer decimation to `sig_rate` and rational resampling from it,
+    // or the arbitrary rate resamplers if the capture rate doesn't allow
+    decimator_t *decimator;
+    rational_resampler_t *audio_src;
+    unsigned int sig_rate;
     msresamp_crcf res_down;
     msresamp_rrrf res_up;
     freqdem fm_demod;
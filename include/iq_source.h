@@ -0,0 +1,34 @@
+#ifndef __IQ_SOURCE_H__
+#define __IQ_SOURCE_H__
+
+#include <complex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum
+{
+    IQ_FORMAT_CF32 = 0,  // interleaved 32-bit floats
+    IQ_FORMAT_CS16,      // interleaved signed 16-bit integers
+    IQ_FORMAT_CU8,       // interleaved unsigned bytes, as rtl_sdr writes
+} iq_format_e;
+
+// Recorded IQ samples, memory-mapped from a file, delivered either as
+// fast as they are consumed or paced to the sample rate like a live SDR
+typedef struct _iq_source_t iq_source_t;
+
+// Parses a format name ("cf32", "cs16" or "cu8")
+bool iq_format_parse(const char *name, iq_format_e *format);
+
+iq_source_t *iq_source_create(const char *path, iq_format_e format,
+                              double sample_rate, bool paced);
+void iq_source_destroy(iq_source_t **src_p);
+
+// Converts up to `n` samples into `y` and returns their count, zero at the
+// end of the file. `time_ns` is set to the time of the first one, counted
+// from the start of the file.
+size_t iq_source_read(iq_source_t *src, complex float *y, size_t n,
+                      long long *time_ns);
+
+size_t iq_source_num_samples(iq_source_t *src);
+
+#endif // __IQ_SOURCE_H__
@@ -0,0 +1,58 @@
+#ifndef __IQ_WRITER_H__
+#define __IQ_WRITER_H__
+
+#include <complex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "iq_source.h"
+
+// Raw IQ capture to disk, at the full SDR rate. The samples are
+// converted into large page-aligned blocks, written out by a thread
+// of its own with O_DIRECT (no page cache to fill up and flush in
+// bursts), into files rotated by size or time. Each data file gets
+// a SigMF (https://sigmf.org) `.sigmf-meta` sidecar.
+typedef struct _iq_writer_t iq_writer_t;
+
+typedef struct
+{
+    // Files are named `<prefix>-NNNN.sigmf-data` and `.sigmf-meta`
+    const char *prefix;
+    iq_format_e format;
+    double sample_rate;
+    double frequency;
+    double gain;
+    // Rotation limits, 0 = none
+    uint64_t max_file_bytes;
+    unsigned int max_file_s;
+    // For the block pool, see arena_create()
+    unsigned int arena_flags;
+} iq_writer_config_t;
+
+typedef struct
+{
+    uint64_t files;
+    uint64_t bytes;
+    // No free block to convert them into (the disk couldn't keep up),
+    // or the write failed
+    uint64_t dropped_samples;
+    // Time spent in the writes, for the disk throughput
+    uint64_t write_ns;
+    uint64_t max_write_ns;
+} iq_writer_stats_t;
+
+iq_writer_t *iq_writer_create(const iq_writer_config_t *config);
+void iq_writer_destroy(iq_writer_t **q_p);
+// Writes out everything buffered and closes the file,
+// nothing can be captured anymore after that
+void iq_writer_finish(iq_writer_t *q);
+
+// Called from a single thread, never blocks
+void iq_writer_write(iq_writer_t *q, complex float const *x, size_t n);
+// Samples were lost before the next ones, they go to a new file
+void iq_writer_discontinuity(iq_writer_t *q);
+
+void iq_writer_get_stats(iq_writer_t *q, iq_writer_stats_t *stats);
+void iq_writer_print_stats(iq_writer_t *q);
+
+#endif // __IQ_WRITER_H__
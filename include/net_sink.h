@@ -0,0 +1,72 @@
+#ifndef __NET_SINK_H__
+#define __NET_SINK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streams the audio of every channel over the network, as 16-bit PCM
+// packets. With `udp://HOST:PORT` the packets are sent to HOST (unicast,
+// broadcast or multicast), batched with sendmmsg(). With `tcp://[HOST]:PORT`
+// the receivers connect to PORT and get the same packets as a stream.
+// The calls only queue the audio up, a thread of its own does the
+// sending, with non-blocking sockets: what a full socket buffer or a
+// slow TCP client can't take is dropped (and counted), it never holds
+// up the caller.
+//
+// Every packet is a header, all fields little-endian:
+//
+//   0  "PMRA"
+//   4  u8  version (1)
+//   5  u8  channel, from 1
+//   6  u8  flags, NET_SINK_FLAG_*
+//   7  u8  CTCSS code, from 1, 0 = none detected
+//   8  u32 sequence number, per channel, +1 for every packet
+//   12 u32 sample rate
+//   16 u64 host clock (CLOCK_REALTIME) time of the first sample in [ns]
+//   24 u32 number of samples
+//
+// followed by the samples (s16le, mono). The end of a transmission is
+// marked by an empty packet.
+typedef struct _net_sink_t net_sink_t;
+
+#define NET_SINK_HEADER_LEN (28)
+#define NET_SINK_VERSION (1)
+// The first packet of a transmission
+#define NET_SINK_FLAG_START (1 << 0)
+// The last one, no samples
+#define NET_SINK_FLAG_END (1 << 1)
+
+typedef struct
+{
+    uint64_t packets;
+    uint64_t bytes;
+    // TCP clients currently connected
+    uint64_t clients;
+    // No room in the queue to the sending thread
+    uint64_t dropped_samples;
+    // No room in the socket buffer, or in a TCP client's backlog,
+    // and opens or closes lost with the sending thread starved of CPU
+    uint64_t dropped_packets;
+    uint64_t errors;
+} net_sink_stats_t;
+
+// Sends to (or listens on) `url`, audio at `rate` S/s, `max_block`
+// is the longest block of samples queued up at once (longer ones are
+// split). NULL if the URL is invalid or the socket can't be set up.
+net_sink_t *net_sink_create(const char *url, unsigned int rate,
+                            size_t max_block);
+void net_sink_destroy(net_sink_t **q_p);
+// Sends out everything queued up, nothing can be streamed anymore
+// after that
+void net_sink_finish(net_sink_t *q);
+
+// Called from a single thread, never block
+void net_sink_open(net_sink_t *q, unsigned int channel);
+void net_sink_write(net_sink_t *q, unsigned int channel, int ctcss_code,
+                    float const *x, size_t n);
+void net_sink_close(net_sink_t *q, unsigned int channel);
+
+void net_sink_get_stats(net_sink_t *q, net_sink_stats_t *stats);
+void net_sink_print_stats(net_sink_t *q);
+
+#endif // __NET_SINK_H__
@@ -0,0 +1,12 @@
+#ifndef __PCM_H__
+#define __PCM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Converts `n` samples to 16-bit PCM, `x * scale` saturated to the
+// int16_t range (and truncated towards zero), so that an overdriven
+// signal clips instead of wrapping around
+void pcm_float_to_s16(float const *x, size_t n, float scale, int16_t *y);
+
+#endif // __PCM_H__
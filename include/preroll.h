@@ -0,0 +1,36 @@
+#ifndef __PREROLL_H__
+#define __PREROLL_H__
+
+#include <complex.h>
+#include <stddef.h>
+
+// The last samples of a closed channel, so its audio from before the
+// squelch opened can still be demodulated for the channel sinks. Kept
+// by value in the channel, the samples are stored in `buf`, which the
+// caller provides (e.g. from the arena).
+typedef struct
+{
+    complex float *buf;
+    size_t len;
+    size_t pos;
+    size_t fill;
+    // Already demodulated part of the next chunk pushed
+    size_t skip;
+} preroll_t;
+
+void preroll_init(preroll_t *p, complex float *buf, size_t len);
+
+// Starts over when the channel closes, `demodulated` samples into the
+// current chunk. Those belong to the transmission that just ended, so
+// they're left out when the chunk is pushed.
+void preroll_reset(preroll_t *p, size_t demodulated);
+
+// Keeps the last `len` samples of the channel while it's closed
+void preroll_push(preroll_t *p, complex float const *x, size_t n);
+
+// The samples kept, oldest first, in at most two parts. Returns the
+// number of parts.
+size_t preroll_get(preroll_t *p, complex float *part[2],
+                   size_t part_len[2]);
+
+#endif // __PREROLL_H__
@@ -0,0 +1,47 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Execution time histograms of the stages of the processing loop.
+// A stage is timed with `profiler_start` and `profiler_record`, both
+// free when the profiler is NULL. Every stage can be recorded from a
+// thread of its own and read (`profiler_print`) from any other thread.
+typedef struct _profiler_t profiler_t;
+
+typedef struct
+{
+    const char *name;
+    uint64_t count;
+    uint64_t samples;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    double avg_ns;
+} profiler_stats_t;
+
+profiler_t *profiler_create(const char *const *names, size_t num_stages);
+void profiler_destroy(profiler_t **p_p);
+
+static inline uint64_t profiler_start(profiler_t *p)
+{
+    if (!p)
+    {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// Records the time since `start` (from `profiler_start`)
+// of a run of `stage` that processed `samples` samples
+void profiler_record(profiler_t *p, size_t stage, uint64_t start,
+                     size_t samples);
+
+void profiler_get_stats(profiler_t *p, size_t stage, profiler_stats_t *stats);
+void profiler_print(profiler_t *p);
+
+#endif // __PROFILER_H__
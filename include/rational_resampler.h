@@ -0,0 +1,28 @@
+#ifndef __RATIONAL_RESAMPLER_H__
+#define __RATIONAL_RESAMPLER_H__
+
+#include <stddef.h>
+
+// Polyphase resampler of real samples by an exact rational factor,
+// e.g. 12500 -> 48000 S/s (96/25). Only the filter phase picked by
+// each output sample is computed, as a SIMD dot product.
+typedef struct _rational_resampler_t rational_resampler_t;
+
+// Converts from `in_rate` to `out_rate` (the ratio is reduced, so any
+// pair of integer rates works), with a stop-band attenuation of `as`
+// above the lower of the two Nyquist frequencies
+rational_resampler_t *rational_resampler_create(unsigned int in_rate,
+                                                unsigned int out_rate,
+                                                float as, size_t max_input);
+void rational_resampler_destroy(rational_resampler_t **q_p);
+void rational_resampler_reset(rational_resampler_t *q);
+void rational_resampler_print(rational_resampler_t *q);
+
+// The most samples `nx` (at most `max_input`) input samples can produce
+size_t rational_resampler_max_output(rational_resampler_t *q, size_t nx);
+
+// Processes `nx` samples into `y` and returns the number of output samples
+size_t rational_resampler_execute(rational_resampler_t *q, float const *x,
+                                  size_t nx, float *y);
+
+#endif // __RATIONAL_RESAMPLER_H__
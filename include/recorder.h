@@ -0,0 +1,41 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Archives the audio of every transmission to a WAV file of its own
+// (16-bit mono), named after the channel, the CTCSS code and the time
+// the transmission started, e.g. `ch05_ctcss12_20240101-120000.250.wav`.
+// The calls only queue the audio up, the files are written by a thread
+// of its own through large buffers, so a slow disk never holds the
+// caller up. Audio not fitting in the queue is dropped (and counted).
+typedef struct _recorder_t recorder_t;
+
+typedef struct
+{
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t dropped_samples;
+    uint64_t errors;
+} recorder_stats_t;
+
+// Files go to `dir`, at `rate` S/s, `max_block` is the longest
+// block of samples queued up at once (longer ones are split)
+recorder_t *recorder_create(const char *dir, unsigned int rate,
+                            size_t max_block);
+void recorder_destroy(recorder_t **q_p);
+// Writes out everything queued up and finishes the files still
+// open, nothing can be recorded anymore after that
+void recorder_finish(recorder_t *q);
+
+// Called from a single thread. `ctcss_code` is the one currently
+// detected (0 if none), the last one seen ends up in the file name.
+void recorder_open(recorder_t *q, unsigned int channel);
+void recorder_write(recorder_t *q, unsigned int channel, int ctcss_code,
+                    float const *x, size_t n);
+void recorder_close(recorder_t *q, unsigned int channel);
+
+void recorder_get_stats(recorder_t *q, recorder_stats_t *stats);
+
+#endif // __RECORDER_H__
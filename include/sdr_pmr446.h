@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #include <SoapySDR/Device.h>
 
@@ -10,8 +11,25 @@
 
 #include <rtaudio/rtaudio_c.h>
 
+#include "arena.h"
+#include "audio_ring.h"
+#include "audio_sync.h"
+#include "channel_plan.h"
+#include "channelizer.h"
+#include "ctcss.h"
+#include "decimator.h"
+#include "iq_source.h"
+#include "iq_writer.h"
+#include "net_sink.h"
+#include "preroll.h"
+#include "profiler.h"
+#include "rational_resampler.h"
+#include "recorder.h"
+#include "waterfall.h"
+#include "worker_pool.h"
+
 #define SDR_SAMPLERATE (1024000UL)
-#define CTCSS_NUM_FREQS (38U)
+#define MAX_CHANNEL_SINKS (4)
 
 typedef enum
 {
@@ -33,33 +51,94 @@ struct arguments
     float audio_gain;
     enum rtaudio_api audio_api;
     float squelch_level;
+    unsigned int squelch_block_ms;
     size_t waterfall;
+    unsigned int waterfall_fps;
+    // Drawn from the channelizer output, 0 = from an FFT of the band
+    unsigned int waterfall_bins;
     bool lowpass;
     uint64_t channel_mask;
     lock_mode_e lock_mode;
+    bool pipeline;
+    size_t queue_depth;
+    unsigned int chunk_ms;
+    unsigned int audio_latency_ms;
+    unsigned int audio_target_ms;
+    bool monitor_all;
+    size_t num_workers;
+    double sample_rate;
+    bool hugepages;
+    bool mlock;
+    char *input;
+    iq_format_e input_format;
+    bool realtime;
+    char *audio_out;
+    bool profile;
+    bool fill_gaps;
+    char *record_dir;
+    unsigned int preroll_ms;
+    char *iq_capture;
+    iq_format_e iq_capture_format;
+    unsigned int iq_rotate_mb;
+    unsigned int iq_rotate_s;
+    char *net_stream;
+    channel_plan_t plan;
 };
 
-typedef struct {
-    float k[CTCSS_NUM_FREQS];
-    float coef[CTCSS_NUM_FREQS];
-    float u0[CTCSS_NUM_FREQS];
-    float u1[CTCSS_NUM_FREQS];
-    float power[CTCSS_NUM_FREQS];
-    float max_power;
-    int max_power_index;
-    size_t samp_processed;
-    bool tone_detected;
-} ctcss_detector_t;
+// Samples lost on the way, the counters are updated with relaxed atomics
+// by the capture stage and read by whoever reports them
+typedef struct
+{
+    // Reported by the driver, with an unknown number of samples lost
+    uint64_t overflows;
+    uint64_t errors;
+    // Discontinuities of the SDR timestamps and the samples missing in them
+    uint64_t gaps;
+    uint64_t gap_samples;
+    // Zeros inserted in place of the missing samples ('-Z')
+    uint64_t filled_samples;
+    // Chunks the pipelined front-end was too busy for
+    uint64_t dropped_samples;
+    // Capture stage only
+    bool has_time;
+    long long next_time_ns;
+} sample_loss_t;
 
-struct _proc_chain_t
+// From the capture of the samples to the audio callback handing
+// them over to the sound card
+typedef struct
 {
-    SoapySDRDevice *sdr;
-    SoapySDRStream *rxStream;
-    rtaudio_t dac;
-    iirfilt_crcf dcblock;
-    msresamp_crcf resampler;
-    nco_crcf nco;
-    firpfbch_crcf channelizer;
+    // SDR clock to host clock offset, see capture_time()
+    bool has_offset;
+    long long offset_ns;
+    // A single stage histogram, NULL without a sound card
+    profiler_t *hist;
+    // Reported by the sound card, on top of the measured latency
+    long device_frames;
+} latency_t;
+
+typedef struct _channel_t channel_t;
+
+// Consumer of the demodulated audio of the individual channels.
+// All the callbacks are made from the demodulator stage thread.
+typedef struct
+{
+    void *ctx;
+    void (*open)(void *ctx, const channel_t *ch);
+    void (*write)(void *ctx, const channel_t *ch, float const *x, size_t n);
+    void (*close)(void *ctx, const channel_t *ch);
+} channel_sink_t;
+
+// Demodulator state of a single channel
+struct _channel_t
+{
+    int index;
+    bool open;
+    // Closed by the squelch in the current chunk, once demodulated
+    bool closing;
+    // The part of the current chunk to demodulate
+    size_t demod_start;
+    size_t demod_end;
     freqdem fm_demod;
     firfilt_rrrf ctcss_filt;
     wdelayf ctcss_lp_delay;
@@ -70,15 +149,71 @@ struct _proc_chain_t
 #else
     iirfilt_rrrf deemph;
 #endif
-    cbuffercf resamp_buf;
-    cbufferf audio_buf;
-    asgramcf asgram;
-    proc_chain_state_e state;
     ctcss_detector_t *ctcss_detector;
+    float rssi;
+    float ctcss_freq;
+    float *ctcss_buf;
+    float *audio;
+    // The last `preroll_len` samples of the channel while it's closed,
+    // demodulated for the sinks once the squelch opens
+    preroll_t preroll;
+    bool preroll_pending;
+    float *preroll_audio;
+    size_t preroll_audio_len;
+};
+
+struct _proc_chain_t
+{
+    SoapySDRDevice *sdr;
+    SoapySDRStream *rxStream;
+    // Recorded input, replaces the SDR when set
+    iq_source_t *iq_src;
+    rtaudio_t dac;
+    FILE *audio_out;
+    double sample_rate;
+    // Per chunk, sized for the channel plan at `sample_rate`
+    size_t input_chunk;
+    size_t resamp_buf_size;
+    size_t chan_buf_size;
+    // Squelch decision interval in channel samples, 0 = once per chunk
+    size_t squelch_block;
+    iirfilt_crcf dcblock;
+    // Integer factor decimator, or the arbitrary rate
+    // resampler if the SDR sample rate is not a multiple
+    decimator_t *decimator;
+    msresamp_crcf resampler;
+    channelizer_t *channelizer;
+    channel_t *channels;
+    worker_pool_t *workers;
+    arena_t *arena;
+    // Stage timing, NULL unless enabled
+    profiler_t *profiler;
+    sample_loss_t loss;
+    latency_t latency;
+    channel_sink_t sinks[MAX_CHANNEL_SINKS];
+    size_t num_sinks;
+    // Channel samples of pre-roll, 0 = none
+    size_t preroll_len;
+    // Transmissions archived to WAV files, NULL unless enabled
+    recorder_t *recorder;
+    // The audio streamed over the network, NULL unless enabled
+    net_sink_t *net_sink;
+    // The raw SDR samples to disk, NULL unless enabled
+    iq_writer_t *iq_writer;
+    float *mix_buf;
+    // Sound card rate, and the conversion to it
+    unsigned int audio_rate;
+    rational_resampler_t *audio_src;
+    float *audio_src_buf;
+    audio_ring_t *audio_buf;
+    // Keeps the audio buffer fill steady, NULL if disabled
+    audio_sync_t *audio_sync;
+    // The terminal output, NULL without '-w'
+    waterfall_t *waterfall;
+    proc_chain_state_e state;
     struct arguments args;
     int active_chan;
     float rssi;
-    float ctcss_freq;
 };
 
 #endif // __SDR_PMR446_H__
\ No newline at end of file
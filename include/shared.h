@@ -13,7 +13,7 @@
 
 typedef struct _proc_chain_t proc_chain_t;
 
-bool init_soapy(proc_chain_t *chain);
+bool init_soapy(proc_chain_t *chain, double sample_rate);
 void destroy_soapy(proc_chain_t *chain);
 
 #endif // __SHARED_H__
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <string.h>
+
+// Portable SIMD helpers built on the GCC vector extensions,
+// so the same kernels map to SSE/AVX on x86 and NEON on ARM
+
+#define SIMD_ALIGNMENT (64)
+
+// Hot kernels wider than the x86-64 baseline get an AVX2 clone,
+// picked at load time by the CPU the program runs on
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SIMD_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef SIMD_TARGET_CLONES
+#define SIMD_TARGET_CLONES
+#endif
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+// Only used inside kernels, passing it by value to a function
+// would depend on AVX being enabled at the call site
+typedef float v8sf __attribute__((vector_size(32)));
+
+// Unaligned load/store (memcpy compiles down to a single move)
+static inline v4sf v4sf_load(float const *p)
+{
+    v4sf v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void v4sf_store(float *p, v4sf v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline v4sf v4sf_set1(float x)
+{
+    return (v4sf){x, x, x, x};
+}
+
+// (a, b, c, d) -> (b, a, d, c), i.e. swaps the real and imaginary
+// parts of two interleaved complex numbers
+static inline v4sf v4sf_swap_pairs(v4sf v)
+{
+    return __builtin_shuffle(v, (v4si){1, 0, 3, 2});
+}
+
+// (a, b, c, d) -> (c, d, a, b), i.e. reverses the order
+// of two interleaved complex numbers
+static inline v4sf v4sf_swap_halves(v4sf v)
+{
+    return __builtin_shuffle(v, (v4si){2, 3, 0, 1});
+}
+
+static inline float v4sf_hsum(v4sf v)
+{
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+#endif // __SIMD_H__
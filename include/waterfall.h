@@ -0,0 +1,59 @@
+#ifndef __WATERFALL_H__
+#define __WATERFALL_H__
+
+#include <complex.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per channel, see waterfall_create_channels()
+#define WATERFALL_MAX_BINS (16)
+
+// ASCII waterfall drawn on stdout by a low priority thread. The
+// receiver hands a chunk of samples over only when a frame is due
+// and the renderer is idle, otherwise the frame is dropped, so
+// a slow terminal can never hold the signal processing up.
+typedef struct _waterfall_t waterfall_t;
+
+typedef struct
+{
+    uint64_t frames;
+    // Due while the previous one was still being drawn
+    uint64_t dropped;
+} waterfall_stats_t;
+
+// `width` characters of spectrum, from at most `max_samples` per
+// frame, followed by a footer line of up to `footer_len` characters
+waterfall_t *waterfall_create(size_t width, size_t max_samples,
+                              size_t footer_len, unsigned int fps);
+
+// Drawn from the output of the channelizer instead, no FFT of the band
+// needed: `num_channels` times `bins` bins, the level of each relative
+// to the median one. With a single bin per channel only the channel
+// energies are used, more bins come from short DFTs of the (at most
+// `chan_len`) samples of each channel.
+waterfall_t *waterfall_create_channels(size_t width, unsigned int num_channels,
+                                       unsigned int bins, size_t chan_len,
+                                       size_t footer_len, unsigned int fps);
+
+void waterfall_destroy(waterfall_t **q_p);
+
+// True if the next frame should be submitted now, called
+// (from a single thread) once per chunk of samples
+bool waterfall_frame_due(waterfall_t *q);
+
+// Copies the samples and the footer and wakes the renderer up.
+// Only valid after waterfall_frame_due() returned true.
+void waterfall_submit(waterfall_t *q, complex float const *x, size_t n,
+                      float rssi, const char *footer);
+
+// The same for waterfall_create_channels(): `power` is the energy of each
+// channel and `y` the `ns` samples of channel k at `y[k * stride]`,
+// only read (and copied) with more than one bin per channel
+void waterfall_submit_channels(waterfall_t *q, float const *power,
+                               complex float const *y, size_t stride,
+                               size_t ns, float rssi, const char *footer);
+
+void waterfall_get_stats(waterfall_t *q, waterfall_stats_t *stats);
+
+#endif // __WATERFALL_H__
@@ -0,0 +1,23 @@
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <stddef.h>
+
+// Fixed pool of threads executing a parallel-for over a set of items.
+// The calling thread takes part in the work too, so a pool created
+// with `num_workers` == 1 doesn't start any threads at all.
+typedef struct _worker_pool_t worker_pool_t;
+
+typedef void (*worker_fn_t)(void *ctx, size_t item);
+
+worker_pool_t *worker_pool_create(size_t num_workers);
+void worker_pool_destroy(worker_pool_t **pool_p);
+
+// Calls `fn(ctx, i)` for every `i` in [0, num_items) and
+// returns when all of them are finished
+void worker_pool_run(worker_pool_t *pool, worker_fn_t fn, void *ctx,
+                     size_t num_items);
+
+size_t worker_pool_size(worker_pool_t *pool);
+
+#endif // __WORKER_POOL_H__
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include "arena.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+#define ARENA_HUGEPAGE_SIZE (2UL * 1024 * 1024)
+
+struct _arena_t
+{
+    uint8_t *base;
+    size_t size;
+    size_t mapped;
+    size_t used;
+    bool hugepages;
+    bool locked;
+};
+
+static size_t round_up(size_t size, size_t to)
+{
+    return ((size + to - 1) / to) * to;
+}
+
+arena_t *arena_create(size_t size, unsigned int flags)
+{
+    log_assert(size > 0);
+
+    arena_t *self = calloc(1, sizeof(arena_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->size = size;
+    self->base = MAP_FAILED;
+
+    if (flags & ARENA_HUGEPAGES)
+    {
+        self->mapped = round_up(size, ARENA_HUGEPAGE_SIZE);
+        self->base = mmap(NULL, self->mapped, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                          -1, 0);
+        if (self->base != MAP_FAILED)
+        {
+            self->hugepages = true;
+        }
+        else
+        {
+            LOG(WARN,
+                "Failed to map %lu bytes of huge pages (%s), falling back to "
+                "transparent huge pages",
+                self->mapped, strerror(errno));
+        }
+    }
+
+    if (self->base == MAP_FAILED)
+    {
+        self->mapped = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+        self->base = mmap(NULL, self->mapped, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (self->base == MAP_FAILED)
+        {
+            LOG(ERROR, "Failed to map %lu bytes: %s", self->mapped,
+                strerror(errno));
+            free(self);
+            return NULL;
+        }
+        if (flags & ARENA_HUGEPAGES)
+        {
+            madvise(self->base, self->mapped, MADV_HUGEPAGE);
+        }
+    }
+
+    if (flags & ARENA_MLOCK)
+    {
+        if (mlock(self->base, self->mapped) == 0)
+        {
+            self->locked = true;
+        }
+        else
+        {
+            LOG(WARN, "Failed to lock %lu bytes in memory (%s), check 'ulimit -l'",
+                self->mapped, strerror(errno));
+        }
+    }
+
+    return self;
+}
+
+void arena_destroy(arena_t **arena_p)
+{
+    log_assert(arena_p);
+    if (*arena_p)
+    {
+        arena_t *arena = *arena_p;
+        if (arena->locked)
+        {
+            munlock(arena->base, arena->mapped);
+        }
+        munmap(arena->base, arena->mapped);
+        free(arena);
+        *arena_p = NULL;
+    }
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    const size_t block = arena_block_size(size);
+
+    if (block > arena->size - arena->used)
+    {
+        LOG(ERROR, "Arena exhausted: %lu bytes requested, %lu of %lu available",
+            size, arena->size - arena->used, arena->size);
+        return NULL;
+    }
+
+    // Fresh anonymous mappings are zeroed already
+    void *p = &arena->base[arena->used];
+    arena->used += block;
+
+    return p;
+}
+
+size_t arena_used(arena_t *arena)
+{
+    return arena->used;
+}
+
+size_t arena_size(arena_t *arena)
+{
+    return arena->size;
+}
+
+void arena_print(arena_t *arena)
+{
+    LOG(INFO, "Sample buffer arena: %lu/%lu bytes used, %s pages%s",
+        arena->used, arena->size, arena->hugepages ? "huge" : "regular",
+        arena->locked ? ", locked" : "");
+}
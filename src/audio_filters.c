@@ -0,0 +1,225 @@
+#include "audio_filters.h"
+
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The corners of the tables below, for designing them at other rates
+#define HP_AUDIO_CUTOFF_HZ (350.0f)
+#define HP_AUDIO_AS (80.0f)
+#define LP_AUDIO_CUTOFF_HZ (4750.0f)
+#define LP_AUDIO_MAX_CUTOFF (0.4f)
+#define LP_AUDIO_AS (60.0f)
+#define DEEMPH_TAU_S (50e-6)
+
+// clang-format off
+const float hp_audio_taps[HP_AUDIO_FILT_TAPS] = {
+    -0.00610107f,  0.00391676f,  0.00266218f,  0.00167537f,  0.00091408f,  0.00033810f, -0.00008332f, -0.00038047f,
+    -0.00057490f, -0.00068889f, -0.00073739f, -0.00073641f, -0.00069558f, -0.00062648f, -0.00053506f, -0.00043000f,
+    -0.00031466f, -0.00019579f, -0.00007544f,  0.00004086f,  0.00015223f,  0.00025372f,  0.00034510f,  0.00042207f,
+     0.00048485f,  0.00052948f,  0.00055715f,  0.00056456f,  0.00055370f,  0.00052215f,  0.00047310f,  0.00040486f,
+     0.00032220f,  0.00022396f,  0.00011684f,  0.00000041f, -0.00011969f, -0.00023528f, -0.00036035f, -0.00045462f,
+    -0.00055752f, -0.00063867f, -0.00069138f, -0.00072720f, -0.00074352f, -0.00073043f, -0.00068551f, -0.00061566f,
+    -0.00052415f, -0.00041128f, -0.00027567f, -0.00012230f,  0.00004259f,  0.00021043f,  0.00037704f,  0.00053688f,
+     0.00068651f,  0.00081869f,  0.00092803f,  0.00100683f,  0.00105219f,  0.00106040f,  0.00103204f,  0.00096555f,
+     0.00086322f,  0.00072470f,  0.00055435f,  0.00035501f,  0.00013467f, -0.00010118f, -0.00034187f, -0.00058131f,
+    -0.00080836f, -0.00101705f, -0.00119876f, -0.00134443f, -0.00145269f, -0.00150880f, -0.00151771f, -0.00147167f,
+    -0.00136820f, -0.00121415f, -0.00101046f, -0.00076114f, -0.00047418f, -0.00016074f,  0.00017216f,  0.00051372f,
+     0.00085220f,  0.00117333f,  0.00146710f,  0.00172173f,  0.00192738f,  0.00207220f,  0.00214969f,  0.00215391f,
+     0.00208363f,  0.00193645f,  0.00171542f,  0.00142398f,  0.00107118f,  0.00066574f,  0.00022115f, -0.00025085f,
+    -0.00073375f, -0.00121240f, -0.00166794f, -0.00208507f, -0.00244541f, -0.00273657f, -0.00294354f, -0.00305704f,
+    -0.00306830f, -0.00297137f, -0.00276761f, -0.00245649f, -0.00204759f, -0.00155007f, -0.00097536f, -0.00034322f,
+     0.00032939f,  0.00102072f,  0.00170755f,  0.00236430f,  0.00296923f,  0.00349782f,  0.00392881f,  0.00424190f,
+     0.00442290f,  0.00445786f,  0.00433928f,  0.00406265f,  0.00363191f,  0.00305345f,  0.00234105f,  0.00151132f,
+     0.00058896f, -0.00040026f, -0.00142513f, -0.00245412f, -0.00345042f, -0.00437964f, -0.00520503f, -0.00589429f,
+    -0.00641531f, -0.00674295f, -0.00685292f, -0.00673136f, -0.00636727f, -0.00575968f, -0.00491414f, -0.00384363f,
+    -0.00257142f, -0.00112603f,  0.00045449f,  0.00212549f,  0.00383932f,  0.00553935f,  0.00717039f,  0.00867240f,
+     0.00998642f,  0.01105318f,  0.01182001f,  0.01223528f,  0.01225579f,  0.01184400f,  0.01097392f,  0.00962636f,
+     0.00779583f,  0.00548611f,  0.00271515f, -0.00049071f, -0.00409137f, -0.00803824f, -0.01227001f, -0.01672007f,
+    -0.02131214f, -0.02596635f, -0.03059634f, -0.03511776f, -0.03944350f, -0.04349080f, -0.04717894f, -0.05043653f,
+    -0.05319598f, -0.05540353f, -0.05701288f, -0.05799162f,  0.94167965f, -0.05799162f, -0.05701288f, -0.05540353f,
+    -0.05319598f, -0.05043653f, -0.04717894f, -0.04349080f, -0.03944350f, -0.03511776f, -0.03059634f, -0.02596635f,
+    -0.02131214f, -0.01672007f, -0.01227001f, -0.00803824f, -0.00409137f, -0.00049071f,  0.00271515f,  0.00548611f,
+     0.00779583f,  0.00962636f,  0.01097392f,  0.01184400f,  0.01225579f,  0.01223528f,  0.01182001f,  0.01105318f,
+     0.00998642f,  0.00867240f,  0.00717039f,  0.00553935f,  0.00383932f,  0.00212549f,  0.00045449f, -0.00112603f,
+    -0.00257142f, -0.00384363f, -0.00491414f, -0.00575968f, -0.00636727f, -0.00673136f, -0.00685292f, -0.00674295f,
+    -0.00641531f, -0.00589429f, -0.00520503f, -0.00437964f, -0.00345042f, -0.00245412f, -0.00142513f, -0.00040026f,
+     0.00058896f,  0.00151132f,  0.00234105f,  0.00305345f,  0.00363191f,  0.00406265f,  0.00433928f,  0.00445786f,
+     0.00442290f,  0.00424190f,  0.00392881f,  0.00349782f,  0.00296923f,  0.00236430f,  0.00170755f,  0.00102072f,
+     0.00032939f, -0.00034322f, -0.00097536f, -0.00155007f, -0.00204759f, -0.00245649f, -0.00276761f, -0.00297137f,
+    -0.00306830f, -0.00305704f, -0.00294354f, -0.00273657f, -0.00244541f, -0.00208507f, -0.00166794f, -0.00121240f,
+    -0.00073375f, -0.00025085f,  0.00022115f,  0.00066574f,  0.00107118f,  0.00142398f,  0.00171542f,  0.00193645f,
+     0.00208363f,  0.00215391f,  0.00214969f,  0.00207220f,  0.00192738f,  0.00172173f,  0.00146710f,  0.00117333f,
+     0.00085220f,  0.00051372f,  0.00017216f, -0.00016074f, -0.00047418f, -0.00076114f, -0.00101046f, -0.00121415f,
+    -0.00136820f, -0.00147167f, -0.00151771f, -0.00150880f, -0.00145269f, -0.00134443f, -0.00119876f, -0.00101705f,
+    -0.00080836f, -0.00058131f, -0.00034187f, -0.00010118f,  0.00013467f,  0.00035501f,  0.00055435f,  0.00072470f,
+     0.00086322f,  0.00096555f,  0.00103204f,  0.00106040f,  0.00105219f,  0.00100683f,  0.00092803f,  0.00081869f,
+     0.00068651f,  0.00053688f,  0.00037704f,  0.00021043f,  0.00004259f, -0.00012230f, -0.00027567f, -0.00041128f,
+    -0.00052415f, -0.00061566f, -0.00068551f, -0.00073043f, -0.00074352f, -0.00072720f, -0.00069138f, -0.00063867f,
+    -0.00055752f, -0.00045462f, -0.00036035f, -0.00023528f, -0.00011969f,  0.00000041f,  0.00011684f,  0.00022396f,
+     0.00032220f,  0.00040486f,  0.00047310f,  0.00052215f,  0.00055370f,  0.00056456f,  0.00055715f,  0.00052948f,
+     0.00048485f,  0.00042207f,  0.00034510f,  0.00025372f,  0.00015223f,  0.00004086f, -0.00007544f, -0.00019579f,
+    -0.00031466f, -0.00043000f, -0.00053506f, -0.00062648f, -0.00069558f, -0.00073641f, -0.00073739f, -0.00068889f,
+    -0.00057490f, -0.00038047f, -0.00008332f,  0.00033810f,  0.00091408f,  0.00167537f,  0.00266218f,  0.00391676f,
+    -0.00610107f};
+
+const float lp_audio_taps[LP_AUDIO_FILT_TAPS] = {
+     0.00246253f,  0.00653798f,  0.00120876f, -0.00287389f,  0.00201971f, -0.00020231f, -0.00156764f,  0.00240512f,
+    -0.00176244f, -0.00011997f,  0.00217598f, -0.00304036f,  0.00192898f,  0.00069908f, -0.00325112f,  0.00393558f,
+    -0.00197824f, -0.00166413f,  0.00470662f, -0.00494003f,  0.00177669f,  0.00310013f, -0.00655946f,  0.00599165f,
+    -0.00119629f, -0.00513856f,  0.00886932f, -0.00703653f,  0.00007751f,  0.00798494f, -0.01177575f,  0.00803340f,
+     0.00184449f, -0.01203789f,  0.01558157f, -0.00892507f, -0.00509551f,  0.01811789f, -0.02096620f,  0.00967502f,
+     0.01086701f, -0.02840958f,  0.02996278f, -0.01023451f, -0.02310694f,  0.05094574f, -0.05120893f,  0.01058206f,
+     0.06674462f, -0.15844736f,  0.23238885f,  0.73929005f,  0.23238885f, -0.15844736f,  0.06674462f,  0.01058206f,
+    -0.05120893f,  0.05094574f, -0.02310694f, -0.01023451f,  0.02996278f, -0.02840958f,  0.01086701f,  0.00967502f,
+    -0.02096620f,  0.01811789f, -0.00509551f, -0.00892507f,  0.01558157f, -0.01203789f,  0.00184449f,  0.00803340f,
+    -0.01177575f,  0.00798494f,  0.00007751f, -0.00703653f,  0.00886932f, -0.00513856f, -0.00119629f,  0.00599165f,
+    -0.00655946f,  0.00310013f,  0.00177669f, -0.00494003f,  0.00470662f, -0.00166413f, -0.00197824f,  0.00393558f,
+    -0.00325112f,  0.00069908f,  0.00192898f, -0.00304036f,  0.00217598f, -0.00011997f, -0.00176244f,  0.00240512f,
+    -0.00156764f, -0.00020231f,  0.00201971f, -0.00287389f,  0.00120876f,  0.00653798f,  0.00246253f};
+
+const float deemph_taps[DEEMPH_FILT_TAPS] = {
+    -0.00051465f, -0.00099186f, -0.00159733f, -0.00227851f, -0.00310069f, -0.00400507f, -0.00506042f, -0.00620048f,
+    -0.00749764f, -0.00887676f, -0.01041414f, -0.01202419f, -0.01378760f, -0.01560654f, -0.01756678f, -0.01955631f,
+    -0.02166702f, -0.02377038f, -0.02596587f, -0.02810578f, -0.03029920f, -0.03237594f, -0.03445746f, -0.03634694f,
+    -0.03818191f, -0.03973361f, -0.04116047f, -0.04219463f, -0.04302200f, -0.04332560f, -0.04332773f, -0.04264781f,
+    -0.04155682f, -0.03958890f, -0.03708117f, -0.03344847f, -0.02911980f, -0.02333449f, -0.01665294f, -0.00803967f,
+     0.00174917f,  0.01421623f,  0.02829790f,  0.04638760f,  0.06690555f,  0.09427435f,  0.12599297f,  0.17284975f,
+     0.23109142f,  0.35660140f,  0.62006398f,  0.35660140f,  0.23109142f,  0.17284975f,  0.12599297f,  0.09427435f,
+     0.06690555f,  0.04638760f,  0.02829790f,  0.01421623f,  0.00174917f, -0.00803967f, -0.01665294f, -0.02333449f,
+    -0.02911980f, -0.03344847f, -0.03708117f, -0.03958890f, -0.04155682f, -0.04264781f, -0.04332773f, -0.04332560f,
+    -0.04302200f, -0.04219463f, -0.04116047f, -0.03973361f, -0.03818191f, -0.03634694f, -0.03445746f, -0.03237594f,
+    -0.03029920f, -0.02810578f, -0.02596587f, -0.02377038f, -0.02166702f, -0.01955631f, -0.01756678f, -0.01560654f,
+    -0.01378760f, -0.01202419f, -0.01041414f, -0.00887676f, -0.00749764f, -0.00620048f, -0.00506042f, -0.00400507f,
+    -0.00310069f, -0.00227851f, -0.00159733f, -0.00099186f, -0.00051465f};
+// clang-format on
+
+// 50us tau
+const float deemph_iir_b[DEEMPH_IIR_ORDER + 1] = {0.507301437230636f,
+                                                  0.507301437230636f};
+const float deemph_iir_a[DEEMPH_IIR_ORDER + 1] = {1.0f, 0.014602874461272194f};
+
+// Same time span as at AUDIO_FILTERS_RATE, hence the same transition
+// width in Hz, and odd, so the delay is a whole number of samples
+static unsigned int scaled_len(unsigned int len, unsigned int rate)
+{
+    const unsigned int n = (len * rate) / AUDIO_FILTERS_RATE;
+    return n < 3 ? 3 : n | 1;
+}
+
+static float *lowpass(unsigned int len, float fc, float as)
+{
+    float *h = malloc(len * sizeof(float));
+    if (!h)
+    {
+        return NULL;
+    }
+
+    liquid_firdes_kaiser(len, fc, as, 0.0f, h);
+    float sum = 0.0f;
+    for (unsigned int i = 0; i < len; i++)
+    {
+        sum += h[i];
+    }
+    for (unsigned int i = 0; i < len; i++)
+    {
+        h[i] /= sum;
+    }
+    return h;
+}
+
+static float *copy_taps(const float *taps, unsigned int len)
+{
+    float *h = malloc(len * sizeof(float));
+    if (h)
+    {
+        memcpy(h, taps, len * sizeof(float));
+    }
+    return h;
+}
+
+// First order de-emphasis, bilinear transform pre-warped to the corner
+static void design_deemph(audio_filters_t *f, unsigned int rate)
+{
+    float fc = 1.0 / (2.0 * M_PI * DEEMPH_TAU_S);
+    if (fc > LP_AUDIO_MAX_CUTOFF * rate)
+    {
+        fc = LP_AUDIO_MAX_CUTOFF * rate;
+    }
+    const double k = 1.0 / tan((M_PI * fc) / rate);
+
+    f->deemph_b[0] = f->deemph_b[1] = 1.0 / (1.0 + k);
+    f->deemph_a[0] = 1.0f;
+    f->deemph_a[1] = (1.0 - k) / (1.0 + k);
+
+    // y[n] = b0 * (x[n] + x[n - 1]) - a1 * y[n - 1], for a unit impulse
+    float y = 0.0f;
+    for (unsigned int i = 0; i < f->deemph_len; i++)
+    {
+        const float x = (i < 2) ? 1.0f : 0.0f;
+        y = (f->deemph_b[0] * x) - (f->deemph_a[1] * y);
+        f->deemph[i] = y;
+    }
+}
+
+bool audio_filters_design(audio_filters_t *f, unsigned int rate)
+{
+    memset(f, 0, sizeof(audio_filters_t));
+
+    if (rate == AUDIO_FILTERS_RATE)
+    {
+        f->hp_len = HP_AUDIO_FILT_TAPS;
+        f->hp = copy_taps(hp_audio_taps, f->hp_len);
+        f->lp_len = LP_AUDIO_FILT_TAPS;
+        f->lp = copy_taps(lp_audio_taps, f->lp_len);
+        f->deemph_len = DEEMPH_FILT_TAPS;
+        f->deemph = copy_taps(deemph_taps, f->deemph_len);
+        memcpy(f->deemph_b, deemph_iir_b, sizeof(f->deemph_b));
+        memcpy(f->deemph_a, deemph_iir_a, sizeof(f->deemph_a));
+    }
+    else
+    {
+        // The high-pass is the complement of a low-pass
+        f->hp_len = scaled_len(HP_AUDIO_FILT_TAPS, rate);
+        f->hp = lowpass(f->hp_len, HP_AUDIO_CUTOFF_HZ / rate, HP_AUDIO_AS);
+        if (f->hp)
+        {
+            for (unsigned int i = 0; i < f->hp_len; i++)
+            {
+                f->hp[i] = -f->hp[i];
+            }
+            f->hp[(f->hp_len - 1) / 2] += 1.0f;
+        }
+
+        float fc = LP_AUDIO_CUTOFF_HZ / rate;
+        if (fc > LP_AUDIO_MAX_CUTOFF)
+        {
+            fc = LP_AUDIO_MAX_CUTOFF;
+        }
+        f->lp_len = scaled_len(LP_AUDIO_FILT_TAPS, rate);
+        f->lp = lowpass(f->lp_len, fc, LP_AUDIO_AS);
+
+        f->deemph_len = scaled_len(DEEMPH_FILT_TAPS, rate);
+        f->deemph = malloc(f->deemph_len * sizeof(float));
+        if (f->deemph)
+        {
+            design_deemph(f, rate);
+        }
+    }
+
+    if (!f->hp || !f->lp || !f->deemph)
+    {
+        audio_filters_free(f);
+        return false;
+    }
+    return true;
+}
+
+void audio_filters_free(audio_filters_t *f)
+{
+    free(f->deemph);
+    free(f->lp);
+    free(f->hp);
+    memset(f, 0, sizeof(audio_filters_t));
+}
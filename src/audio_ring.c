@@ -0,0 +1,193 @@
+#include "audio_ring.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+#define CACHE_LINE_SIZE (64)
+
+struct _audio_ring_t
+{
+    // written only by the producer
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    atomic_uint_fast64_t overruns;
+    atomic_uint_fast64_t overrun_samples;
+    size_t tag_pos;
+    uint64_t tag;
+    // set by the producer, cleared by the consumer
+    atomic_bool tag_pending;
+    // written only by the consumer
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    atomic_uint_fast64_t underruns;
+    atomic_uint_fast64_t underrun_samples;
+    // read-only after creation
+    _Alignas(CACHE_LINE_SIZE) size_t capacity;
+    size_t mask;
+    float *data;
+};
+
+audio_ring_t *audio_ring_create(size_t capacity)
+{
+    log_assert(capacity > 0);
+
+    audio_ring_t *self = aligned_alloc(CACHE_LINE_SIZE, sizeof(audio_ring_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    memset(self, 0, sizeof(audio_ring_t));
+
+    // the storage is a power of two, so the free running
+    // indices can be wrapped with a mask
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    self->data = calloc(size, sizeof(float));
+    if (!self->data)
+    {
+        free(self);
+        return NULL;
+    }
+
+    self->capacity = capacity;
+    self->mask = size - 1;
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->overruns, 0);
+    atomic_init(&self->overrun_samples, 0);
+    atomic_init(&self->underruns, 0);
+    atomic_init(&self->underrun_samples, 0);
+    atomic_init(&self->tag_pending, false);
+
+    return self;
+}
+
+void audio_ring_destroy(audio_ring_t **ring_p)
+{
+    log_assert(ring_p);
+    if (*ring_p)
+    {
+        audio_ring_t *ring = *ring_p;
+        free(ring->data);
+        free(ring);
+        *ring_p = NULL;
+    }
+}
+
+size_t audio_ring_write(audio_ring_t *ring, const float *x, size_t n)
+{
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    const size_t space = ring->capacity - (head - tail);
+    const size_t nw = n < space ? n : space;
+
+    const size_t pos = head & ring->mask;
+    const size_t to_end = ring->mask + 1 - pos;
+    const size_t first = nw < to_end ? nw : to_end;
+    memcpy(&ring->data[pos], x, first * sizeof(float));
+    memcpy(ring->data, &x[first], (nw - first) * sizeof(float));
+
+    atomic_store_explicit(&ring->head, head + nw, memory_order_release);
+
+    if (nw < n)
+    {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->overrun_samples, n - nw,
+                                  memory_order_relaxed);
+    }
+
+    return nw;
+}
+
+size_t audio_ring_read(audio_ring_t *ring, float *y, size_t n)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    const size_t avail = head - tail;
+    const size_t nr = n < avail ? n : avail;
+
+    const size_t pos = tail & ring->mask;
+    const size_t to_end = ring->mask + 1 - pos;
+    const size_t first = nr < to_end ? nr : to_end;
+    memcpy(y, &ring->data[pos], first * sizeof(float));
+    memcpy(&y[first], ring->data, (nr - first) * sizeof(float));
+
+    atomic_store_explicit(&ring->tail, tail + nr, memory_order_release);
+
+    if (nr < n)
+    {
+        memset(&y[nr], 0, (n - nr) * sizeof(float));
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->underrun_samples, n - nr,
+                                  memory_order_relaxed);
+    }
+
+    return nr;
+}
+
+void audio_ring_tag(audio_ring_t *ring, uint64_t tag)
+{
+    if (atomic_load_explicit(&ring->tag_pending, memory_order_acquire))
+    {
+        return;
+    }
+
+    ring->tag_pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->tag = tag;
+    atomic_store_explicit(&ring->tag_pending, true, memory_order_release);
+}
+
+bool audio_ring_take_tag(audio_ring_t *ring, uint64_t *tag)
+{
+    if (!atomic_load_explicit(&ring->tag_pending, memory_order_acquire))
+    {
+        return false;
+    }
+
+    // The indices are free running, so the difference wraps correctly
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if ((ptrdiff_t)(tail - ring->tag_pos) <= 0)
+    {
+        return false;
+    }
+
+    *tag = ring->tag;
+    atomic_store_explicit(&ring->tag_pending, false, memory_order_release);
+    return true;
+}
+
+size_t audio_ring_size(audio_ring_t *ring)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+size_t audio_ring_capacity(audio_ring_t *ring)
+{
+    return ring->capacity;
+}
+
+void audio_ring_get_stats(audio_ring_t *ring, audio_ring_stats_t *stats)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    stats->capacity = ring->capacity;
+    stats->used = head - tail;
+    stats->written = head;
+    stats->read = tail;
+    stats->overruns =
+        atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+    stats->overrun_samples =
+        atomic_load_explicit(&ring->overrun_samples, memory_order_relaxed);
+    stats->underruns =
+        atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+    stats->underrun_samples =
+        atomic_load_explicit(&ring->underrun_samples, memory_order_relaxed);
+}
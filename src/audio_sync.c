@@ -0,0 +1,151 @@
+#include "audio_sync.h"
+
+#include <liquid/liquid.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+// The ring fill is sampled once per block and smoothed over ~20 blocks,
+// it jumps around with the block sizes of both the producer and the
+// audio callback
+#define SYNC_FILL_ALPHA (0.05)
+// PI controller of the rate deviation, per relative fill error.
+// With blocks of ~1s/16 it settles in about 10s.
+#define SYNC_KP (0.0125)
+#define SYNC_KI (0.00003)
+// 0.5% is about a twelfth of a semitone, not noticeable in speech
+#define SYNC_MAX_DEVIATION (0.005)
+
+#define SYNC_FILTER_M (7)
+#define SYNC_FILTER_AS (60.0f)
+#define SYNC_FILTER_NPFB (64)
+
+struct _audio_sync_t
+{
+    size_t target;
+    size_t max_input;
+    resamp_rrrf resamp;
+    float *out;
+    size_t out_len;
+    double fill;
+    double integ;
+    double rate;
+};
+
+audio_sync_t *audio_sync_create(size_t target, size_t max_input)
+{
+    log_assert(target > 0);
+
+    audio_sync_t *self = calloc(1, sizeof(audio_sync_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->target = target;
+    self->max_input = max_input;
+    self->fill = target;
+    self->rate = 1.0;
+    self->out_len = (size_t)(max_input * (1.0 + SYNC_MAX_DEVIATION)) + 16;
+    self->out = calloc(self->out_len, sizeof(float));
+    self->resamp = resamp_rrrf_create(1.0f, SYNC_FILTER_M, 0.45f, SYNC_FILTER_AS,
+                                      SYNC_FILTER_NPFB);
+    if (!self->out || !self->resamp)
+    {
+        audio_sync_destroy(&self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void audio_sync_destroy(audio_sync_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        audio_sync_t *q = *q_p;
+        if (q->resamp)
+        {
+            resamp_rrrf_destroy(q->resamp);
+        }
+        free(q->out);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+static void prime(audio_sync_t *q, audio_ring_t *ring)
+{
+    size_t remaining = q->target;
+
+    memset(q->out, 0, q->out_len * sizeof(float));
+    while (remaining > 0)
+    {
+        const size_t n = remaining < q->out_len ? remaining : q->out_len;
+        audio_ring_write(ring, q->out, n);
+        remaining -= n;
+    }
+
+    // The integral term, i.e. the clock offset, still holds
+    q->fill = q->target;
+}
+
+size_t audio_sync_write(audio_sync_t *q, audio_ring_t *ring, const float *x,
+                        size_t n)
+{
+    log_assert(n <= q->max_input);
+    const size_t fill = audio_ring_size(ring);
+
+    // Starting from an empty ring the controller would take seconds
+    // to build the fill up, with underruns all the way
+    if (fill == 0)
+    {
+        prime(q, ring);
+    }
+    else
+    {
+        q->fill += SYNC_FILL_ALPHA * (fill - q->fill);
+    }
+
+    const double err = (q->fill - q->target) / q->target;
+    q->integ += SYNC_KI * err;
+    if (q->integ > SYNC_MAX_DEVIATION)
+    {
+        q->integ = SYNC_MAX_DEVIATION;
+    }
+    else if (q->integ < -SYNC_MAX_DEVIATION)
+    {
+        q->integ = -SYNC_MAX_DEVIATION;
+    }
+
+    double dev = (SYNC_KP * err) + q->integ;
+    if (dev > SYNC_MAX_DEVIATION)
+    {
+        dev = SYNC_MAX_DEVIATION;
+    }
+    else if (dev < -SYNC_MAX_DEVIATION)
+    {
+        dev = -SYNC_MAX_DEVIATION;
+    }
+    // Too full - produce less, too empty - produce more
+    q->rate = 1.0 - dev;
+    resamp_rrrf_set_rate(q->resamp, q->rate);
+
+    unsigned int ny;
+    resamp_rrrf_execute_block(q->resamp, (float *)x, n, q->out, &ny);
+    log_assert(ny <= q->out_len);
+
+    return audio_ring_write(ring, q->out, ny);
+}
+
+double audio_sync_rate(audio_sync_t *q)
+{
+    return q->rate;
+}
+
+double audio_sync_fill(audio_sync_t *q)
+{
+    return q->fill;
+}
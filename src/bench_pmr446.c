@@ -0,0 +1,1087 @@
+#include <argp.h>
+#include <complex.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio_filters.h"
+#include "audio_ring.h"
+#include "audio_sync.h"
+#include "channelizer.h"
+#include "ctcss.h"
+#include "decimator.h"
+#include "logging.h"
+#include "pcm.h"
+#include "preroll.h"
+#include "rational_resampler.h"
+
+#define NUM_CHANNELS (16)
+#define CHUNK_SIZE (39064UL)
+#define CHANNEL_BUF_SIZE (CHUNK_SIZE / NUM_CHANNELS + 1)
+
+#define DEFAULT_ITERATIONS (200)
+
+// The channel counts with kernels of their own
+static const unsigned int channelizer_sizes[] = {8, 16, 32, 64};
+#define CHANNELIZER_MAX_CHANNELS (64)
+// The block channelizer has to match the legacy one, up to a fixed
+// phase per channel
+#define CHANNELIZER_CHECK_CHUNKS (2)
+#define CHANNELIZER_MAX_RESIDUAL_DB (-40.0f)
+#define CHANNELIZER_MAX_POWER_ERROR_DB (0.1f)
+
+#define CTCSS_SAMPLERATE (12500.0f)
+#define CTCSS_WINDOW_SIZE (2441UL)
+#define CTCSS_HOP_SIZE (CTCSS_WINDOW_SIZE / 4)
+#define CTCSS_TONE_LEN (8 * CTCSS_WINDOW_SIZE)
+// A clean tone of this amplitude has a power of A^2/4 in its bin
+#define CTCSS_LEVEL_AMPLITUDE (0.1f)
+#define CTCSS_LEVEL_MAX_ERROR_DB (1.0f)
+
+// The whole receive chain, as run by sdr_pmr446 at its default sample rate
+#define CHAIN_SAMPLERATE (1600000.0)
+#define CHAIN_CHANNEL_WIDTH (12500.0f)
+#define CHAIN_INPUT_CHUNK (100000UL)
+#define CHAIN_DECIMATION (8)
+#define CHAIN_SQUELCH_LEVEL (18.0f)
+// The generated signal is looped, 1s of it
+#define CHAIN_SIGNAL_CHUNKS (16)
+#define DEFAULT_TRANSMITTERS (3)
+
+// dsd_in, from its default capture rate to 48kHz audio
+#define DSD_SAMPLERATE (1024000UL)
+#define DSD_INPUT_CHUNK (200000UL)
+#define DSD_SIG_SAMPLERATE (12500UL)
+#define DSD_DECIMATION (80)
+#define DSD_AUDIO_SAMPLERATE (48000UL)
+// Well above the 48kHz output of a whole chunk
+#define DSD_OUT_SIZE (DSD_INPUT_CHUNK / 16)
+
+// sdr_pmr446 defaults, 300ms of pre-roll and 64ms chunks at 12.5kHz
+#define PREROLL_LEN (3750UL)
+#define PREROLL_CHUNK (800UL)
+
+// sdr_pmr446 defaults at 48kHz: 64ms chunks, an 80ms fill target in a
+// 336ms buffer, 40ms callback periods
+#define AUDIO_RATE (48000.0)
+#define AUDIO_CHUNK (3072UL)
+#define AUDIO_TARGET (3840UL)
+#define AUDIO_CAPACITY (16128UL)
+#define AUDIO_PERIOD (1920UL)
+// The sound card clock runs a little fast
+#define AUDIO_CLOCK_PPM (100.0)
+// A channel open for chunks [10, 40), closed, reopened for [70, 100)
+#define AUDIO_CHECK_CHUNKS (100)
+
+#define TX_AMPLITUDE (0.2f)
+#define TX_MAX_OFFSET_HZ (500.0f)
+#define TX_VOICE_DEVIATION_HZ (2000.0f)
+#define TX_CTCSS_DEVIATION_HZ (500.0f)
+// ~30dB of SNR in a channel
+#define NOISE_SIGMA (0.05f)
+
+#define xstr(s) str(s)
+#define str(s) #s
+
+typedef struct
+{
+    size_t iterations;
+    size_t transmitters;
+    char *filter;
+} bench_args_t;
+
+typedef struct
+{
+    const char *name;
+    void (*run)(bench_args_t const *args);
+} bench_t;
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+
+static char doc[] = "bench_pmr446 -- sdr_pmr446 DSP micro-benchmarks";
+
+static char args_doc[] = "[BENCHMARK]";
+
+static struct argp_option options[] = {
+    {"iterations", 'n', "N", 0,
+     "The number of chunks processed by each benchmark (default: " xstr(
+         DEFAULT_ITERATIONS) ")"},
+    {"transmitters", 't', "N", 0,
+     "The number of PMR446 transmitters in the signal of the chain "
+     "benchmark (default: " xstr(DEFAULT_TRANSMITTERS) ")"},
+    {0}};
+
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+    int ret;
+    bench_args_t *arguments = state->input;
+
+    switch (key)
+    {
+    case 'n':
+        ret = sscanf(arg, "%lu", &arguments->iterations);
+        if ((ret != 1) || (arguments->iterations == 0))
+        {
+            LOG(ERROR, "Failed to parse the number of iterations");
+            argp_usage(state);
+        }
+        break;
+
+    case 't':
+        ret = sscanf(arg, "%lu", &arguments->transmitters);
+        if ((ret != 1) || (arguments->transmitters > NUM_CHANNELS))
+        {
+            LOG(ERROR, "Failed to parse the number of transmitters (should be "
+                       "at most " xstr(NUM_CHANNELS) ")");
+            argp_usage(state);
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 1)
+            argp_usage(state);
+
+        arguments->filter = arg;
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void fill_noise(complex float *x, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        x[i] = ((float)rand() / RAND_MAX - 0.5f) +
+               _Complex_I * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+static void report(const char *name, double elapsed, size_t samples)
+{
+    printf("%-32s %10.2f ns/sample %10.2f MS/s\n", name,
+           (elapsed * 1e9) / samples, (samples / elapsed) * 1e-6);
+}
+
+// The per-sample NCO + per-frame filterbank loop the scanner used before.
+// Returns the number of samples produced per channel.
+static size_t channelizer_legacy(cbuffercf buf, nco_crcf nco,
+                                 firpfbch_crcf channelizer, unsigned int n,
+                                 complex float *x, size_t nx, complex float *y,
+                                 size_t stride)
+{
+    size_t ns = 0;
+    unsigned int num_read;
+    complex float *rpc;
+    complex float tmp_out[CHANNELIZER_MAX_CHANNELS];
+
+    cbuffercf_write(buf, x, nx);
+    while (cbuffercf_size(buf) >= n)
+    {
+        cbuffercf_read(buf, n, &rpc, &num_read);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            nco_crcf_mix_down(nco, rpc[i], &rpc[i]);
+            nco_crcf_step(nco);
+        }
+        firpfbch_crcf_analyzer_execute(channelizer, rpc, tmp_out);
+        cbuffercf_release(buf, num_read);
+        for (size_t i = 0; i < n; i++)
+        {
+            y[(i * stride) + ns] = tmp_out[i];
+        }
+        ns++;
+    }
+    return ns;
+}
+
+static firpfbch_crcf channelizer_legacy_create(unsigned int n, cbuffercf *buf,
+                                               nco_crcf *nco)
+{
+    *buf = cbuffercf_create(CHUNK_SIZE + n);
+    *nco = nco_crcf_create(LIQUID_VCO);
+    nco_crcf_set_frequency(*nco, -0.5f * (float)(n - 1) / (float)n * 2 * M_PI);
+    firpfbch_crcf pfb =
+        firpfbch_crcf_create_kaiser(LIQUID_ANALYZER, n, 13, 80.0f);
+    log_assert(*buf && *nco && pfb);
+    return pfb;
+}
+
+// Runs the same input through both channelizers and compares the outputs
+// channel by channel, after rotating the legacy one by the phase that
+// fits best. Returns the largest residual relative to the channel power
+// [dB], `power_error` is the largest difference in power [dB].
+static float channelizer_mismatch_db(unsigned int n, complex float *x,
+                                     complex float *y_legacy,
+                                     complex float *y_block,
+                                     float *power_error)
+{
+    const size_t stride = CHUNK_SIZE / n + 1;
+    double complex cross[CHANNELIZER_MAX_CHANNELS] = {0};
+    double p_legacy[CHANNELIZER_MAX_CHANNELS] = {0};
+    double p_block[CHANNELIZER_MAX_CHANNELS] = {0};
+    cbuffercf buf;
+    nco_crcf nco;
+    firpfbch_crcf pfb = channelizer_legacy_create(n, &buf, &nco);
+    channelizer_t *block = channelizer_create(n, 13, 80.0f, CHUNK_SIZE);
+    log_assert(block);
+
+    for (size_t i = 0; i < CHANNELIZER_CHECK_CHUNKS; i++)
+    {
+        const size_t ns =
+            channelizer_legacy(buf, nco, pfb, n, x, CHUNK_SIZE, y_legacy, stride);
+        const size_t ns_block =
+            channelizer_execute(block, x, CHUNK_SIZE, y_block, stride, NULL);
+        log_assert(ns == ns_block);
+
+        for (unsigned int k = 0; k < n; k++)
+        {
+            complex float const *l = &y_legacy[k * stride];
+            complex float const *b = &y_block[k * stride];
+            for (size_t j = 0; j < ns; j++)
+            {
+                cross[k] += b[j] * conjf(l[j]);
+                p_legacy[k] += crealf(l[j] * conjf(l[j]));
+                p_block[k] += crealf(b[j] * conjf(b[j]));
+            }
+        }
+    }
+
+    // With the best fitting phase, sum |b - e^(j phi) l|^2
+    // = sum |b|^2 + sum |l|^2 - 2 |sum b conj(l)|
+    float max_residual = -INFINITY;
+    *power_error = 0.0f;
+    for (unsigned int k = 0; k < n; k++)
+    {
+        const double residual =
+            fmax(p_block[k] + p_legacy[k] - (2.0 * cabs(cross[k])), 1e-30);
+        max_residual =
+            fmaxf(max_residual, 10.0f * log10f(residual / p_legacy[k]));
+        *power_error = fmaxf(*power_error,
+                             fabsf(10.0f * log10f(p_block[k] / p_legacy[k])));
+    }
+
+    channelizer_destroy(&block);
+    firpfbch_crcf_destroy(pfb);
+    nco_crcf_destroy(nco);
+    cbuffercf_destroy(buf);
+    return max_residual;
+}
+
+static void bench_channelizer_size(bench_args_t const *args, unsigned int n,
+                                   complex float *x, complex float *y,
+                                   complex float *y_check)
+{
+    const size_t stride = CHUNK_SIZE / n + 1;
+    char name[64];
+
+    cbuffercf buf;
+    nco_crcf nco;
+    firpfbch_crcf pfb = channelizer_legacy_create(n, &buf, &nco);
+    channelizer_t *block = channelizer_create(n, 13, 80.0f, CHUNK_SIZE);
+    log_assert(block);
+
+    double t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        channelizer_legacy(buf, nco, pfb, n, x, CHUNK_SIZE, y, stride);
+    }
+    const double legacy = now_s() - t0;
+
+    t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        channelizer_execute(block, x, CHUNK_SIZE, y, stride, NULL);
+    }
+    const double blocked = now_s() - t0;
+
+    snprintf(name, sizeof(name), "channelizer/%u (nco + firpfbch)", n);
+    report(name, legacy, args->iterations * CHUNK_SIZE);
+    snprintf(name, sizeof(name), "channelizer/%u (block)", n);
+    report(name, blocked, args->iterations * CHUNK_SIZE);
+
+    channelizer_destroy(&block);
+    firpfbch_crcf_destroy(pfb);
+    nco_crcf_destroy(nco);
+    cbuffercf_destroy(buf);
+
+    float power_error;
+    const float residual =
+        channelizer_mismatch_db(n, x, y, y_check, &power_error);
+    snprintf(name, sizeof(name), "channelizer/%u (match)", n);
+    printf("%-32s %.1f dB residual, %.3f dB power error at most\n", name,
+           residual, power_error);
+    if ((residual > CHANNELIZER_MAX_RESIDUAL_DB) ||
+        (power_error > CHANNELIZER_MAX_POWER_ERROR_DB))
+    {
+        LOG(ERROR, "The %u-channel block channelizer doesn't match the legacy one",
+            n);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void bench_channelizer(bench_args_t const *args)
+{
+    complex float *x = malloc(CHUNK_SIZE * sizeof(complex float));
+    // n * (CHUNK_SIZE / n + 1) samples at most
+    complex float *y = malloc((CHUNK_SIZE + CHANNELIZER_MAX_CHANNELS) *
+                              sizeof(complex float));
+    complex float *y_check = malloc((CHUNK_SIZE + CHANNELIZER_MAX_CHANNELS) *
+                                    sizeof(complex float));
+    log_assert(x && y && y_check);
+    fill_noise(x, CHUNK_SIZE);
+
+    for (size_t i = 0;
+         i < sizeof(channelizer_sizes) / sizeof(channelizer_sizes[0]); i++)
+    {
+        bench_channelizer_size(args, channelizer_sizes[i], x, y, y_check);
+    }
+
+    free(y_check);
+    free(y);
+    free(x);
+}
+
+// Sub-audio with a different tone every CTCSS_TONE_LEN samples (or no
+// tone at all every now and then) buried in noise. The tone index of
+// each segment is stored in `tones`, -1 if there's none.
+static void fill_ctcss(float *x, size_t n, int *tones)
+{
+    int tone = -1;
+    for (size_t i = 0; i < n; i++)
+    {
+        if ((i % CTCSS_TONE_LEN) == 0)
+        {
+            tone = (rand() % 5) == 0 ? -1 : rand() % CTCSS_NUM_FREQS;
+            tones[i / CTCSS_TONE_LEN] = tone;
+        }
+        x[i] = ((float)rand() / RAND_MAX - 0.5f) * 0.1f;
+        if (tone >= 0)
+        {
+            x[i] +=
+                0.2f * sinf((2.0f * M_PI * ctcss_freqs[tone] * i) / CTCSS_SAMPLERATE);
+        }
+    }
+}
+
+// The detection thresholds assume the sub-audio decimation keeps the
+// level of the tones, the largest deviation from it over all of them
+static float ctcss_level_error_db(void)
+{
+    const size_t len = 2 * CTCSS_WINDOW_SIZE;
+    const float expected = 0.25f * CTCSS_LEVEL_AMPLITUDE * CTCSS_LEVEL_AMPLITUDE;
+    float *x = malloc(len * sizeof(float));
+    ctcss_detector_t *ctcss = ctcss_detector_create(
+        CTCSS_SAMPLERATE, CTCSS_WINDOW_SIZE, CTCSS_HOP_SIZE);
+    log_assert(x && ctcss);
+
+    float max_error = 0.0f;
+    for (unsigned int j = 0; j < CTCSS_NUM_FREQS; j++)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            x[i] = CTCSS_LEVEL_AMPLITUDE *
+                   sinf((2.0f * M_PI * ctcss_freqs[j] * i) / CTCSS_SAMPLERATE);
+        }
+        ctcss_detector_reset(ctcss);
+        ctcss_detector_analyze(ctcss, x, len);
+
+        const float error = fabsf(10.0f * log10f(ctcss->power[j] / expected));
+        max_error = fmaxf(max_error, error);
+    }
+
+    ctcss_detector_destroy(&ctcss);
+    free(x);
+    return max_error;
+}
+
+static void bench_ctcss(bench_args_t const *args)
+{
+    const size_t n = CHANNEL_BUF_SIZE;
+    const size_t len = args->iterations * n;
+    float *x = malloc(len * sizeof(float));
+    int *tones = malloc((len / CTCSS_TONE_LEN + 1) * sizeof(int));
+    log_assert(x && tones);
+    fill_ctcss(x, len, tones);
+
+    ctcss_detector_t *scalar = ctcss_detector_create(
+        CTCSS_SAMPLERATE, CTCSS_WINDOW_SIZE, CTCSS_HOP_SIZE);
+    ctcss_detector_t *vector = ctcss_detector_create(
+        CTCSS_SAMPLERATE, CTCSS_WINDOW_SIZE, CTCSS_HOP_SIZE);
+    log_assert(scalar && vector);
+
+    double t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        ctcss_detector_analyze_scalar(scalar, &x[i * n], n);
+    }
+    const double t_scalar = now_s() - t0;
+
+    t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        ctcss_detector_analyze(vector, &x[i * n], n);
+    }
+    const double t_vector = now_s() - t0;
+
+    report("ctcss (scalar)", t_scalar, len);
+    report("ctcss (vector)", t_vector, len);
+    printf("%-32s %10.2fx\n", "speedup", t_scalar / t_vector);
+
+    // Both have to come to the same decisions, hop by hop,
+    // and lock onto the right tone soon after it changes
+    size_t hops = 0;
+    size_t mismatches = 0;
+    size_t acquired = 0;
+    size_t missed = 0;
+    double latency = 0.0;
+    bool locked = false;
+    ctcss_detector_reset(scalar);
+    ctcss_detector_reset(vector);
+    for (size_t i = 0; i + CTCSS_HOP_SIZE <= len; i += CTCSS_HOP_SIZE)
+    {
+        const size_t seg = i / CTCSS_TONE_LEN;
+        const int tone = tones[seg];
+        if ((i % CTCSS_TONE_LEN) < CTCSS_HOP_SIZE)
+        {
+            missed += (seg > 0) && (tones[seg - 1] >= 0) && !locked;
+            locked = false;
+        }
+
+        ctcss_detector_analyze_scalar(scalar, &x[i], CTCSS_HOP_SIZE);
+        ctcss_detector_analyze(vector, &x[i], CTCSS_HOP_SIZE);
+        hops++;
+        if ((scalar->tone_detected != vector->tone_detected) ||
+            (scalar->tone_detected &&
+             (scalar->max_power_index != vector->max_power_index)))
+        {
+            mismatches++;
+        }
+
+        if (!locked && (tone >= 0) && vector->tone_detected &&
+            (vector->max_power_index == tone))
+        {
+            locked = true;
+            acquired++;
+            latency += (double)((i % CTCSS_TONE_LEN) + CTCSS_HOP_SIZE) /
+                       CTCSS_SAMPLERATE;
+        }
+    }
+    printf("%-32s %zu hops, %zu mismatches\n", "ctcss (check)", hops,
+           mismatches);
+    printf("%-32s %zu tones, %zu missed, %.1f ms on average\n",
+           "ctcss (acquisition)", acquired, missed,
+           acquired > 0 ? (latency * 1e3) / acquired : 0.0);
+
+    const float level_error = ctcss_level_error_db();
+    printf("%-32s %.2f dB off at most\n", "ctcss (level)", level_error);
+
+    ctcss_detector_destroy(&vector);
+    ctcss_detector_destroy(&scalar);
+    free(tones);
+    free(x);
+
+    if (mismatches > 0)
+    {
+        LOG(ERROR, "The vectorized CTCSS detector disagrees with the scalar one");
+        exit(EXIT_FAILURE);
+    }
+    if (level_error > CTCSS_LEVEL_MAX_ERROR_DB)
+    {
+        LOG(ERROR, "The CTCSS tone power is off by %.1f dB", level_error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+typedef struct
+{
+    int channel;
+    int ctcss;
+    // from the channel centre, as from a not quite accurate crystal
+    float offset;
+} tx_t;
+
+// NBFM transmitters on distinct channels, each with a CTCSS tone and a
+// voice-like modulation: a few formants with a syllabic envelope. The
+// sum is kept within [-1, 1], where the CIC filter of the decimator clips.
+static void fill_pmr446(complex float *x, size_t n, tx_t const *tx,
+                        size_t num_tx)
+{
+    const float amplitude = fminf(TX_AMPLITUDE, 0.8f / num_tx);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        x[i] = NOISE_SIGMA * M_SQRT1_2 * (randnf() + (_Complex_I * randnf()));
+    }
+
+    for (size_t k = 0; k < num_tx; k++)
+    {
+        const double centre =
+            (tx[k].channel - ((NUM_CHANNELS - 1) / 2.0)) * CHAIN_CHANNEL_WIDTH +
+            tx[k].offset;
+        const float f0 = 500.0f + (rand() % 300);
+        double phase = 0.0;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const float t = i / CHAIN_SAMPLERATE;
+            const float envelope = 0.5f * (1.0f - cosf(2.0f * M_PI * 3.0f * t));
+            const float voice =
+                envelope * ((0.5f * sinf(2.0f * M_PI * f0 * t)) +
+                            (0.3f * sinf(2.0f * M_PI * 1.9f * f0 * t)) +
+                            (0.2f * sinf(2.0f * M_PI * 3.7f * f0 * t)));
+            const float tone = sinf(2.0f * M_PI * ctcss_freqs[tx[k].ctcss] * t);
+            const double f = centre + (TX_VOICE_DEVIATION_HZ * voice) +
+                             (TX_CTCSS_DEVIATION_HZ * tone);
+
+            phase = fmod(phase + (2.0 * M_PI * f / CHAIN_SAMPLERATE), 2.0 * M_PI);
+            x[i] += amplitude * cexpf(_Complex_I * (float)phase);
+        }
+    }
+}
+
+typedef enum
+{
+    STAGE_DCBLOCK = 0,
+    STAGE_DECIMATOR,
+    STAGE_CHANNELIZER,
+    STAGE_SQUELCH,
+    STAGE_FM_DEMOD,
+    STAGE_CTCSS_FILT,
+    STAGE_CTCSS,
+    STAGE_DEEMPH,
+    NUM_STAGES,
+} chain_stage_e;
+
+static const char *const stage_names[NUM_STAGES] = {
+    "chain (dcblock)", "chain (decimator)", "chain (channelizer)",
+    "chain (squelch)", "chain (fm_demod)",  "chain (ctcss_filt)",
+    "chain (ctcss)",   "chain (deemph)",
+};
+
+// The demodulator of a channel, the same filters as in sdr_pmr446
+typedef struct
+{
+    bool open;
+    freqdem fm_demod;
+    firfilt_rrrf ctcss_filt;
+    wdelayf ctcss_lp_delay;
+    iirfilt_rrrf ctcss_dcblock;
+    iirfilt_rrrf deemph;
+    ctcss_detector_t *ctcss_detector;
+    float ctcss_buf[CHANNEL_BUF_SIZE];
+    float audio[CHANNEL_BUF_SIZE];
+} bench_channel_t;
+
+static void bench_channel_init(bench_channel_t *ch)
+{
+    ch->open = false;
+    ch->fm_demod = freqdem_create(0.5f);
+    ch->ctcss_filt =
+        firfilt_rrrf_create((float *)hp_audio_taps, HP_AUDIO_FILT_TAPS);
+    ch->ctcss_lp_delay = wdelayf_create((HP_AUDIO_FILT_TAPS - 1) / 2);
+    ch->ctcss_dcblock = iirfilt_rrrf_create_dc_blocker(0.0005f);
+    ch->deemph = iirfilt_rrrf_create((float *)deemph_iir_b, DEEMPH_IIR_ORDER + 1,
+                                     (float *)deemph_iir_a, DEEMPH_IIR_ORDER + 1);
+    ch->ctcss_detector = ctcss_detector_create(CHAIN_CHANNEL_WIDTH,
+                                               CTCSS_WINDOW_SIZE, CTCSS_HOP_SIZE);
+    log_assert(ch->fm_demod && ch->ctcss_filt && ch->ctcss_lp_delay &&
+               ch->ctcss_dcblock && ch->deemph && ch->ctcss_detector);
+}
+
+static void bench_channel_destroy(bench_channel_t *ch)
+{
+    ctcss_detector_destroy(&ch->ctcss_detector);
+    iirfilt_rrrf_destroy(ch->deemph);
+    iirfilt_rrrf_destroy(ch->ctcss_dcblock);
+    wdelayf_destroy(ch->ctcss_lp_delay);
+    firfilt_rrrf_destroy(ch->ctcss_filt);
+    freqdem_destroy(ch->fm_demod);
+}
+
+static void bench_chain(bench_args_t const *args)
+{
+    const size_t len = CHAIN_SIGNAL_CHUNKS * CHAIN_INPUT_CHUNK;
+    complex float *signal = malloc(len * sizeof(complex float));
+    complex float *x = malloc(CHAIN_INPUT_CHUNK * sizeof(complex float));
+    complex float *y = malloc(CHUNK_SIZE * sizeof(complex float));
+    complex float *chans =
+        malloc(NUM_CHANNELS * CHANNEL_BUF_SIZE * sizeof(complex float));
+    bench_channel_t *channels = calloc(NUM_CHANNELS, sizeof(bench_channel_t));
+    log_assert(signal && x && y && chans && channels);
+
+    // Distinct random channels, tones and offsets
+    tx_t tx[NUM_CHANNELS];
+    int order[NUM_CHANNELS];
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+        order[i] = i;
+    }
+    for (size_t i = 0; i < args->transmitters; i++)
+    {
+        const size_t j = i + (rand() % (NUM_CHANNELS - i));
+        const int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+        tx[i].channel = order[i];
+        tx[i].ctcss = rand() % CTCSS_NUM_FREQS;
+        tx[i].offset = TX_MAX_OFFSET_HZ * ((2.0f * rand() / RAND_MAX) - 1.0f);
+        printf("%-32s channel %2d, CTCSS %2d (%6.1fHz), offset %+6.1fHz\n",
+               "chain (transmitter)", tx[i].channel + 1, tx[i].ctcss + 1,
+               ctcss_freqs[tx[i].ctcss], tx[i].offset);
+    }
+    fill_pmr446(signal, len, tx, args->transmitters);
+
+    iirfilt_crcf dcblock = iirfilt_crcf_create_dc_blocker(0.0005f);
+    decimator_t *decimator =
+        decimator_create(CHAIN_DECIMATION, 60.0f, CHAIN_INPUT_CHUNK);
+    channelizer_t *channelizer =
+        channelizer_create(NUM_CHANNELS, 13, 80.0f, CHUNK_SIZE);
+    log_assert(dcblock && decimator && channelizer);
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+        bench_channel_init(&channels[i]);
+    }
+
+    double elapsed[NUM_STAGES] = {0};
+    size_t samples[NUM_STAGES] = {0};
+    double t0, t1;
+
+    for (size_t it = 0; it < args->iterations; it++)
+    {
+        memcpy(x, &signal[(it % CHAIN_SIGNAL_CHUNKS) * CHAIN_INPUT_CHUNK],
+               CHAIN_INPUT_CHUNK * sizeof(complex float));
+
+        t0 = now_s();
+        iirfilt_crcf_execute_block(dcblock, x, CHAIN_INPUT_CHUNK, x);
+        t1 = now_s();
+        elapsed[STAGE_DCBLOCK] += t1 - t0;
+        samples[STAGE_DCBLOCK] += CHAIN_INPUT_CHUNK;
+
+        const size_t ny = decimator_execute(decimator, x, CHAIN_INPUT_CHUNK, y);
+        t0 = now_s();
+        elapsed[STAGE_DECIMATOR] += t0 - t1;
+        samples[STAGE_DECIMATOR] += CHAIN_INPUT_CHUNK;
+
+        float energy[NUM_CHANNELS];
+        size_t end;
+        channelizer_energy_t stats = {
+            .energy = energy, .end = &end, .max_blocks = 1};
+        const size_t ns = channelizer_execute(channelizer, y, ny, chans,
+                                              CHANNEL_BUF_SIZE, &stats);
+        t1 = now_s();
+        elapsed[STAGE_CHANNELIZER] += t1 - t0;
+        samples[STAGE_CHANNELIZER] += ny;
+
+        // Every channel has its own squelch, as in the '-M' mode
+        float power[NUM_CHANNELS];
+        float avg = 0.0f;
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            power[i] = 10 * log10f(energy[i] / ns);
+            avg += power[i];
+        }
+        avg /= NUM_CHANNELS;
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            bench_channel_t *ch = &channels[i];
+            if (!ch->open && ((power[i] - avg) > CHAIN_SQUELCH_LEVEL))
+            {
+                ch->open = true;
+            }
+            else if (ch->open && ((power[i] - avg) < CHAIN_SQUELCH_LEVEL - 5.0f))
+            {
+                ch->open = false;
+                freqdem_reset(ch->fm_demod);
+                ctcss_detector_reset(ch->ctcss_detector);
+            }
+        }
+        t0 = now_s();
+        elapsed[STAGE_SQUELCH] += t0 - t1;
+        samples[STAGE_SQUELCH] += NUM_CHANNELS * ns;
+
+        for (int i = 0; i < NUM_CHANNELS; i++)
+        {
+            bench_channel_t *ch = &channels[i];
+            if (!ch->open)
+            {
+                continue;
+            }
+
+            t0 = now_s();
+            freqdem_demodulate_block(ch->fm_demod, &chans[i * CHANNEL_BUF_SIZE], ns,
+                                     ch->ctcss_buf);
+            t1 = now_s();
+            elapsed[STAGE_FM_DEMOD] += t1 - t0;
+            samples[STAGE_FM_DEMOD] += ns;
+
+            firfilt_rrrf_execute_block(ch->ctcss_filt, ch->ctcss_buf, ns, ch->audio);
+            for (size_t k = 0; k < ns; k++)
+            {
+                float tmp;
+                wdelayf_push(ch->ctcss_lp_delay, ch->ctcss_buf[k]);
+                wdelayf_read(ch->ctcss_lp_delay, &tmp);
+                ch->ctcss_buf[k] = tmp - ch->audio[k];
+            }
+            t0 = now_s();
+            elapsed[STAGE_CTCSS_FILT] += t0 - t1;
+            samples[STAGE_CTCSS_FILT] += ns;
+
+            iirfilt_rrrf_execute_block(ch->ctcss_dcblock, ch->ctcss_buf, ns,
+                                       ch->ctcss_buf);
+            ctcss_detector_analyze(ch->ctcss_detector, ch->ctcss_buf, ns);
+            t1 = now_s();
+            elapsed[STAGE_CTCSS] += t1 - t0;
+            samples[STAGE_CTCSS] += ns;
+
+            iirfilt_rrrf_execute_block(ch->deemph, ch->audio, ns, ch->audio);
+            t0 = now_s();
+            elapsed[STAGE_DEEMPH] += t0 - t1;
+            samples[STAGE_DEEMPH] += ns;
+        }
+    }
+
+    // Each stage against the number of samples it processed
+    // (the demodulator ones only run for the open channels)
+    double total = 0.0;
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        if (samples[i] > 0)
+        {
+            report(stage_names[i], elapsed[i], samples[i]);
+        }
+        total += elapsed[i];
+    }
+    const size_t input = args->iterations * CHAIN_INPUT_CHUNK;
+    report("chain (total)", total, input);
+    printf("%-32s %10.2fx\n", "real-time factor",
+           (input / CHAIN_SAMPLERATE) / total);
+
+    size_t detected = 0;
+    for (size_t i = 0; i < args->transmitters; i++)
+    {
+        ctcss_detector_t const *det = channels[tx[i].channel].ctcss_detector;
+        detected += det->tone_detected && (det->max_power_index == tx[i].ctcss);
+    }
+    printf("%-32s %zu of %zu tones detected\n", "chain (ctcss)", detected,
+           args->transmitters);
+
+    for (int i = 0; i < NUM_CHANNELS; i++)
+    {
+        bench_channel_destroy(&channels[i]);
+    }
+    channelizer_destroy(&channelizer);
+    decimator_destroy(&decimator);
+    iirfilt_crcf_destroy(dcblock);
+    free(channels);
+    free(chans);
+    free(y);
+    free(x);
+    free(signal);
+}
+
+static void bench_dsd(bench_args_t const *args)
+{
+    complex float *x = malloc(DSD_INPUT_CHUNK * sizeof(complex float));
+    complex float *sig = malloc(DSD_INPUT_CHUNK * sizeof(complex float));
+    float *fm = malloc(DSD_INPUT_CHUNK * sizeof(float));
+    float *audio = malloc(DSD_OUT_SIZE * sizeof(float));
+    int16_t *pcm = malloc(DSD_OUT_SIZE * sizeof(int16_t));
+    log_assert(x && sig && fm && audio && pcm);
+    fill_noise(x, DSD_INPUT_CHUNK);
+
+    // The path dsd_in took before: two arbitrary rate resamplers
+    msresamp_crcf res_down = msresamp_crcf_create(
+        (float)DSD_SIG_SAMPLERATE / DSD_SAMPLERATE, 60.0f);
+    msresamp_rrrf res_up = msresamp_rrrf_create(
+        (float)DSD_AUDIO_SAMPLERATE / DSD_SIG_SAMPLERATE, 60.0f);
+    freqdem fm_demod = freqdem_create(0.5f);
+    log_assert(res_down && res_up && fm_demod);
+
+    size_t out_legacy = 0;
+    double t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        unsigned int ny, nz;
+        msresamp_crcf_execute(res_down, x, DSD_INPUT_CHUNK, sig, &ny);
+        freqdem_demodulate_block(fm_demod, sig, ny, fm);
+        msresamp_rrrf_execute(res_up, fm, ny, audio, &nz);
+        for (size_t k = 0; k < nz; k++)
+        {
+            pcm[k] = audio[k] * INT16_MAX;
+        }
+        out_legacy += nz;
+    }
+    const double legacy = now_s() - t0;
+
+    // 1.024MS/s / 80 = 12.8kHz, times 15/4 = 48kHz
+    const unsigned int sig_rate = DSD_SAMPLERATE / DSD_DECIMATION;
+    decimator_t *decimator =
+        decimator_create(DSD_DECIMATION, 60.0f, DSD_INPUT_CHUNK);
+    rational_resampler_t *audio_src = rational_resampler_create(
+        sig_rate, DSD_AUDIO_SAMPLERATE, 60.0f, DSD_INPUT_CHUNK / DSD_DECIMATION);
+    log_assert(decimator && audio_src);
+    freqdem_reset(fm_demod);
+
+    size_t out_rational = 0;
+    t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        const size_t ny = decimator_execute(decimator, x, DSD_INPUT_CHUNK, sig);
+        freqdem_demodulate_block(fm_demod, sig, ny, fm);
+        const size_t nz = rational_resampler_execute(audio_src, fm, ny, audio);
+        pcm_float_to_s16(audio, nz, INT16_MAX, pcm);
+        out_rational += nz;
+    }
+    const double rational = now_s() - t0;
+
+    const size_t input = args->iterations * DSD_INPUT_CHUNK;
+    report("dsd (msresamp x2)", legacy, input);
+    report("dsd (decimator + rational)", rational, input);
+    printf("%-32s %10.2fx\n", "speedup", legacy / rational);
+    printf("%-32s %zu / %zu samples\n", "dsd (48kHz output)", out_legacy,
+           out_rational);
+
+    // The conversion alone, over the last output chunk
+    const size_t n = out_rational / args->iterations;
+    t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            pcm[k] = audio[k] * INT16_MAX;
+        }
+        __asm__ volatile("" : : "r"(pcm) : "memory");
+    }
+    const double scalar = now_s() - t0;
+
+    t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        pcm_float_to_s16(audio, n, INT16_MAX, pcm);
+    }
+    const double simd = now_s() - t0;
+
+    report("int16 (scalar, wrapping)", scalar, args->iterations * n);
+    report("int16 (simd, saturating)", simd, args->iterations * n);
+
+    rational_resampler_destroy(&audio_src);
+    decimator_destroy(&decimator);
+    freqdem_destroy(fm_demod);
+    msresamp_rrrf_destroy(res_up);
+    msresamp_crcf_destroy(res_down);
+    free(pcm);
+    free(audio);
+    free(fm);
+    free(sig);
+    free(x);
+}
+
+// Whether the pre-roll holds exactly the samples `first` and on, up to
+// the end of what was pushed. The channel samples are their own indices.
+static bool preroll_holds(preroll_t *p, size_t first, size_t end)
+{
+    complex float *part[2];
+    size_t part_len[2];
+    const size_t num_parts = preroll_get(p, part, part_len);
+    size_t next = first;
+
+    for (size_t i = 0; i < num_parts; i++)
+    {
+        for (size_t j = 0; j < part_len[i]; j++)
+        {
+            if (crealf(part[i][j]) != (float)next++)
+            {
+                return false;
+            }
+        }
+    }
+    return next == end;
+}
+
+static void bench_preroll(bench_args_t const *args)
+{
+    const size_t len = (args->iterations + 32) * PREROLL_CHUNK;
+    complex float *x = malloc(len * sizeof(complex float));
+    complex float *buf = malloc(PREROLL_LEN * sizeof(complex float));
+    log_assert(x && buf);
+    for (size_t i = 0; i < len; i++)
+    {
+        x[i] = i;
+    }
+
+    preroll_t p;
+    preroll_init(&p, buf, PREROLL_LEN);
+
+    double t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        preroll_push(&p, &x[i * PREROLL_CHUNK], PREROLL_CHUNK);
+    }
+    report("preroll (push)", now_s() - t0, args->iterations * PREROLL_CHUNK);
+
+    // A transmission closing 300 samples into chunk 10, with the
+    // channel reopening in chunk 12: the pre-roll has to start right
+    // where the transmission ended, with none of it spliced in
+    size_t chunk = 10;
+    bool ok = true;
+    preroll_reset(&p, 300);
+    for (; chunk < 12; chunk++)
+    {
+        preroll_push(&p, &x[chunk * PREROLL_CHUNK], PREROLL_CHUNK);
+    }
+    ok &= preroll_holds(&p, (10 * PREROLL_CHUNK) + 300, chunk * PREROLL_CHUNK);
+
+    // Closing at the end of chunk 13, reopening after a longer gap
+    preroll_reset(&p, PREROLL_CHUNK);
+    for (chunk = 13; chunk < 22; chunk++)
+    {
+        preroll_push(&p, &x[chunk * PREROLL_CHUNK], PREROLL_CHUNK);
+    }
+    ok &= preroll_holds(&p, (chunk * PREROLL_CHUNK) - PREROLL_LEN,
+                        chunk * PREROLL_CHUNK);
+
+    // Reopening in the very chunk that follows the close
+    preroll_reset(&p, PREROLL_CHUNK / 2);
+    preroll_push(&p, &x[chunk * PREROLL_CHUNK], PREROLL_CHUNK);
+    ok &= preroll_holds(&p, (chunk * PREROLL_CHUNK) + (PREROLL_CHUNK / 2),
+                        (chunk + 1) * PREROLL_CHUNK);
+
+    printf("%-32s %s\n", "preroll (reopen)", ok ? "ok" : "FAILED");
+
+    free(buf);
+    free(x);
+
+    if (!ok)
+    {
+        LOG(ERROR, "The pre-roll of a reopened channel is off");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static bool audio_check_open(size_t chunk)
+{
+    return ((chunk >= 10) && (chunk < 40)) || (chunk >= 70);
+}
+
+static void bench_audio(bench_args_t const *args)
+{
+    float *x = malloc(AUDIO_CHUNK * sizeof(float));
+    float *y = malloc(AUDIO_CHUNK * sizeof(float));
+    log_assert(x && y);
+    for (size_t i = 0; i < AUDIO_CHUNK; i++)
+    {
+        x[i] = 0.5f * sinf((2.0f * M_PI * 1000.0f * i) / AUDIO_RATE);
+    }
+
+    audio_ring_t *ring = audio_ring_create(AUDIO_CAPACITY);
+    audio_sync_t *sync = audio_sync_create(AUDIO_TARGET, AUDIO_CHUNK);
+    log_assert(ring && sync);
+
+    double t0 = now_s();
+    for (size_t i = 0; i < args->iterations; i++)
+    {
+        audio_sync_write(sync, ring, x, AUDIO_CHUNK);
+        audio_ring_read(ring, y, AUDIO_CHUNK);
+    }
+    report("audio (sync + ring)", now_s() - t0,
+           args->iterations * AUDIO_CHUNK);
+
+    audio_sync_destroy(&sync);
+    audio_ring_destroy(&ring);
+
+    // Chunks come in as they're captured, while the callback takes its
+    // periods on the sound card's clock. As in sdr_pmr446, silence is
+    // written while the channel is closed, so it takes no underrun to
+    // open, close and reopen it.
+    ring = audio_ring_create(AUDIO_CAPACITY);
+    sync = audio_sync_create(AUDIO_TARGET, AUDIO_CHUNK);
+    log_assert(ring && sync);
+
+    const double chunk_s = AUDIO_CHUNK / AUDIO_RATE;
+    const double period_s =
+        AUDIO_PERIOD / (AUDIO_RATE * (1.0 + (AUDIO_CLOCK_PPM * 1e-6)));
+    // The stream starts with the first chunk
+    double callback_s = chunk_s;
+    for (size_t chunk = 0; chunk < AUDIO_CHECK_CHUNKS; chunk++)
+    {
+        const double captured_s = (chunk + 1) * chunk_s;
+        while (callback_s < captured_s)
+        {
+            audio_ring_read(ring, y, AUDIO_PERIOD);
+            callback_s += period_s;
+        }
+        if (audio_check_open(chunk))
+        {
+            audio_sync_write(sync, ring, x, AUDIO_CHUNK);
+        }
+        else
+        {
+            memset(y, 0, AUDIO_CHUNK * sizeof(float));
+            audio_sync_write(sync, ring, y, AUDIO_CHUNK);
+        }
+    }
+
+    audio_ring_stats_t stats;
+    audio_ring_get_stats(ring, &stats);
+    printf("%-32s %lu underruns, %lu overruns\n", "audio (reopen)",
+           stats.underruns, stats.overruns);
+
+    audio_sync_destroy(&sync);
+    audio_ring_destroy(&ring);
+    free(y);
+    free(x);
+
+    if ((stats.underruns > 0) || (stats.overruns > 0))
+    {
+        LOG(ERROR, "The audio buffer ran dry or over across a reopen");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static const bench_t benchmarks[] = {
+    {"channelizer", bench_channelizer},
+    {"ctcss", bench_ctcss},
+    {"chain", bench_chain},
+    {"dsd", bench_dsd},
+    {"preroll", bench_preroll},
+    {"audio", bench_audio},
+};
+
+int main(int argc, char *argv[])
+{
+    bench_args_t args = {.iterations = DEFAULT_ITERATIONS,
+                         .transmitters = DEFAULT_TRANSMITTERS,
+                         .filter = NULL};
+
+    logging_init();
+
+    argp_parse(&argp, argc, argv, 0, 0, &args);
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (args.filter && strcmp(args.filter, benchmarks[i].name) != 0)
+        {
+            continue;
+        }
+        printf("== %s ==\n", benchmarks[i].name);
+        benchmarks[i].run(&args);
+    }
+
+    exit(EXIT_SUCCESS);
+}
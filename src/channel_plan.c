@@ -0,0 +1,82 @@
+#include "channel_plan.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "logging.h"
+
+static const channel_plan_t presets[] = {
+    // Analogue PMR446, 446.00625 - 446.19375 MHz
+    {"pmr446", 446.0e6, 12500, 16},
+    // The original 8 channels, all that the older radios have
+    {"pmr446-8", 446.0e6, 12500, 8},
+    // dPMR446 and DMR Tier I, 446.003125 - 446.196875 MHz
+    {"dpmr446", 446.0e6, 6250, 32},
+};
+
+static bool plan_valid(const channel_plan_t *plan)
+{
+    return (plan->band_start_hz > 0.0) && (plan->channel_width_hz > 0) &&
+           (plan->num_channels >= 2) && ((plan->num_channels % 2) == 0) &&
+           (plan->num_channels <= CHANNEL_PLAN_MAX_CHANNELS);
+}
+
+bool channel_plan_parse(const char *spec, channel_plan_t *plan)
+{
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++)
+    {
+        if (strcmp(spec, presets[i].name) == 0)
+        {
+            *plan = presets[i];
+            return true;
+        }
+    }
+
+    channel_plan_t custom = {.name = "custom"};
+    char tail;
+    if (sscanf(spec, "%lf,%u,%u%c", &custom.band_start_hz,
+               &custom.channel_width_hz, &custom.num_channels, &tail) != 3)
+    {
+        return false;
+    }
+    if (!plan_valid(&custom))
+    {
+        return false;
+    }
+
+    *plan = custom;
+    return true;
+}
+
+void channel_plan_list(void)
+{
+    for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++)
+    {
+        LOG(INFO, "    %-10s %2u x %5u Hz from %.4f MHz", presets[i].name,
+            presets[i].num_channels, presets[i].channel_width_hz,
+            presets[i].band_start_hz * 1e-6);
+    }
+}
+
+void channel_plan_print(const channel_plan_t *plan)
+{
+    LOG(INFO, "Channel plan '%s': %u channels of %u Hz, %.5f - %.5f MHz",
+        plan->name, plan->num_channels, plan->channel_width_hz,
+        channel_plan_channel_hz(plan, 0) * 1e-6,
+        channel_plan_channel_hz(plan, plan->num_channels - 1) * 1e-6);
+}
+
+unsigned long channel_plan_bandwidth(const channel_plan_t *plan)
+{
+    return (unsigned long)plan->num_channels * plan->channel_width_hz;
+}
+
+double channel_plan_center_hz(const channel_plan_t *plan)
+{
+    return plan->band_start_hz + (0.5 * channel_plan_bandwidth(plan));
+}
+
+double channel_plan_channel_hz(const channel_plan_t *plan, unsigned int k)
+{
+    return plan->band_start_hz + ((k + 0.5) * plan->channel_width_hz);
+}
@@ -0,0 +1,413 @@
+#include "channelizer.h"
+
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "simd.h"
+
+typedef void (*mix_frame_fn)(channelizer_t *q, complex float const *x,
+                             float *out);
+typedef void (*emit_frame_fn)(channelizer_t *q, float const *f,
+                              complex float *y, size_t stride, bool energy);
+
+struct _channelizer_t
+{
+    unsigned int num_channels;
+    unsigned int num_taps;
+    size_t max_frames;
+    // `num_taps` rows of 2N floats - the polyphase branch coefficients,
+    // each one duplicated for the real and the imaginary part
+    float *coefs;
+    // The mixing sequence repeats every 2N samples, i.e. every two
+    // frames. Stored as (re, re) and (-im, im) pairs, so the complex
+    // multiplication is two multiplications and one pair swap.
+    float *mix_re;
+    float *mix_im;
+    // Mixed and time-reversed input frames, 2N floats each,
+    // `num_taps - 1` frames of history followed by the new ones
+    float *frames;
+    complex float *pending;
+    size_t num_pending;
+    unsigned int frame_parity;
+    complex float *fft_in;
+    complex float *fft_out;
+    fftplan fft;
+    // Per-channel |y|^2 accumulators, (re^2, im^2) pairs like `fft_out`,
+    // over the `energy_count` samples of the current block so far
+    float *energy_acc;
+    size_t energy_block;
+    size_t energy_count;
+    // The per-frame kernels, unrolled for the common channel counts
+    mix_frame_fn mix;
+    emit_frame_fn emit;
+    const char *kernel;
+};
+
+static void *alloc_aligned(size_t size)
+{
+    size = (size + SIMD_ALIGNMENT - 1) & ~((size_t)SIMD_ALIGNMENT - 1);
+    void *p = aligned_alloc(SIMD_ALIGNMENT, size);
+    if (p)
+    {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+// The per-frame kernels below take the number of channels as an argument
+// and are always inlined, so the specializations get a constant there and
+// their loops over the channels unrolled completely. The vector count of
+// those loops is at most N / 2, hence the unroll factor.
+#define CHANNELIZER_KERNEL static inline __attribute__((always_inline))
+
+// Mixes one frame of N samples and stores it time-reversed
+CHANNELIZER_KERNEL void mix_frame_n(channelizer_t *q, complex float const *x,
+                                    float *out, const unsigned int n)
+{
+    float const *x_f = (float const *)x;
+    float const *t_re = &q->mix_re[q->frame_parity * 2 * n];
+    float const *t_im = &q->mix_im[q->frame_parity * 2 * n];
+
+#pragma GCC unroll 32
+    for (unsigned int k = 0; k < n; k += 2)
+    {
+        const v4sf a = v4sf_load(&x_f[2 * k]);
+        const v4sf y = (a * v4sf_load(&t_re[2 * k])) +
+                       (v4sf_swap_pairs(a) * v4sf_load(&t_im[2 * k]));
+        v4sf_store(&out[2 * (n - 2 - k)], v4sf_swap_halves(y));
+    }
+
+    q->frame_parity ^= 1;
+}
+
+// Runs the polyphase branch filters over the frame `f` and
+// its `num_taps - 1` predecessors
+CHANNELIZER_KERNEL void filter_frame_n(channelizer_t *q, float const *f,
+                                       float *acc, const unsigned int n)
+{
+    const unsigned int len = 2 * n;
+
+#pragma GCC unroll 32
+    for (unsigned int i = 0; i < len; i += 4)
+    {
+        v4sf_store(&acc[i], v4sf_set1(0.0f));
+    }
+
+    for (unsigned int p = 0; p < q->num_taps; p++)
+    {
+        float const *h = &q->coefs[p * len];
+        float const *r = f - (p * len);
+#pragma GCC unroll 32
+        for (unsigned int i = 0; i < len; i += 4)
+        {
+            v4sf_store(&acc[i], v4sf_load(&acc[i]) +
+                                    (v4sf_load(&h[i]) * v4sf_load(&r[i])));
+        }
+    }
+}
+
+// Filters and transforms one frame into the `y[k * stride]` outputs
+CHANNELIZER_KERNEL void emit_frame_n(channelizer_t *q, float const *f,
+                                     complex float *y, size_t stride,
+                                     bool energy, const unsigned int n)
+{
+    const unsigned int len = 2 * n;
+    float const *out_f = (float const *)q->fft_out;
+
+    filter_frame_n(q, f, (float *)q->fft_in, n);
+    fft_execute(q->fft);
+
+    // The squelch statistics come for free while the output is hot
+    if (energy)
+    {
+#pragma GCC unroll 32
+        for (unsigned int i = 0; i < len; i += 4)
+        {
+            const v4sf v = v4sf_load(&out_f[i]);
+            v4sf_store(&q->energy_acc[i], v4sf_load(&q->energy_acc[i]) + (v * v));
+        }
+    }
+
+#pragma GCC unroll 64
+    for (unsigned int k = 0; k < n; k++)
+    {
+        y[k * stride] = q->fft_out[k];
+    }
+}
+
+#define CHANNELIZER_KERNELS(NAME, N)                                        \
+    static void mix_frame_##NAME(channelizer_t *q, complex float const *x,  \
+                                 float *out)                                \
+    {                                                                       \
+        mix_frame_n(q, x, out, (N));                                        \
+    }                                                                       \
+    static void emit_frame_##NAME(channelizer_t *q, float const *f,         \
+                                  complex float *y, size_t stride,          \
+                                  bool energy)                              \
+    {                                                                       \
+        emit_frame_n(q, f, y, stride, energy, (N));                         \
+    }
+
+CHANNELIZER_KERNELS(8, 8)
+CHANNELIZER_KERNELS(16, 16)
+CHANNELIZER_KERNELS(32, 32)
+CHANNELIZER_KERNELS(64, 64)
+CHANNELIZER_KERNELS(generic, q->num_channels)
+
+static void select_kernels(channelizer_t *q)
+{
+    switch (q->num_channels)
+    {
+    case 8:
+        q->mix = mix_frame_8;
+        q->emit = emit_frame_8;
+        q->kernel = "unrolled";
+        break;
+    case 16:
+        q->mix = mix_frame_16;
+        q->emit = emit_frame_16;
+        q->kernel = "unrolled";
+        break;
+    case 32:
+        q->mix = mix_frame_32;
+        q->emit = emit_frame_32;
+        q->kernel = "unrolled";
+        break;
+    case 64:
+        q->mix = mix_frame_64;
+        q->emit = emit_frame_64;
+        q->kernel = "unrolled";
+        break;
+    default:
+        q->mix = mix_frame_generic;
+        q->emit = emit_frame_generic;
+        q->kernel = "generic";
+        break;
+    }
+}
+
+channelizer_t *channelizer_create(unsigned int num_channels, unsigned int m,
+                                  float as, size_t max_input)
+{
+    // two complex samples per vector
+    log_assert((num_channels >= 2) && ((num_channels % 2) == 0));
+    log_assert(m > 0);
+
+    channelizer_t *self = calloc(1, sizeof(channelizer_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    const unsigned int n = num_channels;
+    self->num_channels = n;
+    self->num_taps = 2 * m;
+    self->max_frames = (max_input + n - 1) / n + 1;
+
+    self->coefs = alloc_aligned(self->num_taps * 2 * n * sizeof(float));
+    self->mix_re = alloc_aligned(2 * 2 * n * sizeof(float));
+    self->mix_im = alloc_aligned(2 * 2 * n * sizeof(float));
+    self->frames = alloc_aligned((self->num_taps - 1 + self->max_frames) * 2 *
+                                 n * sizeof(float));
+    self->pending = alloc_aligned(n * sizeof(complex float));
+    self->fft_in = alloc_aligned(n * sizeof(complex float));
+    self->fft_out = alloc_aligned(n * sizeof(complex float));
+    self->energy_acc = alloc_aligned(2 * n * sizeof(float));
+
+    if (!self->coefs || !self->mix_re || !self->mix_im || !self->frames ||
+        !self->pending || !self->fft_in || !self->fft_out ||
+        !self->energy_acc)
+    {
+        channelizer_destroy(&self);
+        return NULL;
+    }
+
+    // Same prototype as `firpfbch_crcf_create_kaiser`
+    const unsigned int h_len = 2 * n * m + 1;
+    float *h = malloc(h_len * sizeof(float));
+    log_assert(h);
+    liquid_firdes_kaiser(h_len, 0.5f / n, as, 0.0f, h);
+    for (unsigned int p = 0; p < self->num_taps; p++)
+    {
+        for (unsigned int r = 0; r < n; r++)
+        {
+            const float c = h[(p * n) + r];
+            self->coefs[(p * 2 * n) + (2 * r)] = c;
+            self->coefs[(p * 2 * n) + (2 * r) + 1] = c;
+        }
+    }
+    free(h);
+
+    for (unsigned int i = 0; i < 2 * n; i++)
+    {
+        const double phi = M_PI * (double)(n - 1) * (double)i / (double)n;
+        self->mix_re[2 * i] = self->mix_re[(2 * i) + 1] = cos(phi);
+        self->mix_im[2 * i] = -sin(phi);
+        self->mix_im[(2 * i) + 1] = sin(phi);
+    }
+
+    select_kernels(self);
+
+    self->fft = fft_create_plan(n, self->fft_in, self->fft_out,
+                                LIQUID_FFT_BACKWARD, 0);
+    if (!self->fft)
+    {
+        channelizer_destroy(&self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void channelizer_destroy(channelizer_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        channelizer_t *q = *q_p;
+        if (q->fft)
+        {
+            fft_destroy_plan(q->fft);
+        }
+        free(q->energy_acc);
+        free(q->fft_out);
+        free(q->fft_in);
+        free(q->pending);
+        free(q->frames);
+        free(q->mix_im);
+        free(q->mix_re);
+        free(q->coefs);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+void channelizer_reset(channelizer_t *q)
+{
+    memset(q->frames, 0, (q->num_taps - 1) * 2 * q->num_channels * sizeof(float));
+    memset(q->energy_acc, 0, 2 * q->num_channels * sizeof(float));
+    q->num_pending = 0;
+    q->frame_parity = 0;
+    q->energy_count = 0;
+}
+
+void channelizer_set_energy_block(channelizer_t *q, size_t block_len)
+{
+    q->energy_block = block_len;
+    q->energy_count = 0;
+    memset(q->energy_acc, 0, 2 * q->num_channels * sizeof(float));
+}
+
+size_t channelizer_max_energy_blocks(channelizer_t *q, size_t nx)
+{
+    if (q->energy_block == 0)
+    {
+        return 1;
+    }
+    // The pending samples and the block carried over complete one more
+    return ((nx + q->num_channels - 1) / q->num_channels) / q->energy_block + 1;
+}
+
+// Closes the current block, `end` being the index of the sample following it
+static void flush_energy(channelizer_t *q, channelizer_energy_t *e,
+                         size_t end)
+{
+    const unsigned int n = q->num_channels;
+    float *out = &e->energy[e->num_blocks * n];
+
+    log_assert(e->num_blocks < e->max_blocks);
+    for (unsigned int k = 0; k < n; k++)
+    {
+        out[k] = q->energy_acc[2 * k] + q->energy_acc[(2 * k) + 1];
+    }
+    e->end[e->num_blocks++] = end;
+
+    memset(q->energy_acc, 0, 2 * n * sizeof(float));
+    q->energy_count = 0;
+}
+
+unsigned int channelizer_num_channels(channelizer_t *q)
+{
+    return q->num_channels;
+}
+
+void channelizer_print(channelizer_t *q)
+{
+    LOG(INFO, "Channelizer: %u channels, %u taps per branch, %s kernels",
+        q->num_channels, q->num_taps, q->kernel);
+}
+
+size_t channelizer_execute(channelizer_t *q, complex float const *x, size_t nx,
+                           complex float *y, size_t stride,
+                           channelizer_energy_t *energy)
+{
+    const unsigned int n = q->num_channels;
+    const size_t frame_len = 2 * n;
+    float *new_frames = &q->frames[(q->num_taps - 1) * frame_len];
+    size_t num_frames = 0;
+
+    // Mix all the complete frames first...
+    if (q->num_pending > 0)
+    {
+        size_t k = n - q->num_pending;
+        if (k > nx)
+        {
+            k = nx;
+        }
+        memcpy(&q->pending[q->num_pending], x, k * sizeof(complex float));
+        q->num_pending += k;
+        x += k;
+        nx -= k;
+
+        if (q->num_pending == n)
+        {
+            q->mix(q, q->pending, &new_frames[num_frames++ * frame_len]);
+            q->num_pending = 0;
+        }
+    }
+
+    while (nx >= n)
+    {
+        log_assert(num_frames < q->max_frames);
+        q->mix(q, x, &new_frames[num_frames++ * frame_len]);
+        x += n;
+        nx -= n;
+    }
+
+    if (nx > 0)
+    {
+        memcpy(q->pending, x, nx * sizeof(complex float));
+        q->num_pending = nx;
+    }
+
+    // ...then filter and transform them
+    if (energy)
+    {
+        energy->num_blocks = 0;
+    }
+
+    for (size_t m = 0; m < num_frames; m++)
+    {
+        q->emit(q, &new_frames[m * frame_len], &y[m], stride, energy != NULL);
+        if (energy && (++q->energy_count == q->energy_block))
+        {
+            flush_energy(q, energy, m + 1);
+        }
+    }
+
+    // Without a block length every call is a block
+    if (energy && (q->energy_block == 0))
+    {
+        flush_energy(q, energy, num_frames);
+    }
+
+    // Keep the history for the next block
+    memmove(q->frames, &q->frames[num_frames * frame_len],
+            (q->num_taps - 1) * frame_len * sizeof(float));
+
+    return num_frames;
+}
@@ -0,0 +1,217 @@
+#include "chunk_queue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "logging.h"
+
+typedef struct
+{
+    chunk_t **items;
+    size_t head;
+    size_t count;
+} chunk_ring_t;
+
+struct _chunk_queue_t
+{
+    const char *name;
+    size_t depth;
+    chunk_t *chunks;
+    void *payload;
+    bool own_payload;
+    chunk_ring_t free;
+    chunk_ring_t full;
+    pthread_mutex_t lock;
+    pthread_cond_t free_cond;
+    pthread_cond_t full_cond;
+    bool closed;
+    size_t high_watermark;
+    uint64_t pushed;
+    uint64_t dropped;
+};
+
+static void ring_put(chunk_ring_t *r, size_t depth, chunk_t *c)
+{
+    log_assert(r->count < depth);
+    r->items[(r->head + r->count) % depth] = c;
+    r->count++;
+}
+
+static chunk_t *ring_get(chunk_ring_t *r, size_t depth)
+{
+    log_assert(r->count > 0);
+    chunk_t *c = r->items[r->head];
+    r->head = (r->head + 1) % depth;
+    r->count--;
+    return c;
+}
+
+chunk_queue_t *chunk_queue_create(const char *name, size_t depth,
+                                  size_t chunk_size, arena_t *arena)
+{
+    chunk_queue_t *self = calloc(1, sizeof(chunk_queue_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->name = name;
+    self->depth = depth;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->free_cond, NULL);
+    pthread_cond_init(&self->full_cond, NULL);
+
+    self->chunks = calloc(depth, sizeof(chunk_t));
+    if (arena)
+    {
+        chunk_size = arena_block_size(chunk_size);
+        self->payload = arena_alloc(arena, depth * chunk_size);
+    }
+    else
+    {
+        self->payload = calloc(depth, chunk_size);
+        self->own_payload = true;
+    }
+    self->free.items = calloc(depth, sizeof(chunk_t *));
+    self->full.items = calloc(depth, sizeof(chunk_t *));
+
+    if (!self->chunks || !self->payload || !self->free.items ||
+        !self->full.items)
+    {
+        chunk_queue_destroy(&self);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < depth; i++)
+    {
+        self->chunks[i].data = (char *)self->payload + (i * chunk_size);
+        ring_put(&self->free, depth, &self->chunks[i]);
+    }
+
+    return self;
+}
+
+void chunk_queue_destroy(chunk_queue_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        chunk_queue_t *q = *q_p;
+        pthread_cond_destroy(&q->full_cond);
+        pthread_cond_destroy(&q->free_cond);
+        pthread_mutex_destroy(&q->lock);
+        free(q->full.items);
+        free(q->free.items);
+        if (q->own_payload)
+        {
+            free(q->payload);
+        }
+        free(q->chunks);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+chunk_t *chunk_queue_acquire(chunk_queue_t *q, bool wait)
+{
+    chunk_t *c = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (wait && !q->closed && (q->free.count == 0))
+    {
+        pthread_cond_wait(&q->free_cond, &q->lock);
+    }
+    if (!q->closed && (q->free.count > 0))
+    {
+        c = ring_get(&q->free, q->depth);
+        c->len = 0;
+        c->time_ns = 0;
+        c->capture_ns = 0;
+        c->flags = 0;
+        c->ref = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return c;
+}
+
+void chunk_queue_push(chunk_queue_t *q, chunk_t *c)
+{
+    pthread_mutex_lock(&q->lock);
+    c->seq = q->pushed++;
+    ring_put(&q->full, q->depth, c);
+    if (q->full.count > q->high_watermark)
+    {
+        q->high_watermark = q->full.count;
+    }
+    pthread_cond_signal(&q->full_cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void chunk_queue_count_drop(chunk_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->dropped++;
+    pthread_mutex_unlock(&q->lock);
+}
+
+chunk_t *chunk_queue_pop(chunk_queue_t *q)
+{
+    chunk_t *c = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (!q->closed && (q->full.count == 0))
+    {
+        pthread_cond_wait(&q->full_cond, &q->lock);
+    }
+    if (q->full.count > 0)
+    {
+        c = ring_get(&q->full, q->depth);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return c;
+}
+
+chunk_t *chunk_queue_try_pop(chunk_queue_t *q)
+{
+    chunk_t *c = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->full.count > 0)
+    {
+        c = ring_get(&q->full, q->depth);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return c;
+}
+
+void chunk_queue_release(chunk_queue_t *q, chunk_t *c)
+{
+    pthread_mutex_lock(&q->lock);
+    ring_put(&q->free, q->depth, c);
+    pthread_cond_signal(&q->free_cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void chunk_queue_close(chunk_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->free_cond);
+    pthread_cond_broadcast(&q->full_cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void chunk_queue_get_stats(chunk_queue_t *q, chunk_queue_stats_t *stats)
+{
+    pthread_mutex_lock(&q->lock);
+    stats->name = q->name;
+    stats->depth = q->depth;
+    stats->used = q->full.count;
+    stats->high_watermark = q->high_watermark;
+    stats->pushed = q->pushed;
+    stats->dropped = q->dropped;
+    pthread_mutex_unlock(&q->lock);
+}
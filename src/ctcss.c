@@ -0,0 +1,343 @@
+#include "ctcss.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+#define CTCSS_NUM_VECS (CTCSS_NUM_LANES / 8)
+
+// Target rate of the sub-audio branch, the highest tone is ~250Hz
+#define CTCSS_SUBAUDIO_RATE (1000.0f)
+#define CTCSS_DECIM_FILT_M (4)
+#define CTCSS_DECIM_FILT_AS (60.0f)
+#define CTCSS_SUB_BUF_SIZE (256)
+
+// Detection thresholds, the average power is normalized to the window
+// length (it was 120 for the 2441 samples long blocks at 12.5kHz)
+#define CTCSS_MIN_AVG_POWER (2.0e-5f)
+#define CTCSS_MIN_PEAK_TO_AVG (10.0f)
+
+_Static_assert((CTCSS_NUM_LANES % 8 == 0) &&
+                   (CTCSS_NUM_LANES >= CTCSS_NUM_FREQS),
+               "CTCSS_NUM_LANES has to be a multiple of 8");
+
+typedef void (*bank_update_t)(ctcss_detector_t *ctcss, float const *xs,
+                              size_t nx);
+
+// clang-format off
+const float ctcss_freqs[CTCSS_NUM_FREQS] = {
+    67.0f, 71.9f, 74.4f, 77.0f, 79.7f, 82.5f, 85.4f, 88.5f, 91.5f, 94.8f, 97.4f, 100.0f, 103.5f, 107.2f,
+    110.9f, 114.8f, 118.8f, 123.0f, 127.3f, 131.8f, 136.5f, 141.3f, 146.2f, 151.4f, 156.7f, 162.2f,
+    167.9f, 173.8f, 179.9f, 186.2f, 192.8f, 203.5f, 210.7f, 218.1f, 225.7f, 233.6f, 241.8f, 250.3f};
+// clang-format on
+
+void ctcss_detector_reset(ctcss_detector_t *ctcss)
+{
+    ctcss->samp_processed = 0;
+    ctcss->max_power = 0.0f;
+    ctcss->max_power_index = 0;
+    ctcss->tone_detected = false;
+
+    memset(ctcss->u0, 0, sizeof(ctcss->u0));
+    memset(ctcss->u1, 0, sizeof(ctcss->u1));
+    memset(ctcss->power, 0, sizeof(ctcss->power));
+    memset(ctcss->phase, 0, sizeof(ctcss->phase));
+
+    ctcss->seg_index = 0;
+    ctcss->segs_filled = 0;
+
+    if (ctcss->decim)
+    {
+        firdecim_rrrf_reset(ctcss->decim);
+    }
+    ctcss->num_decim_pending = 0;
+}
+
+ctcss_detector_t *ctcss_detector_create(float sample_rate, size_t window,
+                                        size_t hop)
+{
+    log_assert((hop > 0) && (window >= hop));
+
+    ctcss_detector_t *self =
+        aligned_alloc(SIMD_ALIGNMENT, sizeof(ctcss_detector_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    memset(self, 0, sizeof(ctcss_detector_t));
+
+    self->decim_factor = (unsigned int)(sample_rate / CTCSS_SUBAUDIO_RATE);
+    if (self->decim_factor < 1)
+    {
+        self->decim_factor = 1;
+    }
+    self->sample_rate = sample_rate / self->decim_factor;
+
+    self->hop = (size_t)lroundf((float)hop / self->decim_factor);
+    if (self->hop < 1)
+    {
+        self->hop = 1;
+    }
+    self->num_segs = (unsigned int)lroundf((float)window / hop);
+
+    self->decim_pending = malloc(self->decim_factor * sizeof(float));
+    self->sub_buf = malloc(CTCSS_SUB_BUF_SIZE * sizeof(float));
+    self->seg_re = calloc(self->num_segs * CTCSS_NUM_FREQS, sizeof(float));
+    self->seg_im = calloc(self->num_segs * CTCSS_NUM_FREQS, sizeof(float));
+    if (!self->decim_pending || !self->sub_buf || !self->seg_re ||
+        !self->seg_im)
+    {
+        ctcss_detector_destroy(&self);
+        return NULL;
+    }
+
+    if (self->decim_factor > 1)
+    {
+        self->decim = firdecim_rrrf_create_kaiser(
+            self->decim_factor, CTCSS_DECIM_FILT_M, CTCSS_DECIM_FILT_AS);
+        if (!self->decim)
+        {
+            ctcss_detector_destroy(&self);
+            return NULL;
+        }
+        // The Kaiser design has a passband gain of about `decim_factor`,
+        // the thresholds are for the level of the tones as they come
+        firdecim_rrrf_set_scale(self->decim, 1.0f / self->decim_factor);
+    }
+
+    ctcss_detector_reset(self);
+
+    // The padding lanes keep a zero coefficient and are never evaluated
+    for (unsigned int j = 0; j < CTCSS_NUM_FREQS; ++j)
+    {
+        self->omega[j] = (2.0 * M_PI * ctcss_freqs[j]) / self->sample_rate;
+        self->coef[j] = 2.0f * cosf(self->omega[j]);
+    }
+    return self;
+}
+
+void ctcss_detector_destroy(ctcss_detector_t **ctcss_p)
+{
+    log_assert(ctcss_p);
+    if (*ctcss_p)
+    {
+        ctcss_detector_t *ctcss = *ctcss_p;
+        if (ctcss->decim)
+        {
+            firdecim_rrrf_destroy(ctcss->decim);
+        }
+        free(ctcss->seg_im);
+        free(ctcss->seg_re);
+        free(ctcss->sub_buf);
+        free(ctcss->decim_pending);
+        free(ctcss);
+        *ctcss_p = NULL;
+    }
+}
+
+static void evaluate_window(ctcss_detector_t *ctcss)
+{
+    const float len = (float)(ctcss->num_segs * ctcss->hop);
+    float avg_power = 0.0f;
+
+    ctcss->max_power = 0.0f;
+    for (unsigned int j = 0; j < CTCSS_NUM_FREQS; ++j)
+    {
+        float re = 0.0f;
+        float im = 0.0f;
+        for (unsigned int k = 0; k < ctcss->num_segs; k++)
+        {
+            re += ctcss->seg_re[(k * CTCSS_NUM_FREQS) + j];
+            im += ctcss->seg_im[(k * CTCSS_NUM_FREQS) + j];
+        }
+        ctcss->power[j] = ((re * re) + (im * im)) / (len * len);
+        avg_power += ctcss->power[j];
+        if (ctcss->power[j] > ctcss->max_power)
+        {
+            ctcss->max_power = ctcss->power[j];
+            ctcss->max_power_index = j;
+        }
+    }
+    avg_power /= CTCSS_NUM_FREQS;
+    ctcss->tone_detected =
+        (avg_power > CTCSS_MIN_AVG_POWER) &&
+        ((ctcss->max_power / avg_power) > CTCSS_MIN_PEAK_TO_AVG);
+}
+
+// Turns the Goertzel state after a hop into the DFT of the hop, with the
+// phase referred to a common origin, so the hops can be summed up into
+// the DFT of the whole window
+static void end_hop(ctcss_detector_t *ctcss)
+{
+    float *re = &ctcss->seg_re[ctcss->seg_index * CTCSS_NUM_FREQS];
+    float *im = &ctcss->seg_im[ctcss->seg_index * CTCSS_NUM_FREQS];
+
+    for (unsigned int j = 0; j < CTCSS_NUM_FREQS; ++j)
+    {
+        const double w = ctcss->omega[j];
+        // sum(x[n] * e^(-jwn)) = e^(-jw(L - 1)) * (u0 - e^(-jw) * u1)
+        const float y_re = ctcss->u0[j] - ((float)cos(w) * ctcss->u1[j]);
+        const float y_im = (float)sin(w) * ctcss->u1[j];
+        const double phi = ctcss->phase[j] + (w * (ctcss->hop - 1));
+        const float c = (float)cos(phi);
+        const float s = (float)sin(phi);
+        re[j] = (y_re * c) + (y_im * s);
+        im[j] = (y_im * c) - (y_re * s);
+        ctcss->phase[j] = fmod(ctcss->phase[j] + (w * ctcss->hop), 2.0 * M_PI);
+    }
+
+    memset(ctcss->u0, 0, sizeof(ctcss->u0));
+    memset(ctcss->u1, 0, sizeof(ctcss->u1));
+    ctcss->samp_processed = 0;
+    ctcss->seg_index = (ctcss->seg_index + 1) % ctcss->num_segs;
+
+    if (ctcss->segs_filled < ctcss->num_segs)
+    {
+        ctcss->segs_filled++;
+    }
+    if (ctcss->segs_filled == ctcss->num_segs)
+    {
+        evaluate_window(ctcss);
+    }
+}
+
+// In the AVX2 clone the filter state of the bank (u0 and u1, 10 ymm
+// registers for the 40 lanes) stays in registers for the duration of
+// the hop, the coefficients are memory operands. The baseline clone
+// splits every vector into two SSE halves, 20 xmm registers for the
+// state alone out of 16, so part of it goes through the stack every
+// sample.
+SIMD_TARGET_CLONES
+static void goertzel_bank_update(ctcss_detector_t *ctcss, float const *xs,
+                                 size_t nx)
+{
+    v8sf c[CTCSS_NUM_VECS];
+    v8sf u0[CTCSS_NUM_VECS];
+    v8sf u1[CTCSS_NUM_VECS];
+
+    memcpy(c, ctcss->coef, sizeof(c));
+    memcpy(u0, ctcss->u0, sizeof(u0));
+    memcpy(u1, ctcss->u1, sizeof(u1));
+
+    for (size_t i = 0; i < nx; i++)
+    {
+        const float in = xs[i];
+        for (unsigned int v = 0; v < CTCSS_NUM_VECS; v++)
+        {
+            const v8sf t = u0[v];
+            u0[v] = in + (c[v] * u0[v]) - u1[v];
+            u1[v] = t;
+        }
+    }
+
+    memcpy(ctcss->u0, u0, sizeof(u0));
+    memcpy(ctcss->u1, u1, sizeof(u1));
+}
+
+static void goertzel_bank_update_scalar(ctcss_detector_t *ctcss,
+                                        float const *xs, size_t nx)
+{
+    for (size_t i = 0; i < nx; i++)
+    {
+        const float in = xs[i];
+
+        for (unsigned int j = 0; j < CTCSS_NUM_FREQS; ++j)
+        {
+            const float t = ctcss->u0[j];
+            ctcss->u0[j] = in + (ctcss->coef[j] * ctcss->u0[j]) - ctcss->u1[j];
+            ctcss->u1[j] = t;
+        }
+    }
+}
+
+// Decimates up to CTCSS_SUB_BUF_SIZE samples into `sub_buf`,
+// returns the number of input samples consumed
+static size_t decimate(ctcss_detector_t *ctcss, float const *xs, size_t nx,
+                       size_t *ns)
+{
+    const unsigned int m = ctcss->decim_factor;
+    size_t used = 0;
+
+    *ns = 0;
+    if (m == 1)
+    {
+        used = nx < CTCSS_SUB_BUF_SIZE ? nx : CTCSS_SUB_BUF_SIZE;
+        memcpy(ctcss->sub_buf, xs, used * sizeof(float));
+        *ns = used;
+        return used;
+    }
+
+    while ((used < nx) && (*ns < CTCSS_SUB_BUF_SIZE))
+    {
+        if ((ctcss->num_decim_pending == 0) && ((nx - used) >= m))
+        {
+            size_t nb = (nx - used) / m;
+            if (nb > CTCSS_SUB_BUF_SIZE - *ns)
+            {
+                nb = CTCSS_SUB_BUF_SIZE - *ns;
+            }
+            firdecim_rrrf_execute_block(ctcss->decim, (float *)&xs[used], nb,
+                                        &ctcss->sub_buf[*ns]);
+            *ns += nb;
+            used += nb * m;
+        }
+        else
+        {
+            ctcss->decim_pending[ctcss->num_decim_pending++] = xs[used++];
+            if (ctcss->num_decim_pending == m)
+            {
+                firdecim_rrrf_execute(ctcss->decim, ctcss->decim_pending,
+                                      &ctcss->sub_buf[(*ns)++]);
+                ctcss->num_decim_pending = 0;
+            }
+        }
+    }
+
+    return used;
+}
+
+static void analyze(ctcss_detector_t *ctcss, float const *xs, size_t nx,
+                    bank_update_t update)
+{
+    while (nx > 0)
+    {
+        size_t ns;
+        const size_t used = decimate(ctcss, xs, nx, &ns);
+        xs += used;
+        nx -= used;
+
+        float const *s = ctcss->sub_buf;
+        while (ns > 0)
+        {
+            size_t n = ctcss->hop - ctcss->samp_processed;
+            if (n > ns)
+            {
+                n = ns;
+            }
+
+            update(ctcss, s, n);
+            ctcss->samp_processed += n;
+            s += n;
+            ns -= n;
+
+            if (ctcss->samp_processed == ctcss->hop)
+            {
+                end_hop(ctcss);
+            }
+        }
+    }
+}
+
+void ctcss_detector_analyze(ctcss_detector_t *ctcss, float const *xs,
+                            size_t nx)
+{
+    analyze(ctcss, xs, nx, goertzel_bank_update);
+}
+
+void ctcss_detector_analyze_scalar(ctcss_detector_t *ctcss, float const *xs,
+                                   size_t nx)
+{
+    analyze(ctcss, xs, nx, goertzel_bank_update_scalar);
+}
@@ -0,0 +1,391 @@
+#include "decimator.h"
+
+#include <liquid/liquid.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "simd.h"
+
+#define CIC_ORDER (4)
+// The integrators wrap around, which is fine as long as the
+// output fits: 16 bits of input + CIC_ORDER * log2(ratio)
+#define CIC_MAX_RATIO (15)
+#define CIC_INPUT_SCALE (32767.0f)
+// The CIC filter droops towards the edge of the output band (half the
+// output rate), the more the fewer halfbands follow it: by 14-16 dB with
+// none, 3.3-3.6 dB with one, less than 0.9 dB with two. Beyond this, the
+// factor is better left to an arbitrary rate resampler.
+#define CIC_MAX_DROOP_DB (1.0f)
+
+// Halfband filter semi-lengths. The last stage, producing the output
+// rate, needs a steep transition, the ones before it have a lot of room.
+#define HB_LAST_STAGE_M (16)
+#define HB_STAGE_M (4)
+
+// (I, Q) pair of integrator/comb registers
+typedef uint32_t v2su __attribute__((vector_size(8)));
+
+typedef struct
+{
+    unsigned int ratio;
+    unsigned int phase;
+    float scale;
+    v2su integ[CIC_ORDER];
+    v2su comb[CIC_ORDER];
+} cic_stage_t;
+
+typedef struct
+{
+    unsigned int m;
+    float *g;
+    size_t hist;
+    // polyphase components of the input, `hist` samples of history first
+    complex float *even;
+    complex float *odd;
+    complex float pending;
+    bool has_pending;
+    complex float *out;
+} hb_stage_t;
+
+struct _decimator_t
+{
+    unsigned int factor;
+    cic_stage_t *cic;
+    complex float *cic_out;
+    hb_stage_t *hb;
+    unsigned int num_hb;
+};
+
+// The attenuation of the CIC filter at half the final output rate [dB]
+static float cic_droop_db(unsigned int ratio, unsigned int num_hb)
+{
+    // relative to the CIC input rate
+    const double f = 0.5 / (ratio * (double)(1U << num_hb));
+    const double h = sin(M_PI * ratio * f) / (ratio * sin(M_PI * f));
+    return (float)(-20.0 * CIC_ORDER * log10(h));
+}
+
+static void *alloc_aligned(size_t size)
+{
+    size = (size + SIMD_ALIGNMENT - 1) & ~((size_t)SIMD_ALIGNMENT - 1);
+    void *p = aligned_alloc(SIMD_ALIGNMENT, size);
+    if (p)
+    {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+static inline float clamp_unit(float v)
+{
+    v = v > -1.0f ? v : -1.0f;
+    return v < 1.0f ? v : 1.0f;
+}
+
+static size_t cic_execute(cic_stage_t *s, complex float const *x, size_t nx,
+                          complex float *y)
+{
+    size_t ny = 0;
+    unsigned int phase = s->phase;
+    // Kept in registers for the whole block (the loops over them have to
+    // be unrolled for that), fminf()/fmaxf() would be library calls here,
+    // so the input is clamped with plain comparisons
+    v2su integ[CIC_ORDER];
+    memcpy(integ, s->integ, sizeof(integ));
+
+    for (size_t i = 0; i < nx; i++)
+    {
+        const float re = clamp_unit(crealf(x[i]));
+        const float im = clamp_unit(cimagf(x[i]));
+        v2su v = {(uint32_t)(int32_t)(re * CIC_INPUT_SCALE),
+                  (uint32_t)(int32_t)(im * CIC_INPUT_SCALE)};
+
+#pragma GCC unroll 8
+        for (int k = 0; k < CIC_ORDER; k++)
+        {
+            integ[k] += v;
+            v = integ[k];
+        }
+
+        if (++phase == s->ratio)
+        {
+            phase = 0;
+            for (int k = 0; k < CIC_ORDER; k++)
+            {
+                const v2su t = v - s->comb[k];
+                s->comb[k] = v;
+                v = t;
+            }
+            y[ny++] = ((float)(int32_t)v[0] * s->scale) +
+                      _Complex_I * ((float)(int32_t)v[1] * s->scale);
+        }
+    }
+
+    memcpy(s->integ, integ, sizeof(integ));
+    s->phase = phase;
+    return ny;
+}
+
+static size_t hb_execute(hb_stage_t *s, complex float const *x, size_t nx,
+                         complex float *y)
+{
+    complex float *e = &s->even[s->hist];
+    complex float *o = &s->odd[s->hist];
+    const ptrdiff_t m = s->m;
+    size_t n = 0;
+    size_t i = 0;
+
+    if (s->has_pending && (nx > 0))
+    {
+        e[n] = s->pending;
+        o[n++] = x[i++];
+        s->has_pending = false;
+    }
+    for (; i + 1 < nx; i += 2)
+    {
+        e[n] = x[i];
+        o[n++] = x[i + 1];
+    }
+    if (i < nx)
+    {
+        s->pending = x[i];
+        s->has_pending = true;
+    }
+
+    // Only every other tap of a halfband filter is non-zero, and those are
+    // symmetric, so the odd phase is folded before the multiplication:
+    // y[k] = 0.5 * e[k - m] + sum_j(g[j] * (o[k - 1 - j] + o[k - 2m + j]))
+    float const *ef = (float const *)e;
+    float const *of = (float const *)o;
+    float *yf = (float *)y;
+    ptrdiff_t k = 0;
+
+    for (; k + 2 <= (ptrdiff_t)n; k += 2)
+    {
+        v4sf acc = v4sf_set1(0.5f) * v4sf_load(&ef[2 * (k - m)]);
+        for (ptrdiff_t j = 0; j < m; j++)
+        {
+            acc += v4sf_set1(s->g[j]) * (v4sf_load(&of[2 * (k - 1 - j)]) +
+                                         v4sf_load(&of[2 * (k - (2 * m) + j)]));
+        }
+        v4sf_store(&yf[2 * k], acc);
+    }
+    for (; k < (ptrdiff_t)n; k++)
+    {
+        complex float acc = 0.5f * e[k - m];
+        for (ptrdiff_t j = 0; j < m; j++)
+        {
+            acc += s->g[j] * (o[k - 1 - j] + o[k - (2 * m) + j]);
+        }
+        y[k] = acc;
+    }
+
+    memmove(s->even, &s->even[n], s->hist * sizeof(complex float));
+    memmove(s->odd, &s->odd[n], s->hist * sizeof(complex float));
+
+    return n;
+}
+
+static bool hb_init(hb_stage_t *s, unsigned int m, float as, size_t max_out)
+{
+    const unsigned int h_len = (4 * m) + 1;
+    float *h = malloc(h_len * sizeof(float));
+    if (!h)
+    {
+        return false;
+    }
+
+    s->m = m;
+    s->hist = 2 * m;
+    s->g = malloc(m * sizeof(float));
+    s->even = alloc_aligned((s->hist + max_out) * sizeof(complex float));
+    s->odd = alloc_aligned((s->hist + max_out) * sizeof(complex float));
+    s->out = alloc_aligned(max_out * sizeof(complex float));
+    if (!s->g || !s->even || !s->odd || !s->out)
+    {
+        free(h);
+        return false;
+    }
+
+    // Windowed sinc at a quarter of the sample rate, normalized
+    // for unity gain with the centre tap at exactly 0.5
+    liquid_firdes_kaiser(h_len, 0.25f, as, 0.0f, h);
+    float sum = 0.0f;
+    for (unsigned int j = 0; j < m; j++)
+    {
+        s->g[j] = h[(2 * j) + 1];
+        sum += 2.0f * s->g[j];
+    }
+    for (unsigned int j = 0; j < m; j++)
+    {
+        s->g[j] *= 0.5f / sum;
+    }
+    free(h);
+
+    return true;
+}
+
+static void hb_free(hb_stage_t *s)
+{
+    free(s->out);
+    free(s->odd);
+    free(s->even);
+    free(s->g);
+}
+
+decimator_t *decimator_create(unsigned int factor, float as, size_t max_input)
+{
+    log_assert(factor > 0);
+
+    unsigned int ratio = factor;
+    unsigned int num_hb = 0;
+    while ((ratio % 2) == 0)
+    {
+        ratio /= 2;
+        num_hb++;
+    }
+
+    if (ratio > CIC_MAX_RATIO)
+    {
+        LOG(WARN, "Decimation factor %u has an odd part (%u) larger than %d",
+            factor, ratio, CIC_MAX_RATIO);
+        return NULL;
+    }
+    if ((ratio > 1) && (cic_droop_db(ratio, num_hb) > CIC_MAX_DROOP_DB))
+    {
+        LOG(INFO,
+            "Decimation factor %u would droop by %.1f dB at the band edge "
+            "(CIC: R=%u, halfband stages: %u)",
+            factor, cic_droop_db(ratio, num_hb), ratio, num_hb);
+        return NULL;
+    }
+
+    decimator_t *self = calloc(1, sizeof(decimator_t));
+    if (!self)
+    {
+        return NULL;
+    }
+    self->factor = factor;
+
+    size_t max_n = max_input;
+    if (ratio > 1)
+    {
+        max_n = max_n / ratio + 1;
+        self->cic = calloc(1, sizeof(cic_stage_t));
+        self->cic_out = alloc_aligned(max_n * sizeof(complex float));
+        if (!self->cic || !self->cic_out)
+        {
+            decimator_destroy(&self);
+            return NULL;
+        }
+        self->cic->ratio = ratio;
+        self->cic->scale = 1.0f / (CIC_INPUT_SCALE * powf(ratio, CIC_ORDER));
+    }
+
+    if (num_hb > 0)
+    {
+        self->hb = calloc(num_hb, sizeof(hb_stage_t));
+        if (!self->hb)
+        {
+            decimator_destroy(&self);
+            return NULL;
+        }
+        for (unsigned int i = 0; i < num_hb; i++)
+        {
+            max_n = max_n / 2 + 1;
+            const unsigned int m = (i == num_hb - 1) ? HB_LAST_STAGE_M : HB_STAGE_M;
+            self->num_hb++;
+            if (!hb_init(&self->hb[i], m, as, max_n))
+            {
+                decimator_destroy(&self);
+                return NULL;
+            }
+        }
+    }
+
+    return self;
+}
+
+void decimator_destroy(decimator_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        decimator_t *q = *q_p;
+        for (unsigned int i = 0; i < q->num_hb; i++)
+        {
+            hb_free(&q->hb[i]);
+        }
+        free(q->hb);
+        free(q->cic_out);
+        free(q->cic);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+void decimator_reset(decimator_t *q)
+{
+    if (q->cic)
+    {
+        const unsigned int ratio = q->cic->ratio;
+        const float scale = q->cic->scale;
+        memset(q->cic, 0, sizeof(cic_stage_t));
+        q->cic->ratio = ratio;
+        q->cic->scale = scale;
+    }
+    for (unsigned int i = 0; i < q->num_hb; i++)
+    {
+        hb_stage_t *s = &q->hb[i];
+        memset(s->even, 0, s->hist * sizeof(complex float));
+        memset(s->odd, 0, s->hist * sizeof(complex float));
+        s->has_pending = false;
+    }
+}
+
+void decimator_print(decimator_t *q)
+{
+    LOG(INFO, "Decimator: factor %u, CIC: R=%u N=%d, halfband stages: %u",
+        q->factor, q->cic ? q->cic->ratio : 1, q->cic ? CIC_ORDER : 0, q->num_hb);
+    for (unsigned int i = 0; i < q->num_hb; i++)
+    {
+        LOG(INFO, "    halfband #%u: %u taps", i, (4 * q->hb[i].m) + 1);
+    }
+}
+
+unsigned int decimator_factor(decimator_t *q)
+{
+    return q->factor;
+}
+
+size_t decimator_execute(decimator_t *q, complex float const *x, size_t nx,
+                         complex float *y)
+{
+    complex float const *src = x;
+    size_t n = nx;
+
+    if (q->cic)
+    {
+        complex float *dst = q->num_hb > 0 ? q->cic_out : y;
+        n = cic_execute(q->cic, src, n, dst);
+        src = dst;
+    }
+
+    for (unsigned int i = 0; i < q->num_hb; i++)
+    {
+        complex float *dst = (i == q->num_hb - 1) ? y : q->hb[i].out;
+        n = hb_execute(&q->hb[i], src, n, dst);
+        src = dst;
+    }
+
+    if (src != y)
+    {
+        memmove(y, src, n * sizeof(complex float));
+    }
+
+    return n;
+}
@@ -1,9 +1,14 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <complex.h>
 #include <math.h>
@@ -15,26 +20,59 @@
 
 #include <liquid/liquid.h>
 
+#include "arena.h"
+#include "chunk_queue.h"
 #include "dsd_in.h"
 #include "shared.h"
 #include "logging.h"
+#include "pcm.h"
 
 #define AUDIO_SAMPLERATE (48000UL)
 #define SIG_SAMPLERATE (12500UL)
+// The highest rate the decimation can stop at, instead of SIG_SAMPLERATE
+#define SIG_MAX_SAMPLERATE (16000UL)
+// The odd part of the decimation factor goes to a CIC filter
+#define SIG_MAX_ODD_FACTOR (15)
 
 #define SDR_INPUT_CHUNK (200000UL)
 #define DEFAULT_SDR_FREQUENCY (160.0e6)
 #define DEFAULT_SDR_GAIN (25.0)
+#define DEFAULT_QUEUE_DEPTH (8)
+// Output chunks written with a single writev() at most
+#define OUTPUT_MAX_BATCH (16)
 
 #define xstr(s) str(s)
 #define str(s) #s
 
+typedef struct
+{
+    proc_chain_t *chain;
+    chunk_queue_t *capture_q;
+    chunk_queue_t *output_q;
+    complex float *drop_buf;
+    // DSP intermediate buffers
+    complex float *resamp_buf;
+    float *fm_out_buf;
+    float *out_buf;
+    // Output statistics
+    uint64_t bytes_written;
+    uint64_t capture_drops;
+} pipeline_t;
+
+static volatile sig_atomic_t exit_via_sig;
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
 
 static proc_chain_t g_chain = {
     .args = {
         .gain = DEFAULT_SDR_GAIN,
         .frequency = DEFAULT_SDR_FREQUENCY,
+        .sample_rate = SDR_SAMPLERATE,
+        .input = NULL,
+        .input_format = IQ_FORMAT_CU8,
+        .realtime = false,
+        .output_policy = output_policy_block,
+        .queue_depth = DEFAULT_QUEUE_DEPTH,
     }};
 
 static char doc[] =
@@ -45,6 +83,12 @@ static char args_doc[] = "";
 static struct argp_option options[] = {
     {"gain", 'g', "G", 0, "The gain to set in the SDR receiver in [dB] (default: " xstr(DEFAULT_SDR_GAIN) ")"},
     {"frequency", 'f', "FQ", 0, "The receive frequency of the SDR (default: " xstr(DEFAULT_SDR_FREQUENCY) ")"},
+    {"input", 'i', "FILE", 0, "Read recorded IQ samples from FILE instead of the SDR"},
+    {"input-format", 'F', "FMT", 0, "The format of the '-i' file: cf32, cs16, or cu8 (default: cu8)"},
+    {"realtime", 'R', 0, 0, "Pace the '-i' file to its sample rate, instead of processing it as fast as possible"},
+    {"sample-rate", 'r', "SR", 0, "The sample rate of the '-i' file (default: " xstr(SDR_SAMPLERATE) ")"},
+    {"output-policy", 'p', "POL", 0, "What to do when the output is too slow: 'block' (the capture drops samples instead), 'drop-oldest' (drop the oldest audio not written yet), or 'report' (drop the newest audio and log it) (default: 'block')"},
+    {"queue-depth", 'q', "QD", 0, "The number of chunks buffered between capture, DSP and output (default: " xstr(DEFAULT_QUEUE_DEPTH) ")"},
     {0}};
 
 static struct argp argp = {options, parse_opt, args_doc, doc};
@@ -74,6 +118,60 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         }
         break;
 
+    case 'i':
+        arguments->input = arg;
+        break;
+
+    case 'F':
+        if (!iq_format_parse(arg, &arguments->input_format))
+        {
+            LOG(ERROR, "Failed to parse input format (should be 'cf32', 'cs16', or 'cu8')");
+            argp_usage(state);
+        }
+        break;
+
+    case 'R':
+        arguments->realtime = true;
+        break;
+
+    case 'r':
+        ret = sscanf(arg, "%lf", &arguments->sample_rate);
+        if ((ret != 1) || (arguments->sample_rate <= 0.0))
+        {
+            LOG(ERROR, "Failed to parse sample rate");
+            argp_usage(state);
+        }
+        break;
+
+    case 'p':
+        if (strncmp(arg, "block", sizeof("block")) == 0)
+        {
+            arguments->output_policy = output_policy_block;
+        }
+        else if (strncmp(arg, "drop-oldest", sizeof("drop-oldest")) == 0)
+        {
+            arguments->output_policy = output_policy_drop_oldest;
+        }
+        else if (strncmp(arg, "report", sizeof("report")) == 0)
+        {
+            arguments->output_policy = output_policy_report;
+        }
+        else
+        {
+            LOG(ERROR, "Failed to parse output policy (should be 'block', 'drop-oldest', or 'report')");
+            argp_usage(state);
+        }
+        break;
+
+    case 'q':
+        ret = sscanf(arg, "%lu", &arguments->queue_depth);
+        if ((ret != 1) || (arguments->queue_depth < 2))
+        {
+            LOG(ERROR, "Failed to parse queue depth (should be at least 2)");
+            argp_usage(state);
+        }
+        break;
+
     case ARGP_KEY_ARG:
         if (state->arg_num >= 0)
             argp_usage(state);
@@ -92,20 +190,72 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
     return 0;
 }
 
-static bool init_liquid(proc_chain_t *chain)
+// The largest integer factor bringing the capture rate down to
+// between SIG_SAMPLERATE and SIG_MAX_SAMPLERATE, 0 if there is none
+static unsigned int find_decimation(double sample_rate)
+{
+    const unsigned long rate = (unsigned long)sample_rate;
+    if ((double)rate != sample_rate)
+    {
+        return 0;
+    }
+
+    for (unsigned int factor = rate / SIG_SAMPLERATE; factor >= 2; factor--)
+    {
+        unsigned int odd = factor;
+        while ((odd % 2) == 0)
+        {
+            odd /= 2;
+        }
+        if ((rate / factor) > SIG_MAX_SAMPLERATE)
+        {
+            break;
+        }
+        if (((rate % factor) == 0) && (odd <= SIG_MAX_ODD_FACTOR))
+        {
+            return factor;
+        }
+    }
+
+    return 0;
+}
+
+static bool init_liquid(proc_chain_t *chain, size_t res_size, size_t out_size)
 {
     chain->dcblock = iirfilt_crcf_create_dc_blocker(0.0005);
     log_assert(chain->dcblock);
 
-    chain->res_down = msresamp_crcf_create(((float)SIG_SAMPLERATE) / SDR_SAMPLERATE, 60.0f);
-    log_assert(chain->res_down);
-    // msresamp_crcf_print(chain->res_down);
+    const unsigned int factor = find_decimation(chain->args.sample_rate);
+    if (factor > 0)
+    {
+        chain->decimator = decimator_create(factor, 60.0f, SDR_INPUT_CHUNK);
+    }
+    if (chain->decimator)
+    {
+        chain->sig_rate = (unsigned int)chain->args.sample_rate / factor;
+        decimator_print(chain->decimator);
 
-    chain->res_up = msresamp_rrrf_create(((float)AUDIO_SAMPLERATE) / SIG_SAMPLERATE, 60.0f);
-    log_assert(chain->res_up);
-    // msresamp_rrrf_print(chain->res_up);
+        chain->audio_src = rational_resampler_create(chain->sig_rate, AUDIO_SAMPLERATE, 60.0f, res_size);
+        log_assert(chain->audio_src);
+        log_assert(rational_resampler_max_output(chain->audio_src, res_size) <= out_size);
+        rational_resampler_print(chain->audio_src);
+    }
+    else
+    {
+        LOG(WARN, "No suitable integer decimation from %g S/s, using arbitrary rate resampling", chain->args.sample_rate);
+        chain->sig_rate = SIG_SAMPLERATE;
+        chain->res_down = msresamp_crcf_create((float)(SIG_SAMPLERATE / chain->args.sample_rate), 60.0f);
+        log_assert(chain->res_down);
+        // msresamp_crcf_print(chain->res_down);
+
+        chain->res_up = msresamp_rrrf_create(((float)AUDIO_SAMPLERATE) / SIG_SAMPLERATE, 60.0f);
+        log_assert(chain->res_up);
+        // msresamp_rrrf_print(chain->res_up);
+    }
+    LOG(INFO, "Demodulating at %u S/s", chain->sig_rate);
 
-    chain->fm_demod = freqdem_create(0.5f);
+    // The same output level for the same deviation at any rate
+    chain->fm_demod = freqdem_create((0.5f * SIG_SAMPLERATE) / chain->sig_rate);
     log_assert(chain->fm_demod);
 
     return true;
@@ -117,71 +267,355 @@ static void destroy_liquid(proc_chain_t *chain)
 
     err = freqdem_destroy(chain->fm_demod);
     log_assert(err == LIQUID_OK);
-    err = msresamp_crcf_destroy(chain->res_down);
-    log_assert(err == LIQUID_OK);
+    if (chain->decimator)
+    {
+        rational_resampler_destroy(&chain->audio_src);
+        decimator_destroy(&chain->decimator);
+    }
+    else
+    {
+        err = msresamp_rrrf_destroy(chain->res_up);
+        log_assert(err == LIQUID_OK);
+        err = msresamp_crcf_destroy(chain->res_down);
+        log_assert(err == LIQUID_OK);
+    }
     err = iirfilt_crcf_destroy(chain->dcblock);
     log_assert(err == LIQUID_OK);
 }
 
+static void sighandler(int signum)
+{
+    fprintf(stderr, "Signal caught, exiting!\n");
+    exit_via_sig = true;
+}
+
+// The DSP stage needs a free output chunk, what happens
+// when there is none depends on the output policy
+static chunk_t *acquire_output(pipeline_t *pl)
+{
+    chunk_t *out;
+
+    switch (pl->chain->args.output_policy)
+    {
+    case output_policy_drop_oldest:
+        out = chunk_queue_acquire(pl->output_q, false);
+        if (!out)
+        {
+            // Taken back from the output queue, if the
+            // output hasn't picked it up in the meantime
+            out = chunk_queue_try_pop(pl->output_q);
+            if (!out)
+            {
+                out = chunk_queue_acquire(pl->output_q, true);
+            }
+            else
+            {
+                chunk_queue_count_drop(pl->output_q);
+            }
+        }
+        break;
+
+    case output_policy_report:
+        out = chunk_queue_acquire(pl->output_q, false);
+        if (!out && !exit_via_sig)
+        {
+            chunk_queue_count_drop(pl->output_q);
+            LOG(WARN, "The output is too slow, audio dropped");
+        }
+        break;
+
+    default:
+        out = chunk_queue_acquire(pl->output_q, true);
+        break;
+    }
+
+    return out;
+}
+
+static void *dsp_thread(void *arg)
+{
+    pipeline_t *pl = arg;
+    proc_chain_t *chain = pl->chain;
+    chunk_t *in;
+    unsigned int ny;
+    unsigned int nz;
+
+    while ((in = chunk_queue_pop(pl->capture_q)))
+    {
+        iirfilt_crcf_execute_block(chain->dcblock, in->data, in->len, in->data);
+        if (chain->decimator)
+        {
+            ny = decimator_execute(chain->decimator, in->data, in->len, pl->resamp_buf);
+        }
+        else
+        {
+            msresamp_crcf_execute(chain->res_down, in->data, in->len, pl->resamp_buf, &ny);
+        }
+        chunk_queue_release(pl->capture_q, in);
+        freqdem_demodulate_block(chain->fm_demod, pl->resamp_buf, ny, pl->fm_out_buf);
+        if (chain->audio_src)
+        {
+            nz = rational_resampler_execute(chain->audio_src, pl->fm_out_buf, ny, pl->out_buf);
+        }
+        else
+        {
+            msresamp_rrrf_execute(chain->res_up, pl->fm_out_buf, ny, pl->out_buf, &nz);
+        }
+
+        // The filters have run anyway, they stay continuous
+        chunk_t *out = acquire_output(pl);
+        if (!out)
+        {
+            continue;
+        }
+
+        pcm_float_to_s16(pl->out_buf, nz, INT16_MAX, out->data);
+        out->len = nz;
+        chunk_queue_push(pl->output_q, out);
+    }
+
+    chunk_queue_close(pl->output_q);
+    return NULL;
+}
+
+// Writes the whole batch, the pipe can take less at once
+static bool write_batch(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(ERROR, "Failed to write the output: %s", strerror(errno));
+            return false;
+        }
+
+        while ((iovcnt > 0) && ((size_t)n >= iov->iov_len))
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return true;
+}
+
+// Everything queued up while the previous write was
+// blocked goes out in one system call
+static void *output_thread(void *arg)
+{
+    pipeline_t *pl = arg;
+    chunk_t *batch[OUTPUT_MAX_BATCH];
+    struct iovec iov[OUTPUT_MAX_BATCH];
+
+    while ((batch[0] = chunk_queue_pop(pl->output_q)))
+    {
+        size_t n = 1;
+        while ((n < OUTPUT_MAX_BATCH) && (batch[n] = chunk_queue_try_pop(pl->output_q)))
+        {
+            n++;
+        }
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            iov[i].iov_base = batch[i]->data;
+            iov[i].iov_len = batch[i]->len * sizeof(int16_t);
+            bytes += iov[i].iov_len;
+        }
+
+        const bool ok = write_batch(STDOUT_FILENO, iov, n);
+        for (size_t i = 0; i < n; i++)
+        {
+            chunk_queue_release(pl->output_q, batch[i]);
+        }
+
+        if (!ok)
+        {
+            // Nobody to write to anymore, stop the whole pipeline
+            exit_via_sig = true;
+            chunk_queue_close(pl->output_q);
+            break;
+        }
+        pl->bytes_written += bytes;
+    }
+
+    return NULL;
+}
+
+static void report_stats(pipeline_t *pl)
+{
+    chunk_queue_t *queues[] = {pl->capture_q, pl->output_q};
+
+    for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++)
+    {
+        chunk_queue_stats_t st;
+        chunk_queue_get_stats(queues[i], &st);
+        LOG(INFO, "Queue '%s': high watermark: %lu/%lu, pushed: %lu, dropped: %lu",
+            st.name, st.high_watermark, st.depth, st.pushed, st.dropped);
+    }
+    LOG(INFO, "Output: %lu bytes written", pl->bytes_written);
+}
+
 int main(int argc, char *argv[])
 {
     bool ret;
     int read, flags;
     long long timeNs;
-    unsigned int ny;
-    unsigned int nz;
+    struct sigaction sigact;
+    pthread_t dsp_th, output_th;
     proc_chain_t *chain = &g_chain;
 
-    complex float buffp[SDR_INPUT_CHUNK];
-    void *buffs[] = {buffp};
-    size_t res_size = (size_t)ceilf(1 + 2 * SDR_INPUT_CHUNK * ((float)SIG_SAMPLERATE / SDR_SAMPLERATE));
-    size_t out_size = (size_t)ceilf(1 + 2 * res_size * ((float)AUDIO_SAMPLERATE / SIG_SAMPLERATE));
-    complex float resamp_buf[res_size];
-    float fm_out_buf[res_size];
-    float out_buf[out_size];
-    int16_t buf_out_s[res_size];
+    size_t res_size;
+    size_t out_size;
 
     logging_init();
 
     argp_parse(&argp, argc, argv, 0, 0, &chain->args);
 
-    ret = init_liquid(chain);
+    const size_t depth = chain->args.queue_depth;
+    res_size = (size_t)ceilf(1 + 2 * SDR_INPUT_CHUNK * ((float)SIG_SAMPLERATE / chain->args.sample_rate));
+    out_size = (size_t)ceilf(1 + 2 * res_size * ((float)AUDIO_SAMPLERATE / SIG_SAMPLERATE));
+
+    // The chunk queues, the capture drop buffer, and the DSP buffers
+    arena_t *arena = arena_create(depth * arena_block_size(SDR_INPUT_CHUNK * sizeof(complex float)) +
+                                      depth * arena_block_size(out_size * sizeof(int16_t)) +
+                                      arena_block_size(SDR_INPUT_CHUNK * sizeof(complex float)) +
+                                      arena_block_size(res_size * sizeof(complex float)) +
+                                      arena_block_size(res_size * sizeof(float)) +
+                                      arena_block_size(out_size * sizeof(float)),
+                                  0);
+    log_assert(arena);
+
+    pipeline_t pl = {
+        .chain = chain,
+        .capture_q = chunk_queue_create("capture", depth, SDR_INPUT_CHUNK * sizeof(complex float), arena),
+        .output_q = chunk_queue_create("output", depth, out_size * sizeof(int16_t), arena),
+        .drop_buf = arena_alloc(arena, SDR_INPUT_CHUNK * sizeof(complex float)),
+        .resamp_buf = arena_alloc(arena, res_size * sizeof(complex float)),
+        .fm_out_buf = arena_alloc(arena, res_size * sizeof(float)),
+        .out_buf = arena_alloc(arena, out_size * sizeof(float)),
+    };
+    log_assert(pl.capture_q && pl.output_q && pl.drop_buf && pl.resamp_buf && pl.fm_out_buf && pl.out_buf);
+
+    ret = init_liquid(chain, res_size, out_size);
     log_assert(ret);
 
-    ret = init_soapy(chain);
-    if (!ret)
+    if (chain->args.input)
     {
-        exit(EXIT_FAILURE);
+        chain->iq_src = iq_source_create(chain->args.input, chain->args.input_format,
+                                         chain->args.sample_rate, chain->args.realtime);
+        if (!chain->iq_src)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        ret = init_soapy(chain, chain->args.sample_rate);
+        if (!ret)
+        {
+            exit(EXIT_FAILURE);
+        }
     }
 
-    setvbuf(stdout, NULL, _IONBF, 0);
-
-    while (true)
+    sigact.sa_handler = sighandler;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigaction(SIGINT, &sigact, NULL);
+    sigaction(SIGTERM, &sigact, NULL);
+    sigaction(SIGQUIT, &sigact, NULL);
+    // A closed pipe shows up as a write error instead
+    signal(SIGPIPE, SIG_IGN);
+
+    int err = pthread_create(&dsp_th, NULL, dsp_thread, &pl);
+    log_assert(err == 0);
+    pthread_setname_np(dsp_th, "dsp");
+    err = pthread_create(&output_th, NULL, output_thread, &pl);
+    log_assert(err == 0);
+    pthread_setname_np(output_th, "output");
+
+    // The capture runs here and never waits for the DSP, so a slow
+    // consumer can't stall the SDR. A recording can wait, nothing
+    // gets lost then.
+    while (!exit_via_sig)
     {
-        read = SoapySDRDevice_readStream(chain->sdr, chain->rxStream, buffs, SDR_INPUT_CHUNK, &flags, &timeNs, 200000);
+        chunk_t *c = chunk_queue_acquire(pl.capture_q, chain->iq_src != NULL);
+        complex float *buffp = c ? c->data : pl.drop_buf;
+
+        if (chain->iq_src)
+        {
+            read = iq_source_read(chain->iq_src, buffp, SDR_INPUT_CHUNK, &timeNs);
+            if (read == 0)
+            {
+                if (c)
+                {
+                    chunk_queue_release(pl.capture_q, c);
+                }
+                break;
+            }
+        }
+        else
+        {
+            void *buffs[] = {buffp};
+            read = SoapySDRDevice_readStream(chain->sdr, chain->rxStream, buffs, SDR_INPUT_CHUNK, &flags, &timeNs, 200000);
+        }
         if (read < 0)
         {
             LOG(ERROR, "Reading stream failed with error code: %d", read);
+            if (c)
+            {
+                chunk_queue_release(pl.capture_q, c);
+            }
             continue;
         }
-        iirfilt_crcf_execute_block(chain->dcblock, buffp, read, buffp);
-        msresamp_crcf_execute(chain->res_down, buffp, read, resamp_buf, &ny);
-        freqdem_demodulate_block(chain->fm_demod, resamp_buf, ny, fm_out_buf);
-        msresamp_rrrf_execute(chain->res_up, fm_out_buf, ny, out_buf, &nz);
 
-        for (size_t i = 0; i < nz; i++)
+        if (c)
         {
-            buf_out_s[i] = out_buf[i] * INT16_MAX;
+            c->len = read;
+            c->time_ns = timeNs;
+            chunk_queue_push(pl.capture_q, c);
         }
+        else
+        {
+            chunk_queue_count_drop(pl.capture_q);
+            pl.capture_drops += read;
+        }
+    }
 
-        size_t written = fwrite(buf_out_s, 2, nz, stdout);
-        log_assert(written == nz);
-        fflush(stdout);
+    chunk_queue_close(pl.capture_q);
+    pthread_join(dsp_th, NULL);
+    pthread_join(output_th, NULL);
+
+    report_stats(&pl);
+    if (pl.capture_drops > 0)
+    {
+        LOG(WARN, "%lu samples dropped at the capture", pl.capture_drops);
     }
 
-    destroy_soapy(chain);
+    if (chain->iq_src)
+    {
+        iq_source_destroy(&chain->iq_src);
+    }
+    else
+    {
+        destroy_soapy(chain);
+    }
     destroy_liquid(chain);
+    chunk_queue_destroy(&pl.output_q);
+    chunk_queue_destroy(&pl.capture_q);
+    arena_destroy(&arena);
 
     LOG(INFO, "Exiting");
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
@@ -0,0 +1,198 @@
+#include "iq_source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+struct _iq_source_t
+{
+    iq_format_e format;
+    double sample_rate;
+    bool paced;
+    uint8_t const *data;
+    size_t size;
+    size_t sample_size;
+    size_t num_samples;
+    size_t pos;
+    struct timespec start;
+};
+
+static const struct
+{
+    const char *name;
+    iq_format_e format;
+    size_t sample_size;
+} formats[] = {
+    {"cf32", IQ_FORMAT_CF32, 2 * sizeof(float)},
+    {"cs16", IQ_FORMAT_CS16, 2 * sizeof(int16_t)},
+    {"cu8", IQ_FORMAT_CU8, 2 * sizeof(uint8_t)},
+};
+
+bool iq_format_parse(const char *name, iq_format_e *format)
+{
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        if (strcmp(name, formats[i].name) == 0)
+        {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+    return false;
+}
+
+iq_source_t *iq_source_create(const char *path, iq_format_e format,
+                              double sample_rate, bool paced)
+{
+    log_assert(sample_rate > 0.0);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        LOG(ERROR, "Failed to open '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        LOG(ERROR, "'%s' is empty or not a regular file", path);
+        close(fd);
+        return NULL;
+    }
+
+    iq_source_t *self = calloc(1, sizeof(iq_source_t));
+    if (!self)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    self->format = format;
+    self->sample_rate = sample_rate;
+    self->paced = paced;
+    self->size = st.st_size;
+    self->sample_size = formats[format].sample_size;
+    self->num_samples = self->size / self->sample_size;
+
+    self->data = mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (self->data == MAP_FAILED)
+    {
+        LOG(ERROR, "Failed to map '%s': %s", path, strerror(errno));
+        free(self);
+        return NULL;
+    }
+    madvise((void *)self->data, self->size, MADV_SEQUENTIAL);
+
+    LOG(INFO, "Reading %lu %s samples (%.1fs) from '%s'%s", self->num_samples,
+        formats[format].name, self->num_samples / sample_rate, path,
+        paced ? ", paced to the sample rate" : "");
+
+    return self;
+}
+
+void iq_source_destroy(iq_source_t **src_p)
+{
+    log_assert(src_p);
+    if (*src_p)
+    {
+        iq_source_t *src = *src_p;
+        munmap((void *)src->data, src->size);
+        free(src);
+        *src_p = NULL;
+    }
+}
+
+// Sleeps until the sample at `pos` would have been received live
+static void wait_for(iq_source_t *src, size_t pos)
+{
+    const double t = pos / src->sample_rate;
+    struct timespec deadline = src->start;
+
+    deadline.tv_sec += (time_t)t;
+    deadline.tv_nsec += (long)((t - (time_t)t) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR)
+    {
+    }
+}
+
+size_t iq_source_read(iq_source_t *src, complex float *y, size_t n,
+                      long long *time_ns)
+{
+    if (n > src->num_samples - src->pos)
+    {
+        n = src->num_samples - src->pos;
+    }
+
+    if (src->pos == 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &src->start);
+    }
+
+    uint8_t const *p = &src->data[src->pos * src->sample_size];
+    float *y_f = (float *)y;
+
+    switch (src->format)
+    {
+    case IQ_FORMAT_CF32:
+        memcpy(y, p, n * src->sample_size);
+        break;
+
+    case IQ_FORMAT_CS16:
+    {
+        int16_t x[2];
+        for (size_t i = 0; i < 2 * n; i += 2)
+        {
+            memcpy(x, &p[i * sizeof(int16_t)], sizeof(x));
+            y_f[i] = x[0] * (1.0f / 32768.0f);
+            y_f[i + 1] = x[1] * (1.0f / 32768.0f);
+        }
+    }
+    break;
+
+    case IQ_FORMAT_CU8:
+        for (size_t i = 0; i < 2 * n; i++)
+        {
+            y_f[i] = (p[i] - 127.5f) * (1.0f / 127.5f);
+        }
+        break;
+
+    default:
+        log_assert(0);
+        break;
+    }
+
+    if (time_ns)
+    {
+        *time_ns = (long long)((src->pos * 1e9) / src->sample_rate);
+    }
+    src->pos += n;
+
+    if (src->paced && (n > 0))
+    {
+        wait_for(src, src->pos);
+    }
+
+    return n;
+}
+
+size_t iq_source_num_samples(iq_source_t *src)
+{
+    return src->num_samples;
+}
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+
+#include "iq_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "chunk_queue.h"
+#include "logging.h"
+#include "pcm.h"
+
+// O_DIRECT wants the buffers, the lengths and the file offsets aligned
+#define IQ_WRITER_ALIGNMENT (4096)
+// ~0.3s of cf32 at 1.6MS/s per write, and ~5s of buffering in total
+#define IQ_WRITER_BLOCK (4UL << 20)
+#define IQ_WRITER_NUM_BLOCKS (16)
+
+// Samples were lost before the block
+#define IQ_BLOCK_DISCONTINUITY (1 << 0)
+
+_Static_assert(IQ_WRITER_BLOCK % IQ_WRITER_ALIGNMENT == 0,
+               "Whole aligned blocks");
+
+struct _iq_writer_t
+{
+    iq_writer_config_t config;
+    char *prefix;
+    size_t sample_size;
+    const char *datatype;
+    // Rotation, by whichever limit comes first, 0 = never
+    uint64_t max_bytes;
+    arena_t *arena;
+    chunk_queue_t *queue;
+    pthread_t thread;
+    bool started;
+    // Producer only, the block being filled
+    chunk_t *block;
+    bool discontinuity;
+    // Writer thread only
+    int fd;
+    bool direct;
+    unsigned int file_index;
+    uint64_t file_bytes;
+    atomic_uint_fast64_t files;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t dropped_samples;
+    atomic_uint_fast64_t write_ns;
+    atomic_uint_fast64_t max_write_ns;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// The inverse of the iq_source conversions
+static void convert(iq_writer_t *q, complex float const *x, size_t n,
+                    uint8_t *y)
+{
+    float const *x_f = (float const *)x;
+
+    switch (q->config.format)
+    {
+    case IQ_FORMAT_CF32:
+        memcpy(y, x, n * sizeof(complex float));
+        break;
+
+    case IQ_FORMAT_CS16:
+        pcm_float_to_s16(x_f, 2 * n, 32768.0f, (int16_t *)y);
+        break;
+
+    case IQ_FORMAT_CU8:
+        for (size_t i = 0; i < 2 * n; i++)
+        {
+            const float v = (x_f[i] * 127.5f) + 127.5f;
+            y[i] = v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t)lrintf(v);
+        }
+        break;
+    }
+}
+
+static void write_meta(iq_writer_t *q, const char *path, uint64_t time_ns)
+{
+    const time_t sec = time_ns / 1000000000ULL;
+    struct tm tm;
+    char stamp[32];
+
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        LOG(ERROR, "Failed to create '%s': %s", path, strerror(errno));
+        return;
+    }
+
+    gmtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(f,
+            "{\n"
+            "  \"global\": {\n"
+            "    \"core:datatype\": \"%s\",\n"
+            "    \"core:sample_rate\": %.12g,\n"
+            "    \"core:version\": \"1.0.0\",\n"
+            "    \"core:recorder\": \"sdr_pmr446\",\n"
+            "    \"core:description\": \"SDR gain: %.1f dB\"\n"
+            "  },\n"
+            "  \"captures\": [\n"
+            "    {\n"
+            "      \"core:sample_start\": 0,\n"
+            "      \"core:frequency\": %.12g,\n"
+            "      \"core:datetime\": \"%s.%06luZ\"\n"
+            "    }\n"
+            "  ],\n"
+            "  \"annotations\": []\n"
+            "}\n",
+            q->datatype, q->config.sample_rate, q->config.gain,
+            q->config.frequency, stamp,
+            (unsigned long)((time_ns % 1000000000ULL) / 1000));
+    if (fclose(f) != 0)
+    {
+        LOG(ERROR, "Failed to write '%s': %s", path, strerror(errno));
+    }
+}
+
+static bool file_open(iq_writer_t *q, uint64_t time_ns)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s-%04u.sigmf-data", q->prefix,
+             q->file_index);
+    q->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    q->direct = q->fd >= 0;
+    // Not supported by every file system, e.g. tmpfs
+    if ((q->fd < 0) && (errno == EINVAL))
+    {
+        q->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (q->file_index == 0)
+        {
+            LOG(WARN, "No O_DIRECT for '%s', writing through the page cache",
+                path);
+        }
+    }
+    if (q->fd < 0)
+    {
+        LOG(ERROR, "Failed to create '%s': %s", path, strerror(errno));
+        return false;
+    }
+    LOG(DEBUG, "Capturing IQ samples to '%s'", path);
+
+    snprintf(path, sizeof(path), "%s-%04u.sigmf-meta", q->prefix,
+             q->file_index);
+    write_meta(q, path, time_ns);
+
+    q->file_index++;
+    q->file_bytes = 0;
+    atomic_fetch_add_explicit(&q->files, 1, memory_order_relaxed);
+    return true;
+}
+
+static void file_close(iq_writer_t *q)
+{
+    if (q->fd >= 0)
+    {
+        if (close(q->fd) != 0)
+        {
+            LOG(ERROR, "Failed to close the IQ capture: %s", strerror(errno));
+        }
+        q->fd = -1;
+    }
+}
+
+static bool write_block(iq_writer_t *q, const uint8_t *buf, size_t len)
+{
+    // The last block is shorter, and O_DIRECT can't write it as it is
+    if (q->direct && ((len % IQ_WRITER_ALIGNMENT) != 0))
+    {
+        fcntl(q->fd, F_SETFL, fcntl(q->fd, F_GETFL) & ~O_DIRECT);
+        q->direct = false;
+    }
+
+    const uint64_t t = clock_ns(CLOCK_MONOTONIC);
+    while (len > 0)
+    {
+        const ssize_t n = write(q->fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(ERROR, "Failed to write the IQ capture: %s", strerror(errno));
+            return false;
+        }
+        buf += n;
+        len -= n;
+        q->file_bytes += n;
+        atomic_fetch_add_explicit(&q->bytes, n, memory_order_relaxed);
+    }
+    const uint64_t ns = clock_ns(CLOCK_MONOTONIC) - t;
+
+    atomic_fetch_add_explicit(&q->write_ns, ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&q->max_write_ns, memory_order_relaxed))
+    {
+        atomic_store_explicit(&q->max_write_ns, ns, memory_order_relaxed);
+    }
+    return true;
+}
+
+static void *writer_thread(void *arg)
+{
+    iq_writer_t *q = arg;
+    chunk_t *c;
+
+    while ((c = chunk_queue_pop(q->queue)))
+    {
+        // Every file holds a continuous stretch of samples
+        if ((q->fd >= 0) && (q->file_bytes > 0) &&
+            ((c->flags & IQ_BLOCK_DISCONTINUITY) ||
+             ((q->max_bytes > 0) && (q->file_bytes + c->len > q->max_bytes))))
+        {
+            file_close(q);
+        }
+
+        bool ok = (q->fd >= 0) || file_open(q, c->time_ns);
+        if (ok)
+        {
+            ok = write_block(q, c->data, c->len);
+            if (!ok)
+            {
+                file_close(q);
+            }
+        }
+        if (!ok)
+        {
+            atomic_fetch_add_explicit(&q->dropped_samples, c->len / q->sample_size,
+                                      memory_order_relaxed);
+        }
+        chunk_queue_release(q->queue, c);
+    }
+
+    file_close(q);
+    return NULL;
+}
+
+iq_writer_t *iq_writer_create(const iq_writer_config_t *config)
+{
+    log_assert(config && config->prefix && (config->sample_rate > 0));
+
+    iq_writer_t *self = calloc(1, sizeof(iq_writer_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->config = *config;
+    self->fd = -1;
+    atomic_init(&self->files, 0);
+    atomic_init(&self->bytes, 0);
+    atomic_init(&self->dropped_samples, 0);
+    atomic_init(&self->write_ns, 0);
+    atomic_init(&self->max_write_ns, 0);
+
+    switch (config->format)
+    {
+    case IQ_FORMAT_CF32:
+        self->sample_size = 2 * sizeof(float);
+        self->datatype = "cf32_le";
+        break;
+
+    case IQ_FORMAT_CS16:
+        self->sample_size = 2 * sizeof(int16_t);
+        self->datatype = "ci16_le";
+        break;
+
+    case IQ_FORMAT_CU8:
+        self->sample_size = 2 * sizeof(uint8_t);
+        self->datatype = "cu8";
+        break;
+    }
+
+    self->max_bytes = config->max_file_bytes;
+    if (config->max_file_s > 0)
+    {
+        const uint64_t bytes = (uint64_t)llround(
+            config->max_file_s * config->sample_rate * self->sample_size);
+        if ((self->max_bytes == 0) || (bytes < self->max_bytes))
+        {
+            self->max_bytes = bytes;
+        }
+    }
+
+    // A fresh mapping, so the blocks are page-aligned
+    self->prefix = strdup(config->prefix);
+    self->arena = arena_create(IQ_WRITER_NUM_BLOCKS * IQ_WRITER_BLOCK,
+                               config->arena_flags);
+    if (!self->prefix || !self->arena)
+    {
+        iq_writer_destroy(&self);
+        return NULL;
+    }
+    self->queue = chunk_queue_create("iq_writer", IQ_WRITER_NUM_BLOCKS,
+                                     IQ_WRITER_BLOCK, self->arena);
+    if (!self->queue)
+    {
+        iq_writer_destroy(&self);
+        return NULL;
+    }
+
+    int ret = pthread_create(&self->thread, NULL, writer_thread, self);
+    if (ret != 0)
+    {
+        LOG(ERROR, "Failed to start the IQ writer thread: %s", strerror(ret));
+        iq_writer_destroy(&self);
+        return NULL;
+    }
+    pthread_setname_np(self->thread, "iq_writer");
+    self->started = true;
+
+    return self;
+}
+
+void iq_writer_destroy(iq_writer_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        iq_writer_t *q = *q_p;
+        iq_writer_finish(q);
+        chunk_queue_destroy(&q->queue);
+        arena_destroy(&q->arena);
+        free(q->prefix);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+void iq_writer_finish(iq_writer_t *q)
+{
+    if (q->started)
+    {
+        if (q->block)
+        {
+            chunk_queue_push(q->queue, q->block);
+            q->block = NULL;
+        }
+        chunk_queue_close(q->queue);
+        pthread_join(q->thread, NULL);
+        q->started = false;
+    }
+}
+
+void iq_writer_write(iq_writer_t *q, complex float const *x, size_t n)
+{
+    while (n > 0)
+    {
+        if (!q->block)
+        {
+            q->block = chunk_queue_acquire(q->queue, false);
+            if (!q->block)
+            {
+                chunk_queue_count_drop(q->queue);
+                atomic_fetch_add_explicit(&q->dropped_samples, n,
+                                          memory_order_relaxed);
+                q->discontinuity = true;
+                return;
+            }
+            q->block->flags = q->discontinuity ? IQ_BLOCK_DISCONTINUITY : 0;
+            q->block->time_ns = clock_ns(CLOCK_REALTIME);
+            q->discontinuity = false;
+        }
+
+        chunk_t *c = q->block;
+        const size_t room = (IQ_WRITER_BLOCK - c->len) / q->sample_size;
+        const size_t m = n < room ? n : room;
+        convert(q, x, m, (uint8_t *)c->data + c->len);
+        c->len += m * q->sample_size;
+        if (c->len + q->sample_size > IQ_WRITER_BLOCK)
+        {
+            chunk_queue_push(q->queue, c);
+            q->block = NULL;
+        }
+
+        x += m;
+        n -= m;
+    }
+}
+
+void iq_writer_discontinuity(iq_writer_t *q)
+{
+    // The samples so far go out in a (short) block of their own
+    if (q->block && (q->block->len > 0))
+    {
+        chunk_queue_push(q->queue, q->block);
+        q->block = NULL;
+    }
+    q->discontinuity = true;
+}
+
+void iq_writer_get_stats(iq_writer_t *q, iq_writer_stats_t *stats)
+{
+    stats->files = atomic_load_explicit(&q->files, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&q->bytes, memory_order_relaxed);
+    stats->dropped_samples =
+        atomic_load_explicit(&q->dropped_samples, memory_order_relaxed);
+    stats->write_ns = atomic_load_explicit(&q->write_ns, memory_order_relaxed);
+    stats->max_write_ns =
+        atomic_load_explicit(&q->max_write_ns, memory_order_relaxed);
+}
+
+void iq_writer_print_stats(iq_writer_t *q)
+{
+    iq_writer_stats_t st;
+    iq_writer_get_stats(q, &st);
+
+    LOG(INFO,
+        "IQ capture: %lu file(s), %.1f MB written (%.1f MB/s while writing, "
+        "longest write: %.1fms), %lu samples dropped",
+        st.files, st.bytes * 1e-6,
+        st.write_ns > 0 ? (st.bytes * 1e3) / st.write_ns : 0.0,
+        st.max_write_ns * 1e-6, st.dropped_samples);
+}
@@ -0,0 +1,868 @@
+#define _GNU_SOURCE
+
+#include "net_sink.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunk_queue.h"
+#include "logging.h"
+#include "pcm.h"
+
+#define NET_SINK_MAX_CHANNELS (64)
+// With 64ms blocks, ~16s of audio of a single channel, or a second
+// of all the 16 PMR446 channels at once
+#define NET_SINK_QUEUE_DEPTH (256)
+// On top of that, kept for the opens and closes, which the audio
+// can't crowd out of the queue: a lost close would never get the
+// receivers the end of the transmission
+#define NET_SINK_CONTROL_ROOM (NET_SINK_MAX_CHANNELS)
+// ~41ms at 12.5kHz, 1052 byte packets, well within the Ethernet MTU
+#define NET_SINK_MAX_SAMPLES (512)
+#define NET_SINK_MAX_PACKET \
+  (NET_SINK_HEADER_LEN + (NET_SINK_MAX_SAMPLES * sizeof(int16_t)))
+// Packets per sendmmsg()
+#define NET_SINK_BATCH (64)
+#define NET_SINK_MAX_CLIENTS (8)
+// Per TCP client, ~10s of a single channel
+#define NET_SINK_CLIENT_BUF (256 * 1024)
+
+typedef enum
+{
+    net_open = 0,
+    net_write,
+    net_close,
+} net_event_e;
+
+// The payload of the queued chunks, `len` samples
+typedef struct
+{
+    net_event_e event;
+    unsigned int channel;
+    int ctcss_code;
+    // Of the first sample
+    uint64_t time_ns;
+    // Dropped since the previous block of the channel
+    uint64_t skipped;
+    float samples[];
+} net_block_t;
+
+// Sending thread only
+typedef struct
+{
+    bool start;
+    uint32_t seq;
+    // The last one detected, for the end of the transmission
+    int ctcss_code;
+    // The timestamps count the samples from the start of the transmission
+    bool has_time;
+    uint64_t start_ns;
+    uint64_t samples;
+} net_channel_t;
+
+typedef struct
+{
+    int fd;
+    // Frames not sent yet, from `head` to `tail`
+    uint8_t *buf;
+    size_t head;
+    size_t tail;
+    char name[NI_MAXHOST + NI_MAXSERV + 1];
+} net_client_t;
+
+struct _net_sink_t
+{
+    char *url;
+    bool tcp;
+    unsigned int rate;
+    size_t max_block;
+    // The UDP socket, or the TCP listening one
+    int fd;
+    // Wakes the sending thread up on new blocks
+    int wake_fd;
+    chunk_queue_t *queue;
+    pthread_t thread;
+    bool started;
+    atomic_bool stop;
+    // Blocks of samples in the queue, up to NET_SINK_QUEUE_DEPTH
+    atomic_size_t queued_writes;
+    // Producer only
+    uint64_t skipped[NET_SINK_MAX_CHANNELS];
+    // Sending thread only
+    net_channel_t channels[NET_SINK_MAX_CHANNELS];
+    net_client_t clients[NET_SINK_MAX_CLIENTS];
+    uint8_t (*packets)[NET_SINK_MAX_PACKET];
+    struct iovec iov[NET_SINK_BATCH];
+    struct mmsghdr msgs[NET_SINK_BATCH];
+    size_t num_packets;
+    int last_errno;
+    atomic_uint_fast64_t num_packets_sent;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t num_clients;
+    atomic_uint_fast64_t dropped_samples;
+    atomic_uint_fast64_t dropped_packets;
+    atomic_uint_fast64_t errors;
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(&p[2], v >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, v & 0xffffffff);
+    put_le32(&p[4], v >> 32);
+}
+
+// Logged once per cause, so an absent receiver doesn't flood the log
+static void net_error(net_sink_t *q, const char *what)
+{
+    if (errno != q->last_errno)
+    {
+        LOG(WARN, "Failed to %s ('%s'): %s", what, q->url, strerror(errno));
+        q->last_errno = errno;
+    }
+    atomic_fetch_add_explicit(&q->errors, 1, memory_order_relaxed);
+}
+
+static void drop_packets(net_sink_t *q, size_t n)
+{
+    atomic_fetch_add_explicit(&q->dropped_packets, n, memory_order_relaxed);
+}
+
+static void client_close(net_sink_t *q, net_client_t *c)
+{
+    LOG(INFO, "Audio stream client %s disconnected", c->name);
+    close(c->fd);
+    free(c->buf);
+    c->fd = -1;
+    c->buf = NULL;
+    atomic_fetch_sub_explicit(&q->num_clients, 1, memory_order_relaxed);
+}
+
+static void client_accept(net_sink_t *q)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    net_client_t *c = NULL;
+
+    const int fd = accept4(q->fd, (struct sockaddr *)&addr, &addr_len,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        if ((errno != EAGAIN) && (errno != EINTR))
+        {
+            net_error(q, "accept");
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+    {
+        if (q->clients[i].fd < 0)
+        {
+            c = &q->clients[i];
+            break;
+        }
+    }
+    if (!c || !(c->buf = malloc(NET_SINK_CLIENT_BUF)))
+    {
+        LOG(WARN, "Too many audio stream clients, rejecting one");
+        close(fd);
+        return;
+    }
+
+    if (getnameinfo((struct sockaddr *)&addr, addr_len, host, sizeof(host),
+                    port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) !=
+        0)
+    {
+        snprintf(host, sizeof(host), "?");
+        snprintf(port, sizeof(port), "?");
+    }
+    snprintf(c->name, sizeof(c->name), "%s:%s", host, port);
+    c->fd = fd;
+    c->head = 0;
+    c->tail = 0;
+    atomic_fetch_add_explicit(&q->num_clients, 1, memory_order_relaxed);
+    LOG(INFO, "Audio stream client %s connected", c->name);
+}
+
+// As much of the backlog as the socket takes right now
+static void client_flush(net_sink_t *q, net_client_t *c)
+{
+    while (c->head < c->tail)
+    {
+        const ssize_t n = send(c->fd, &c->buf[c->head], c->tail - c->head,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                client_close(q, c);
+            }
+            return;
+        }
+        c->head += n;
+        atomic_fetch_add_explicit(&q->bytes, n, memory_order_relaxed);
+    }
+    c->head = 0;
+    c->tail = 0;
+}
+
+// Whole packets only, so the stream stays in sync when some are dropped
+static void client_queue(net_sink_t *q, net_client_t *c)
+{
+    for (size_t i = 0; i < q->num_packets; i++)
+    {
+        const size_t len = q->iov[i].iov_len;
+
+        if (c->tail + len > NET_SINK_CLIENT_BUF)
+        {
+            memmove(c->buf, &c->buf[c->head], c->tail - c->head);
+            c->tail -= c->head;
+            c->head = 0;
+        }
+        if (c->tail + len > NET_SINK_CLIENT_BUF)
+        {
+            drop_packets(q, 1);
+            continue;
+        }
+        memcpy(&c->buf[c->tail], q->packets[i], len);
+        c->tail += len;
+    }
+}
+
+static void send_packets(net_sink_t *q)
+{
+    size_t sent = 0;
+
+    if (q->num_packets == 0)
+    {
+        return;
+    }
+
+    if (q->tcp)
+    {
+        for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+        {
+            net_client_t *c = &q->clients[i];
+            if (c->fd >= 0)
+            {
+                client_queue(q, c);
+                client_flush(q, c);
+            }
+        }
+        sent = q->num_packets;
+    }
+    else
+    {
+        while (sent < q->num_packets)
+        {
+            const int n = sendmmsg(q->fd, &q->msgs[sent], q->num_packets - sent,
+                                   MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // The socket buffer is full, or an ICMP error came back
+                // from an earlier packet (e.g. no receiver listening)
+                if (errno != EAGAIN)
+                {
+                    net_error(q, "send");
+                }
+                drop_packets(q, q->num_packets - sent);
+                break;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                atomic_fetch_add_explicit(&q->bytes, q->msgs[sent + i].msg_len,
+                                          memory_order_relaxed);
+            }
+            sent += n;
+        }
+    }
+
+    atomic_fetch_add_explicit(&q->num_packets_sent, sent, memory_order_relaxed);
+    q->num_packets = 0;
+}
+
+static void add_packet(net_sink_t *q, unsigned int channel, int flags,
+                       int ctcss_code, float const *x, size_t n)
+{
+    net_channel_t *ch = &q->channels[channel];
+    uint8_t *p = q->packets[q->num_packets];
+    const uint64_t time_ns =
+        ch->has_time ? ch->start_ns + ((ch->samples * 1000000000ULL) / q->rate)
+                     : clock_ns(CLOCK_REALTIME);
+
+    if (ch->start)
+    {
+        flags |= NET_SINK_FLAG_START;
+        ch->start = false;
+    }
+
+    memcpy(&p[0], "PMRA", 4);
+    p[4] = NET_SINK_VERSION;
+    p[5] = channel + 1;
+    p[6] = flags;
+    p[7] = ctcss_code > 0 ? ctcss_code : 0;
+    put_le32(&p[8], ch->seq++);
+    put_le32(&p[12], q->rate);
+    put_le64(&p[16], time_ns);
+    put_le32(&p[24], n);
+    pcm_float_to_s16(x, n, 32767.0f, (int16_t *)&p[NET_SINK_HEADER_LEN]);
+
+    q->iov[q->num_packets].iov_len = NET_SINK_HEADER_LEN + (n * sizeof(int16_t));
+    ch->samples += n;
+    if (++q->num_packets == NET_SINK_BATCH)
+    {
+        send_packets(q);
+    }
+}
+
+static void handle_block(net_sink_t *q, const net_block_t *b, size_t len)
+{
+    net_channel_t *ch = &q->channels[b->channel];
+
+    switch (b->event)
+    {
+    case net_open:
+        ch->start = true;
+        ch->has_time = false;
+        ch->ctcss_code = 0;
+        break;
+
+    case net_write:
+        if (!ch->has_time)
+        {
+            ch->has_time = true;
+            ch->start_ns = b->time_ns;
+            ch->samples = 0;
+        }
+        ch->samples += b->skipped;
+        if (b->ctcss_code > 0)
+        {
+            ch->ctcss_code = b->ctcss_code;
+        }
+        for (size_t i = 0; i < len; i += NET_SINK_MAX_SAMPLES)
+        {
+            const size_t n =
+                len - i < NET_SINK_MAX_SAMPLES ? len - i : NET_SINK_MAX_SAMPLES;
+            add_packet(q, b->channel, 0, b->ctcss_code, &b->samples[i], n);
+        }
+        break;
+
+    case net_close:
+        add_packet(q, b->channel, NET_SINK_FLAG_END, ch->ctcss_code, NULL, 0);
+        ch->has_time = false;
+        break;
+    }
+}
+
+// Everything queued up, in as few batches as possible
+static void drain(net_sink_t *q)
+{
+    chunk_t *c;
+
+    while ((c = chunk_queue_try_pop(q->queue)))
+    {
+        const net_block_t *b = c->data;
+        const bool write = b->event == net_write;
+
+        handle_block(q, b, c->len);
+        chunk_queue_release(q->queue, c);
+        if (write)
+        {
+            atomic_fetch_sub(&q->queued_writes, 1);
+        }
+    }
+    send_packets(q);
+}
+
+static void *sender_thread(void *arg)
+{
+    net_sink_t *q = arg;
+    struct pollfd fds[2 + NET_SINK_MAX_CLIENTS];
+    net_client_t *polled[NET_SINK_MAX_CLIENTS];
+
+    while (true)
+    {
+        const bool stop = atomic_load(&q->stop);
+        size_t nfds = 0, nclients = 0;
+
+        drain(q);
+        if (stop)
+        {
+            break;
+        }
+
+        fds[nfds++] = (struct pollfd){.fd = q->wake_fd, .events = POLLIN};
+        if (q->tcp)
+        {
+            fds[nfds++] = (struct pollfd){.fd = q->fd, .events = POLLIN};
+            for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+            {
+                net_client_t *c = &q->clients[i];
+                if (c->fd >= 0)
+                {
+                    // Readable only when closed, the clients don't send anything
+                    fds[nfds++] = (struct pollfd){
+                        .fd = c->fd,
+                        .events = POLLIN | (c->head < c->tail ? POLLOUT : 0)};
+                    polled[nclients++] = c;
+                }
+            }
+        }
+
+        if (poll(fds, nfds, -1) < 0)
+        {
+            if (errno != EINTR)
+            {
+                net_error(q, "poll");
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t v;
+            if (read(q->wake_fd, &v, sizeof(v)) < 0)
+            {
+                // Nothing to do, the blocks are picked up either way
+            }
+        }
+        if (!q->tcp)
+        {
+            continue;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            client_accept(q);
+        }
+        for (size_t i = 0; i < nclients; i++)
+        {
+            const short revents = fds[2 + i].revents;
+            net_client_t *c = polled[i];
+            uint8_t discard[256];
+
+            if ((revents & POLLIN) &&
+                (recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT) == 0))
+            {
+                client_close(q, c);
+            }
+            else if (revents & (POLLERR | POLLHUP))
+            {
+                client_close(q, c);
+            }
+            else if (revents & POLLOUT)
+            {
+                client_flush(q, c);
+            }
+        }
+    }
+
+    // One last try for the TCP clients, without waiting for them
+    for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+    {
+        if (q->clients[i].fd >= 0)
+        {
+            client_flush(q, &q->clients[i]);
+        }
+    }
+
+    return NULL;
+}
+
+// `udp://HOST:PORT` or `tcp://[HOST]:PORT`, IPv6 addresses in brackets
+static bool parse_url(const char *url, bool *tcp, char *host, size_t host_len,
+                      char *port, size_t port_len)
+{
+    const char *p;
+
+    if (strncmp(url, "udp://", 6) == 0)
+    {
+        *tcp = false;
+    }
+    else if (strncmp(url, "tcp://", 6) == 0)
+    {
+        *tcp = true;
+    }
+    else
+    {
+        return false;
+    }
+    url += 6;
+
+    p = strrchr(url, ':');
+    if (!p || (p[1] == '\0') || ((size_t)(p - url) >= host_len) ||
+        (strlen(&p[1]) >= port_len))
+    {
+        return false;
+    }
+    if ((url[0] == '[') && (p > url) && (p[-1] == ']'))
+    {
+        snprintf(host, host_len, "%.*s", (int)(p - url - 2), &url[1]);
+    }
+    else
+    {
+        snprintf(host, host_len, "%.*s", (int)(p - url), url);
+    }
+    snprintf(port, port_len, "%s", &p[1]);
+
+    // Only a TCP server can do without the host
+    return *tcp || (host[0] != '\0');
+}
+
+static int open_socket(net_sink_t *q, const char *host, const char *port)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = q->tcp ? SOCK_STREAM : SOCK_DGRAM,
+        .ai_flags = q->tcp ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *res, *ai;
+    int fd = -1;
+
+    int ret = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (ret != 0)
+    {
+        LOG(ERROR, "Failed to resolve '%s': %s", q->url, gai_strerror(ret));
+        return -1;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        if (q->tcp)
+        {
+            const int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if ((bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) &&
+                (listen(fd, NET_SINK_MAX_CLIENTS) == 0))
+            {
+                break;
+            }
+        }
+        else
+        {
+            // Lets broadcast addresses through, multicast ones need nothing
+            const int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+            if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            {
+                break;
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        LOG(ERROR, "Failed to set up '%s': %s", q->url, strerror(errno));
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+net_sink_t *net_sink_create(const char *url, unsigned int rate,
+                            size_t max_block)
+{
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    bool tcp;
+
+    log_assert(url && (rate > 0) && (max_block > 0));
+
+    if (!parse_url(url, &tcp, host, sizeof(host), port, sizeof(port)))
+    {
+        LOG(ERROR,
+            "Failed to parse '%s' (should be udp://HOST:PORT or "
+            "tcp://[HOST]:PORT)",
+            url);
+        return NULL;
+    }
+
+    net_sink_t *self = calloc(1, sizeof(net_sink_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->tcp = tcp;
+    self->rate = rate;
+    self->max_block = max_block;
+    self->wake_fd = -1;
+    atomic_init(&self->stop, false);
+    atomic_init(&self->queued_writes, 0);
+    atomic_init(&self->num_packets_sent, 0);
+    atomic_init(&self->bytes, 0);
+    atomic_init(&self->num_clients, 0);
+    atomic_init(&self->dropped_samples, 0);
+    atomic_init(&self->dropped_packets, 0);
+    atomic_init(&self->errors, 0);
+    for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+    {
+        self->clients[i].fd = -1;
+    }
+
+    self->url = strdup(url);
+    self->packets = malloc(NET_SINK_BATCH * NET_SINK_MAX_PACKET);
+    self->queue = chunk_queue_create(
+        "net_sink", NET_SINK_QUEUE_DEPTH + NET_SINK_CONTROL_ROOM,
+        sizeof(net_block_t) + (max_block * sizeof(float)), NULL);
+    if (!self->url || !self->packets || !self->queue)
+    {
+        self->fd = -1;
+        net_sink_destroy(&self);
+        return NULL;
+    }
+    for (size_t i = 0; i < NET_SINK_BATCH; i++)
+    {
+        self->iov[i].iov_base = self->packets[i];
+        self->msgs[i].msg_hdr.msg_iov = &self->iov[i];
+        self->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    self->fd = open_socket(self, host, port);
+    self->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((self->fd < 0) || (self->wake_fd < 0))
+    {
+        net_sink_destroy(&self);
+        return NULL;
+    }
+
+    int ret = pthread_create(&self->thread, NULL, sender_thread, self);
+    if (ret != 0)
+    {
+        LOG(ERROR, "Failed to start the audio streaming thread: %s",
+            strerror(ret));
+        net_sink_destroy(&self);
+        return NULL;
+    }
+    pthread_setname_np(self->thread, "net_sink");
+    self->started = true;
+
+    return self;
+}
+
+void net_sink_destroy(net_sink_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        net_sink_t *q = *q_p;
+        net_sink_finish(q);
+        for (size_t i = 0; i < NET_SINK_MAX_CLIENTS; i++)
+        {
+            if (q->clients[i].fd >= 0)
+            {
+                client_close(q, &q->clients[i]);
+            }
+        }
+        if (q->fd >= 0)
+        {
+            close(q->fd);
+        }
+        if (q->wake_fd >= 0)
+        {
+            close(q->wake_fd);
+        }
+        chunk_queue_destroy(&q->queue);
+        free(q->packets);
+        free(q->url);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+static void wake(net_sink_t *q)
+{
+    const uint64_t v = 1;
+    if (write(q->wake_fd, &v, sizeof(v)) < 0)
+    {
+        // Already signalled that many times, it's awake anyway
+    }
+}
+
+void net_sink_finish(net_sink_t *q)
+{
+    if (q->started)
+    {
+        atomic_store(&q->stop, true);
+        wake(q);
+        pthread_join(q->thread, NULL);
+        q->started = false;
+    }
+}
+
+static net_block_t *acquire(net_sink_t *q, chunk_t **c_p, net_event_e event,
+                            unsigned int channel)
+{
+    log_assert(channel < NET_SINK_MAX_CHANNELS);
+
+    const bool write = event == net_write;
+    chunk_t *c = NULL;
+    if (!write || (atomic_load(&q->queued_writes) < NET_SINK_QUEUE_DEPTH))
+    {
+        c = chunk_queue_acquire(q->queue, false);
+    }
+    if (!c)
+    {
+        chunk_queue_count_drop(q->queue);
+        // Only with the sending thread starved of CPU for a long time, the
+        // start or the end of a transmission is never seen by the receivers
+        if (!write)
+        {
+            drop_packets(q, 1);
+        }
+        return NULL;
+    }
+    if (write)
+    {
+        atomic_fetch_add(&q->queued_writes, 1);
+    }
+
+    net_block_t *b = c->data;
+    b->event = event;
+    b->channel = channel;
+    b->ctcss_code = 0;
+    b->skipped = 0;
+    c->len = 0;
+    *c_p = c;
+    return b;
+}
+
+void net_sink_open(net_sink_t *q, unsigned int channel)
+{
+    chunk_t *c;
+    net_block_t *b = acquire(q, &c, net_open, channel);
+
+    if (b)
+    {
+        q->skipped[channel] = 0;
+        chunk_queue_push(q->queue, c);
+        wake(q);
+    }
+}
+
+void net_sink_write(net_sink_t *q, unsigned int channel, int ctcss_code,
+                    float const *x, size_t n)
+{
+    // The samples end now
+    uint64_t time_ns =
+        clock_ns(CLOCK_REALTIME) - ((n * 1000000000ULL) / q->rate);
+    bool queued = false;
+
+    while (n > 0)
+    {
+        const size_t len = n < q->max_block ? n : q->max_block;
+        chunk_t *c;
+        net_block_t *b = acquire(q, &c, net_write, channel);
+
+        if (!b)
+        {
+            atomic_fetch_add_explicit(&q->dropped_samples, n,
+                                      memory_order_relaxed);
+            q->skipped[channel] += n;
+            break;
+        }
+        b->ctcss_code = ctcss_code;
+        b->time_ns = time_ns;
+        b->skipped = q->skipped[channel];
+        q->skipped[channel] = 0;
+        memcpy(b->samples, x, len * sizeof(float));
+        c->len = len;
+        chunk_queue_push(q->queue, c);
+        queued = true;
+
+        x += len;
+        n -= len;
+        time_ns += (len * 1000000000ULL) / q->rate;
+    }
+
+    if (queued)
+    {
+        wake(q);
+    }
+}
+
+void net_sink_close(net_sink_t *q, unsigned int channel)
+{
+    chunk_t *c;
+    net_block_t *b = acquire(q, &c, net_close, channel);
+
+    if (b)
+    {
+        chunk_queue_push(q->queue, c);
+        wake(q);
+    }
+}
+
+void net_sink_get_stats(net_sink_t *q, net_sink_stats_t *stats)
+{
+    stats->packets =
+        atomic_load_explicit(&q->num_packets_sent, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&q->bytes, memory_order_relaxed);
+    stats->clients = atomic_load_explicit(&q->num_clients, memory_order_relaxed);
+    stats->dropped_samples =
+        atomic_load_explicit(&q->dropped_samples, memory_order_relaxed);
+    stats->dropped_packets =
+        atomic_load_explicit(&q->dropped_packets, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&q->errors, memory_order_relaxed);
+}
+
+void net_sink_print_stats(net_sink_t *q)
+{
+    net_sink_stats_t st;
+    net_sink_get_stats(q, &st);
+
+    LOG(INFO,
+        "Audio stream '%s': %lu packets, %.1f kB sent, %lu samples dropped "
+        "(queue full), %lu packets dropped (socket or clients full), %lu errors",
+        q->url, st.packets, st.bytes * 1e-3, st.dropped_samples,
+        st.dropped_packets, st.errors);
+    if (q->tcp)
+    {
+        LOG(INFO, "Audio stream '%s': %lu client(s) connected", q->url,
+            st.clients);
+    }
+}
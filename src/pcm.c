@@ -0,0 +1,49 @@
+#include "pcm.h"
+
+#include <string.h>
+
+#include "simd.h"
+
+#define PCM_VEC_LEN (8)
+
+typedef int v8si __attribute__((vector_size(32)));
+typedef short v8hi __attribute__((vector_size(16)));
+
+// NaNs fail both comparisons, they end up as INT16_MIN
+static inline float clamp_s16(float v)
+{
+    v = v > INT16_MIN ? v : INT16_MIN;
+    return v < INT16_MAX ? v : INT16_MAX;
+}
+
+SIMD_TARGET_CLONES
+void pcm_float_to_s16(float const *x, size_t n, float scale, int16_t *y)
+{
+    const v8sf lo = {INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN,
+                     INT16_MIN, INT16_MIN, INT16_MIN, INT16_MIN};
+    const v8sf hi = {INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX,
+                     INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX};
+    size_t i = 0;
+
+    for (; i + PCM_VEC_LEN <= n; i += PCM_VEC_LEN)
+    {
+        v8sf v;
+        memcpy(&v, &x[i], sizeof(v));
+        v *= scale;
+
+        // The same compare and select as clamp_s16(), vectorized
+        v8si m = v > lo;
+        v = (v8sf)(((v8si)v & m) | ((v8si)lo & ~m));
+        m = v < hi;
+        v = (v8sf)(((v8si)v & m) | ((v8si)hi & ~m));
+
+        const v8hi s = __builtin_convertvector(__builtin_convertvector(v, v8si),
+                                               v8hi);
+        memcpy(&y[i], &s, sizeof(s));
+    }
+
+    for (; i < n; i++)
+    {
+        y[i] = (int16_t)clamp_s16(x[i] * scale);
+    }
+}
@@ -0,0 +1,66 @@
+#include "preroll.h"
+
+#include <string.h>
+
+#include "logging.h"
+
+void preroll_init(preroll_t *p, complex float *buf, size_t len)
+{
+    log_assert(buf && (len > 0));
+
+    p->buf = buf;
+    p->len = len;
+    preroll_reset(p, 0);
+}
+
+void preroll_reset(preroll_t *p, size_t demodulated)
+{
+    p->pos = 0;
+    p->fill = 0;
+    p->skip = demodulated;
+}
+
+void preroll_push(preroll_t *p, complex float const *x, size_t n)
+{
+    const size_t skip = p->skip < n ? p->skip : n;
+
+    x += skip;
+    n -= skip;
+    p->skip = 0;
+    if (n > p->len)
+    {
+        x += n - p->len;
+        n = p->len;
+    }
+
+    const size_t room = p->len - p->pos;
+    const size_t first = n < room ? n : room;
+    memcpy(&p->buf[p->pos], x, first * sizeof(complex float));
+    memcpy(p->buf, &x[first], (n - first) * sizeof(complex float));
+    p->pos = (p->pos + n) % p->len;
+    p->fill = p->fill + n < p->len ? p->fill + n : p->len;
+}
+
+size_t preroll_get(preroll_t *p, complex float *part[2],
+                   size_t part_len[2])
+{
+    const size_t start = (p->pos + p->len - p->fill) % p->len;
+    const size_t first = p->len - start;
+
+    if (p->fill == 0)
+    {
+        return 0;
+    }
+    if (p->fill <= first)
+    {
+        part[0] = &p->buf[start];
+        part_len[0] = p->fill;
+        return 1;
+    }
+
+    part[0] = &p->buf[start];
+    part_len[0] = first;
+    part[1] = p->buf;
+    part_len[1] = p->fill - first;
+    return 2;
+}
@@ -0,0 +1,188 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+
+#include "logging.h"
+
+// Log-linear buckets: every power of two is split into 2^PROF_SUB_BITS
+// buckets, so a percentile is never more than ~12% off, from a nanosecond
+// up to PROF_MAX_EXP seconds
+#define PROF_SUB_BITS (3)
+#define PROF_SUB_BUCKETS (1U << PROF_SUB_BITS)
+#define PROF_MAX_EXP (40)
+#define PROF_NUM_BUCKETS ((PROF_MAX_EXP - PROF_SUB_BITS + 2) * PROF_SUB_BUCKETS)
+
+typedef struct
+{
+    const char *name;
+    uint64_t count;
+    uint64_t samples;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[PROF_NUM_BUCKETS];
+} prof_stage_t;
+
+struct _profiler_t
+{
+    size_t num_stages;
+    prof_stage_t *stages;
+};
+
+static size_t bucket_index(uint64_t v)
+{
+    if (v < PROF_SUB_BUCKETS)
+    {
+        return v;
+    }
+
+    unsigned int e = 63 - __builtin_clzll(v);
+    if (e > PROF_MAX_EXP)
+    {
+        return PROF_NUM_BUCKETS - 1;
+    }
+    const size_t sub = (v >> (e - PROF_SUB_BITS)) & (PROF_SUB_BUCKETS - 1);
+    return ((e - PROF_SUB_BITS + 1) * PROF_SUB_BUCKETS) + sub;
+}
+
+// The upper bound of a bucket
+static uint64_t bucket_value(size_t i)
+{
+    if (i < PROF_SUB_BUCKETS)
+    {
+        return i;
+    }
+
+    const unsigned int e = (i / PROF_SUB_BUCKETS) + PROF_SUB_BITS - 1;
+    const uint64_t sub = i % PROF_SUB_BUCKETS;
+    return ((PROF_SUB_BUCKETS + sub + 1) << (e - PROF_SUB_BITS)) - 1;
+}
+
+profiler_t *profiler_create(const char *const *names, size_t num_stages)
+{
+    profiler_t *self = calloc(1, sizeof(profiler_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->stages = calloc(num_stages, sizeof(prof_stage_t));
+    if (!self->stages)
+    {
+        free(self);
+        return NULL;
+    }
+
+    self->num_stages = num_stages;
+    for (size_t i = 0; i < num_stages; i++)
+    {
+        self->stages[i].name = names[i];
+    }
+
+    return self;
+}
+
+void profiler_destroy(profiler_t **p_p)
+{
+    log_assert(p_p);
+    if (*p_p)
+    {
+        free((*p_p)->stages);
+        free(*p_p);
+        *p_p = NULL;
+    }
+}
+
+void profiler_record(profiler_t *p, size_t stage, uint64_t start,
+                     size_t samples)
+{
+    if (!p)
+    {
+        return;
+    }
+    log_assert(stage < p->num_stages);
+
+    prof_stage_t *s = &p->stages[stage];
+    const uint64_t ns = profiler_start(p) - start;
+
+    __atomic_fetch_add(&s->buckets[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->samples, samples, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+    while ((ns > max) &&
+           !__atomic_compare_exchange_n(&s->max_ns, &max, ns, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void profiler_get_stats(profiler_t *p, size_t stage, profiler_stats_t *stats)
+{
+    log_assert(stage < p->num_stages);
+    prof_stage_t *s = &p->stages[stage];
+    uint64_t buckets[PROF_NUM_BUCKETS];
+    uint64_t count = 0;
+
+    // The counters keep moving while they are read, so the
+    // percentiles come from a copy of the histogram alone
+    for (size_t i = 0; i < PROF_NUM_BUCKETS; i++)
+    {
+        buckets[i] = __atomic_load_n(&s->buckets[i], __ATOMIC_RELAXED);
+        count += buckets[i];
+    }
+
+    stats->name = s->name;
+    stats->count = count;
+    stats->samples = __atomic_load_n(&s->samples, __ATOMIC_RELAXED);
+    stats->max_ns = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+    stats->avg_ns =
+        count > 0
+            ? (double)__atomic_load_n(&s->total_ns, __ATOMIC_RELAXED) / count
+            : 0.0;
+    stats->p50_ns = 0;
+    stats->p99_ns = 0;
+
+    uint64_t acc = 0;
+    const uint64_t p50 = (count + 1) / 2;
+    const uint64_t p99 = count - (count / 100);
+    for (size_t i = 0; (i < PROF_NUM_BUCKETS) && (acc < p99); i++)
+    {
+        acc += buckets[i];
+        if ((stats->p50_ns == 0) && (acc >= p50))
+        {
+            stats->p50_ns = bucket_value(i);
+        }
+        if (acc >= p99)
+        {
+            stats->p99_ns = bucket_value(i);
+        }
+    }
+    // Bucket bounds are coarse, the maximum is exact
+    if (stats->p50_ns > stats->max_ns)
+    {
+        stats->p50_ns = stats->max_ns;
+    }
+    if (stats->p99_ns > stats->max_ns)
+    {
+        stats->p99_ns = stats->max_ns;
+    }
+}
+
+void profiler_print(profiler_t *p)
+{
+    LOG(INFO, "%-12s %10s %10s %10s %10s %10s %12s", "stage", "runs",
+        "avg [us]", "p50 [us]", "p99 [us]", "max [us]", "samples/run");
+    for (size_t i = 0; i < p->num_stages; i++)
+    {
+        profiler_stats_t st;
+        profiler_get_stats(p, i, &st);
+        if (st.count == 0)
+        {
+            continue;
+        }
+        LOG(INFO, "%-12s %10lu %10.1f %10.1f %10.1f %10.1f %12.1f", st.name,
+            st.count, st.avg_ns * 1e-3, st.p50_ns * 1e-3, st.p99_ns * 1e-3,
+            st.max_ns * 1e-3, (double)st.samples / st.count);
+    }
+}
@@ -0,0 +1,182 @@
+#include "rational_resampler.h"
+
+#include <liquid/liquid.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "simd.h"
+
+// Taps of each polyphase component, a multiple of the vector width.
+// The transition band is then ~30% of the lower Nyquist frequency.
+#define RR_TAPS_PER_PHASE (24)
+#define RR_VEC_LEN (8)
+// The passband edge, relative to the lower Nyquist frequency
+#define RR_CUTOFF (0.8f)
+
+_Static_assert(RR_TAPS_PER_PHASE % RR_VEC_LEN == 0,
+               "Whole vectors of taps per phase");
+
+struct _rational_resampler_t
+{
+    unsigned int interp;
+    unsigned int decim;
+    size_t max_input;
+    // `interp` phases, the taps of each one reversed
+    float *h;
+    // RR_TAPS_PER_PHASE - 1 samples of history, then the input
+    float *buf;
+    // The phase and the (buf) input index of the next output sample
+    unsigned int phase;
+    size_t index;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0)
+    {
+        const unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static void *alloc_aligned(size_t size)
+{
+    size = (size + SIMD_ALIGNMENT - 1) & ~((size_t)SIMD_ALIGNMENT - 1);
+    void *p = aligned_alloc(SIMD_ALIGNMENT, size);
+    if (p)
+    {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+rational_resampler_t *rational_resampler_create(unsigned int in_rate,
+                                                unsigned int out_rate,
+                                                float as, size_t max_input)
+{
+    log_assert((in_rate > 0) && (out_rate > 0));
+
+    rational_resampler_t *self = calloc(1, sizeof(rational_resampler_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    const unsigned int g = gcd(in_rate, out_rate);
+    self->interp = out_rate / g;
+    self->decim = in_rate / g;
+    self->max_input = max_input;
+
+    const size_t len = (size_t)self->interp * RR_TAPS_PER_PHASE;
+    float *proto = malloc(len * sizeof(float));
+    self->h = alloc_aligned(len * sizeof(float));
+    self->buf =
+        alloc_aligned((RR_TAPS_PER_PHASE - 1 + max_input) * sizeof(float));
+    if (!proto || !self->h || !self->buf)
+    {
+        free(proto);
+        rational_resampler_destroy(&self);
+        return NULL;
+    }
+
+    // Designed at the interpolated rate, cut off below
+    // the lower of the input and output Nyquist frequencies
+    const unsigned int max_factor =
+        self->interp > self->decim ? self->interp : self->decim;
+    liquid_firdes_kaiser(len, (0.5f * RR_CUTOFF) / max_factor, as, 0.0f, proto);
+
+    // Every phase gets unity DC gain
+    float sum = 0.0f;
+    for (size_t i = 0; i < len; i++)
+    {
+        sum += proto[i];
+    }
+    const float scale = self->interp / sum;
+
+    for (unsigned int p = 0; p < self->interp; p++)
+    {
+        for (unsigned int j = 0; j < RR_TAPS_PER_PHASE; j++)
+        {
+            self->h[(p * RR_TAPS_PER_PHASE) + (RR_TAPS_PER_PHASE - 1 - j)] =
+                scale * proto[p + (j * self->interp)];
+        }
+    }
+    free(proto);
+
+    return self;
+}
+
+void rational_resampler_destroy(rational_resampler_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        free((*q_p)->buf);
+        free((*q_p)->h);
+        free(*q_p);
+        *q_p = NULL;
+    }
+}
+
+void rational_resampler_reset(rational_resampler_t *q)
+{
+    memset(q->buf, 0, (RR_TAPS_PER_PHASE - 1) * sizeof(float));
+    q->phase = 0;
+    q->index = 0;
+}
+
+void rational_resampler_print(rational_resampler_t *q)
+{
+    LOG(INFO, "Rational resampler: %u/%u, %u taps per phase", q->interp,
+        q->decim, RR_TAPS_PER_PHASE);
+}
+
+size_t rational_resampler_max_output(rational_resampler_t *q, size_t nx)
+{
+    return (((nx + 1) * q->interp) / q->decim) + 1;
+}
+
+SIMD_TARGET_CLONES
+static size_t resample(rational_resampler_t *q, size_t nx, float *y)
+{
+    size_t ny = 0;
+
+    while (q->index < nx)
+    {
+        float const *h = &q->h[q->phase * RR_TAPS_PER_PHASE];
+        float const *b = &q->buf[q->index];
+        v8sf acc = {0};
+        for (unsigned int j = 0; j < RR_TAPS_PER_PHASE; j += RR_VEC_LEN)
+        {
+            v8sf hv, bv;
+            memcpy(&hv, &h[j], sizeof(hv));
+            memcpy(&bv, &b[j], sizeof(bv));
+            acc += hv * bv;
+        }
+        y[ny++] = (acc[0] + acc[4]) + (acc[1] + acc[5]) + (acc[2] + acc[6]) +
+                  (acc[3] + acc[7]);
+
+        q->phase += q->decim;
+        q->index += q->phase / q->interp;
+        q->phase %= q->interp;
+    }
+
+    return ny;
+}
+
+size_t rational_resampler_execute(rational_resampler_t *q, float const *x,
+                                  size_t nx, float *y)
+{
+    log_assert(nx <= q->max_input);
+
+    memcpy(&q->buf[RR_TAPS_PER_PHASE - 1], x, nx * sizeof(float));
+    const size_t ny = resample(q, nx, y);
+
+    q->index -= nx;
+    memmove(q->buf, &q->buf[nx], (RR_TAPS_PER_PHASE - 1) * sizeof(float));
+
+    return ny;
+}
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+
+#include "recorder.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk_queue.h"
+#include "logging.h"
+#include "pcm.h"
+
+#define RECORDER_MAX_CHANNELS (64)
+// With 64ms blocks, ~16s of audio of a single channel, or a second
+// of all the 16 PMR446 channels at once
+#define RECORDER_QUEUE_DEPTH (256)
+// Per open file, so the disk sees a few large writes per second at most
+#define RECORDER_FILE_BUF (256 * 1024)
+#define RECORDER_WAV_HEADER_LEN (44)
+
+typedef enum
+{
+    rec_open = 0,
+    rec_write,
+    rec_close,
+} rec_event_e;
+
+// The payload of the queued chunks, `len` samples
+typedef struct
+{
+    rec_event_e event;
+    unsigned int channel;
+    int ctcss_code;
+    struct timespec start;
+    float samples[];
+} rec_block_t;
+
+// Writer thread only
+typedef struct
+{
+    FILE *f;
+    struct timespec start;
+    int ctcss_code;
+    uint32_t data_bytes;
+    char path[PATH_MAX];
+} rec_file_t;
+
+struct _recorder_t
+{
+    char *dir;
+    unsigned int rate;
+    size_t max_block;
+    chunk_queue_t *queue;
+    pthread_t thread;
+    bool started;
+    rec_file_t files[RECORDER_MAX_CHANNELS];
+    int16_t *pcm;
+    atomic_uint_fast64_t num_files;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t dropped_samples;
+    atomic_uint_fast64_t errors;
+};
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(&p[2], v >> 16);
+}
+
+static void wav_header(uint8_t *h, unsigned int rate, uint32_t data_bytes)
+{
+    memcpy(&h[0], "RIFF", 4);
+    put_le32(&h[4], 36 + data_bytes);
+    memcpy(&h[8], "WAVEfmt ", 8);
+    put_le32(&h[16], 16);
+    put_le16(&h[20], 1);  // PCM
+    put_le16(&h[22], 1);  // mono
+    put_le32(&h[24], rate);
+    put_le32(&h[28], rate * sizeof(int16_t));
+    put_le16(&h[32], sizeof(int16_t));
+    put_le16(&h[34], 16);
+    memcpy(&h[36], "data", 4);
+    put_le32(&h[40], data_bytes);
+}
+
+// The CTCSS code is only known by the end of the transmission,
+// so the name is given to the file once it's complete
+static void file_name(recorder_t *q, unsigned int channel,
+                      const rec_file_t *file, const char *suffix, char *path)
+{
+    struct tm tm;
+    char stamp[32];
+    char code[16];
+
+    localtime_r(&file->start.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    if (file->ctcss_code > 0)
+    {
+        snprintf(code, sizeof(code), "ctcss%02d", file->ctcss_code);
+    }
+    else
+    {
+        snprintf(code, sizeof(code), "noctcss");
+    }
+    snprintf(path, PATH_MAX, "%s/ch%02u_%s_%s.%03ld%s", q->dir, channel + 1,
+             code, stamp, file->start.tv_nsec / 1000000, suffix);
+}
+
+static void file_error(recorder_t *q, rec_file_t *file, const char *what)
+{
+    LOG(ERROR, "Failed to %s '%s': %s", what, file->path, strerror(errno));
+    atomic_fetch_add_explicit(&q->errors, 1, memory_order_relaxed);
+}
+
+static void file_finish(recorder_t *q, unsigned int channel)
+{
+    rec_file_t *file = &q->files[channel];
+    uint8_t header[RECORDER_WAV_HEADER_LEN];
+    char path[PATH_MAX];
+
+    if (!file->f)
+    {
+        return;
+    }
+
+    wav_header(header, q->rate, file->data_bytes);
+    if ((fseek(file->f, 0, SEEK_SET) != 0) ||
+        (fwrite(header, sizeof(header), 1, file->f) != 1))
+    {
+        file_error(q, file, "write");
+    }
+    if (fclose(file->f) != 0)
+    {
+        file_error(q, file, "close");
+    }
+    file->f = NULL;
+
+    file_name(q, channel, file, ".wav", path);
+    if (rename(file->path, path) != 0)
+    {
+        file_error(q, file, "rename");
+        return;
+    }
+    LOG(DEBUG, "Recorded %.1fs to '%s'",
+        (double)file->data_bytes / (q->rate * sizeof(int16_t)), path);
+    atomic_fetch_add_explicit(&q->num_files, 1, memory_order_relaxed);
+}
+
+static void file_start(recorder_t *q, const rec_block_t *b)
+{
+    rec_file_t *file = &q->files[b->channel];
+    uint8_t header[RECORDER_WAV_HEADER_LEN];
+
+    // The close got lost in a full queue
+    file_finish(q, b->channel);
+
+    file->start = b->start;
+    file->ctcss_code = 0;
+    file->data_bytes = 0;
+    file_name(q, b->channel, file, ".wav.part", file->path);
+
+    file->f = fopen(file->path, "wb");
+    if (!file->f)
+    {
+        file_error(q, file, "create");
+        return;
+    }
+    setvbuf(file->f, NULL, _IOFBF, RECORDER_FILE_BUF);
+
+    // Completed with the sizes at the end
+    wav_header(header, q->rate, 0);
+    if (fwrite(header, sizeof(header), 1, file->f) != 1)
+    {
+        file_error(q, file, "write");
+    }
+}
+
+static void file_write(recorder_t *q, const rec_block_t *b, size_t n)
+{
+    rec_file_t *file = &q->files[b->channel];
+
+    if (!file->f)
+    {
+        return;
+    }
+    if (b->ctcss_code > 0)
+    {
+        file->ctcss_code = b->ctcss_code;
+    }
+
+    pcm_float_to_s16(b->samples, n, 32767.0f, q->pcm);
+    if (fwrite(q->pcm, sizeof(int16_t), n, file->f) != n)
+    {
+        file_error(q, file, "write");
+        return;
+    }
+    file->data_bytes += n * sizeof(int16_t);
+    atomic_fetch_add_explicit(&q->bytes, n * sizeof(int16_t),
+                              memory_order_relaxed);
+}
+
+static void *writer_thread(void *arg)
+{
+    recorder_t *q = arg;
+    chunk_t *c;
+
+    while ((c = chunk_queue_pop(q->queue)))
+    {
+        const rec_block_t *b = c->data;
+
+        switch (b->event)
+        {
+        case rec_open:
+            file_start(q, b);
+            break;
+
+        case rec_write:
+            file_write(q, b, c->len);
+            break;
+
+        case rec_close:
+            file_finish(q, b->channel);
+            break;
+        }
+        chunk_queue_release(q->queue, c);
+    }
+
+    for (unsigned int i = 0; i < RECORDER_MAX_CHANNELS; i++)
+    {
+        file_finish(q, i);
+    }
+
+    return NULL;
+}
+
+recorder_t *recorder_create(const char *dir, unsigned int rate,
+                            size_t max_block)
+{
+    log_assert(dir && (rate > 0) && (max_block > 0));
+
+    recorder_t *self = calloc(1, sizeof(recorder_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->rate = rate;
+    self->max_block = max_block;
+    atomic_init(&self->num_files, 0);
+    atomic_init(&self->bytes, 0);
+    atomic_init(&self->dropped_samples, 0);
+    atomic_init(&self->errors, 0);
+
+    self->dir = strdup(dir);
+    self->pcm = malloc(max_block * sizeof(int16_t));
+    self->queue = chunk_queue_create(
+        "recorder", RECORDER_QUEUE_DEPTH,
+        sizeof(rec_block_t) + (max_block * sizeof(float)), NULL);
+    if (!self->dir || !self->pcm || !self->queue)
+    {
+        recorder_destroy(&self);
+        return NULL;
+    }
+
+    int ret = pthread_create(&self->thread, NULL, writer_thread, self);
+    if (ret != 0)
+    {
+        LOG(ERROR, "Failed to start the recorder thread: %s", strerror(ret));
+        recorder_destroy(&self);
+        return NULL;
+    }
+    pthread_setname_np(self->thread, "recorder");
+    self->started = true;
+
+    return self;
+}
+
+void recorder_destroy(recorder_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        recorder_t *q = *q_p;
+        recorder_finish(q);
+        chunk_queue_destroy(&q->queue);
+        free(q->pcm);
+        free(q->dir);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+void recorder_finish(recorder_t *q)
+{
+    if (q->started)
+    {
+        chunk_queue_close(q->queue);
+        pthread_join(q->thread, NULL);
+        q->started = false;
+    }
+}
+
+static rec_block_t *acquire(recorder_t *q, chunk_t **c_p, rec_event_e event,
+                            unsigned int channel)
+{
+    log_assert(channel < RECORDER_MAX_CHANNELS);
+
+    chunk_t *c = chunk_queue_acquire(q->queue, false);
+    if (!c)
+    {
+        chunk_queue_count_drop(q->queue);
+        return NULL;
+    }
+
+    rec_block_t *b = c->data;
+    b->event = event;
+    b->channel = channel;
+    b->ctcss_code = 0;
+    *c_p = c;
+    return b;
+}
+
+void recorder_open(recorder_t *q, unsigned int channel)
+{
+    chunk_t *c;
+    rec_block_t *b = acquire(q, &c, rec_open, channel);
+
+    if (b)
+    {
+        clock_gettime(CLOCK_REALTIME, &b->start);
+        chunk_queue_push(q->queue, c);
+    }
+}
+
+void recorder_write(recorder_t *q, unsigned int channel, int ctcss_code,
+                    float const *x, size_t n)
+{
+    while (n > 0)
+    {
+        const size_t len = n < q->max_block ? n : q->max_block;
+        chunk_t *c;
+        rec_block_t *b = acquire(q, &c, rec_write, channel);
+
+        if (!b)
+        {
+            atomic_fetch_add_explicit(&q->dropped_samples, n,
+                                      memory_order_relaxed);
+            return;
+        }
+        b->ctcss_code = ctcss_code;
+        memcpy(b->samples, x, len * sizeof(float));
+        c->len = len;
+        chunk_queue_push(q->queue, c);
+
+        x += len;
+        n -= len;
+    }
+}
+
+void recorder_close(recorder_t *q, unsigned int channel)
+{
+    chunk_t *c;
+    rec_block_t *b = acquire(q, &c, rec_close, channel);
+
+    if (b)
+    {
+        chunk_queue_push(q->queue, c);
+    }
+}
+
+void recorder_get_stats(recorder_t *q, recorder_stats_t *stats)
+{
+    stats->files = atomic_load_explicit(&q->num_files, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&q->bytes, memory_order_relaxed);
+    stats->dropped_samples =
+        atomic_load_explicit(&q->dropped_samples, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&q->errors, memory_order_relaxed);
+}
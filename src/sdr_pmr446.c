@@ -1,162 +1,177 @@
+#define _GNU_SOURCE
+
 #include "sdr_pmr446.h"
 
 #include <SoapySDR/Device.h>
+#include <SoapySDR/Errors.h>
 #include <argp.h>
 #include <complex.h>
+#include <errno.h>
+#include <limits.h>
 #include <liquid/liquid.h>
 #include <math.h>
 #include <pthread.h>
 #include <rtaudio/rtaudio_c.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "audio_filters.h"
+#include "chunk_queue.h"
+#include "ctcss.h"
+#include "iq_source.h"
 #include "logging.h"
 #include "shared.h"
+#include "waterfall.h"
 
-#define MAX_CHANNELS (64)
+#define MAX_CHANNELS (CHANNEL_PLAN_MAX_CHANNELS)
 
 #define FOOTER_TAIL_LEN (64UL)
 
-#define CHANNEL_WIDTH_HZ (12500UL)
-#define NUM_CHANNELS (16)
-#define AUDIO_SAMPLERATE (CHANNEL_WIDTH_HZ)
-#define BAND_START_HZ (446.0e6)
-
-#define SDR_RESAMPLERATE (NUM_CHANNELS * CHANNEL_WIDTH_HZ)
-#define SDR_FREQUENCY (BAND_START_HZ + ((NUM_CHANNELS / 2) * CHANNEL_WIDTH_HZ))
+#define SDR_DEFAULT_CHANNEL_PLAN "pmr446"
 
-#define SDR_INPUT_CHUNK (100000UL)
+#define SDR_DEFAULT_SAMPLERATE (1600000UL)
+// The latency/throughput trade-off, every buffer is sized from it
+#define SDR_DEFAULT_CHUNK_MS (64)
+#define SDR_MIN_CHUNK_MS (2)
+#define SDR_MAX_CHUNK_MS (500)
 
 #define SDR_DEFAULT_GAIN (42.0)
 #define SDR_DEFAULT_AUDIO_GAIN (4.0)
 #define SDR_DEFAULT_SQUELCH_LEVEL (18.0)
-
-#define SDR_RESAMP_BUF_SIZE (39064)
-#define SDR_CHANNEL_BUF_SIZE (2441UL)
-
-#define HP_AUDIO_FILT_TAPS (377)
-#define LP_AUDIO_FILT_TAPS (103)
-#define LP_CTCSS_FILT_TAPS (315)
-#ifdef APP_FIR_DEEMPH
-#define DEEMPH_FILT_TAPS (101)
-#endif
-
-#define CTCSS_BLOCK_SIZE (SDR_CHANNEL_BUF_SIZE)
+#define SDR_DEFAULT_QUEUE_DEPTH (4)
+// The audio buffer follows the chunk length, unless given explicitly
+#define AUDIO_AUTO_MS (UINT_MAX)
+// On top of a chunk, for the scheduling and processing time jitter
+#define AUDIO_TARGET_MARGIN_MS (16)
+// Chunks of room above the target
+#define AUDIO_CHUNKS_ABOVE_TARGET (4)
+#define SDR_DEFAULT_SQUELCH_BLOCK_MS (10)
+#define SDR_DEFAULT_WATERFALL_FPS (10)
+#define SDR_DEFAULT_PREROLL_MS (300)
+
+// Used when the sound card doesn't tell its native rate
+#define AUDIO_DEFAULT_DEVICE_RATE (48000U)
+#define AUDIO_MAX_DEVICE_RATE (192000U)
+// Longer gaps are not worth filling with zeros
+#define SDR_MAX_GAP_FILL_S (1.0)
+
+// The SDR to host clock offset estimate follows a drift up to this
+#define LATENCY_MAX_DRIFT (100e-6)
+
+// Squelch decisions per chunk at most
+#define SQUELCH_MAX_BLOCKS (64)
+
+// ~195ms detection window, re-evaluated every ~49ms
+#define CTCSS_WINDOW_S (0.195)
+#define CTCSS_HOPS_PER_WINDOW (4)
+
+#define PIPELINE_NUM_STAGES (4)
+#define PIPELINE_REPORT_INTERVAL_S (10)
+
+typedef enum {
+  PROF_CAPTURE = 0,
+  PROF_DCBLOCK,
+  PROF_RESAMPLER,
+  PROF_CHANNELIZER,
+  PROF_SQUELCH,
+  PROF_DEMOD,
+  PROF_AUDIO,
+  PROF_AUDIO_SRC,
+  PROF_WATERFALL,
+  PROF_NUM_STAGES,
+} prof_stage_e;
+
+static const char *const prof_stage_names[PROF_NUM_STAGES] = {
+    "capture", "dcblock", "resampler", "channelizer",
+    "squelch", "demod",   "audio",     "audio_src", "waterfall",
+};
+
+static const char *const latency_stage_names[] = {"end-to-end"};
 
 #define xstr(s) str(s)
 #define str(s) #s
 
-typedef complex float ch_buff_mat_t[NUM_CHANNELS][SDR_CHANNEL_BUF_SIZE];
+// Followed by the samples of all the channels of the plan,
+// `chan_buf_size` of each, see chan_samples()
+typedef struct {
+  // Host clock time the first sample was taken at, 0 if unknown
+  uint64_t capture_ns;
+  // Sum of |x|^2 of each channel over each squelch block completed in
+  // the chunk, at [block * num_channels + channel], and the index of the
+  // sample following the block. Filled in by the channelizer.
+  size_t num_blocks;
+  size_t block_end[SQUELCH_MAX_BLOCKS];
+  float energy[SQUELCH_MAX_BLOCKS * MAX_CHANNELS];
+  complex float samples[];
+} ch_buff_mat_t;
+
+typedef struct {
+  proc_chain_t *chain;
+  chunk_queue_t *capture_q;
+  chunk_queue_t *resamp_q;
+  chunk_queue_t *chan_q;
+  complex float *drop_buf;
+} pipeline_t;
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state);
 
-// clang-format off
-static const float hp_audio_taps[HP_AUDIO_FILT_TAPS] = {
-    -0.00610107f,  0.00391676f,  0.00266218f,  0.00167537f,  0.00091408f,  0.00033810f, -0.00008332f, -0.00038047f,
-    -0.00057490f, -0.00068889f, -0.00073739f, -0.00073641f, -0.00069558f, -0.00062648f, -0.00053506f, -0.00043000f,
-    -0.00031466f, -0.00019579f, -0.00007544f,  0.00004086f,  0.00015223f,  0.00025372f,  0.00034510f,  0.00042207f,
-     0.00048485f,  0.00052948f,  0.00055715f,  0.00056456f,  0.00055370f,  0.00052215f,  0.00047310f,  0.00040486f,
-     0.00032220f,  0.00022396f,  0.00011684f,  0.00000041f, -0.00011969f, -0.00023528f, -0.00036035f, -0.00045462f,
-    -0.00055752f, -0.00063867f, -0.00069138f, -0.00072720f, -0.00074352f, -0.00073043f, -0.00068551f, -0.00061566f,
-    -0.00052415f, -0.00041128f, -0.00027567f, -0.00012230f,  0.00004259f,  0.00021043f,  0.00037704f,  0.00053688f,
-     0.00068651f,  0.00081869f,  0.00092803f,  0.00100683f,  0.00105219f,  0.00106040f,  0.00103204f,  0.00096555f,
-     0.00086322f,  0.00072470f,  0.00055435f,  0.00035501f,  0.00013467f, -0.00010118f, -0.00034187f, -0.00058131f,
-    -0.00080836f, -0.00101705f, -0.00119876f, -0.00134443f, -0.00145269f, -0.00150880f, -0.00151771f, -0.00147167f,
-    -0.00136820f, -0.00121415f, -0.00101046f, -0.00076114f, -0.00047418f, -0.00016074f,  0.00017216f,  0.00051372f,
-     0.00085220f,  0.00117333f,  0.00146710f,  0.00172173f,  0.00192738f,  0.00207220f,  0.00214969f,  0.00215391f,
-     0.00208363f,  0.00193645f,  0.00171542f,  0.00142398f,  0.00107118f,  0.00066574f,  0.00022115f, -0.00025085f,
-    -0.00073375f, -0.00121240f, -0.00166794f, -0.00208507f, -0.00244541f, -0.00273657f, -0.00294354f, -0.00305704f,
-    -0.00306830f, -0.00297137f, -0.00276761f, -0.00245649f, -0.00204759f, -0.00155007f, -0.00097536f, -0.00034322f,
-     0.00032939f,  0.00102072f,  0.00170755f,  0.00236430f,  0.00296923f,  0.00349782f,  0.00392881f,  0.00424190f,
-     0.00442290f,  0.00445786f,  0.00433928f,  0.00406265f,  0.00363191f,  0.00305345f,  0.00234105f,  0.00151132f,
-     0.00058896f, -0.00040026f, -0.00142513f, -0.00245412f, -0.00345042f, -0.00437964f, -0.00520503f, -0.00589429f,
-    -0.00641531f, -0.00674295f, -0.00685292f, -0.00673136f, -0.00636727f, -0.00575968f, -0.00491414f, -0.00384363f,
-    -0.00257142f, -0.00112603f,  0.00045449f,  0.00212549f,  0.00383932f,  0.00553935f,  0.00717039f,  0.00867240f,
-     0.00998642f,  0.01105318f,  0.01182001f,  0.01223528f,  0.01225579f,  0.01184400f,  0.01097392f,  0.00962636f,
-     0.00779583f,  0.00548611f,  0.00271515f, -0.00049071f, -0.00409137f, -0.00803824f, -0.01227001f, -0.01672007f,
-    -0.02131214f, -0.02596635f, -0.03059634f, -0.03511776f, -0.03944350f, -0.04349080f, -0.04717894f, -0.05043653f,
-    -0.05319598f, -0.05540353f, -0.05701288f, -0.05799162f,  0.94167965f, -0.05799162f, -0.05701288f, -0.05540353f,
-    -0.05319598f, -0.05043653f, -0.04717894f, -0.04349080f, -0.03944350f, -0.03511776f, -0.03059634f, -0.02596635f,
-    -0.02131214f, -0.01672007f, -0.01227001f, -0.00803824f, -0.00409137f, -0.00049071f,  0.00271515f,  0.00548611f,
-     0.00779583f,  0.00962636f,  0.01097392f,  0.01184400f,  0.01225579f,  0.01223528f,  0.01182001f,  0.01105318f,
-     0.00998642f,  0.00867240f,  0.00717039f,  0.00553935f,  0.00383932f,  0.00212549f,  0.00045449f, -0.00112603f,
-    -0.00257142f, -0.00384363f, -0.00491414f, -0.00575968f, -0.00636727f, -0.00673136f, -0.00685292f, -0.00674295f,
-    -0.00641531f, -0.00589429f, -0.00520503f, -0.00437964f, -0.00345042f, -0.00245412f, -0.00142513f, -0.00040026f,
-     0.00058896f,  0.00151132f,  0.00234105f,  0.00305345f,  0.00363191f,  0.00406265f,  0.00433928f,  0.00445786f,
-     0.00442290f,  0.00424190f,  0.00392881f,  0.00349782f,  0.00296923f,  0.00236430f,  0.00170755f,  0.00102072f,
-     0.00032939f, -0.00034322f, -0.00097536f, -0.00155007f, -0.00204759f, -0.00245649f, -0.00276761f, -0.00297137f,
-    -0.00306830f, -0.00305704f, -0.00294354f, -0.00273657f, -0.00244541f, -0.00208507f, -0.00166794f, -0.00121240f,
-    -0.00073375f, -0.00025085f,  0.00022115f,  0.00066574f,  0.00107118f,  0.00142398f,  0.00171542f,  0.00193645f,
-     0.00208363f,  0.00215391f,  0.00214969f,  0.00207220f,  0.00192738f,  0.00172173f,  0.00146710f,  0.00117333f,
-     0.00085220f,  0.00051372f,  0.00017216f, -0.00016074f, -0.00047418f, -0.00076114f, -0.00101046f, -0.00121415f,
-    -0.00136820f, -0.00147167f, -0.00151771f, -0.00150880f, -0.00145269f, -0.00134443f, -0.00119876f, -0.00101705f,
-    -0.00080836f, -0.00058131f, -0.00034187f, -0.00010118f,  0.00013467f,  0.00035501f,  0.00055435f,  0.00072470f,
-     0.00086322f,  0.00096555f,  0.00103204f,  0.00106040f,  0.00105219f,  0.00100683f,  0.00092803f,  0.00081869f,
-     0.00068651f,  0.00053688f,  0.00037704f,  0.00021043f,  0.00004259f, -0.00012230f, -0.00027567f, -0.00041128f,
-    -0.00052415f, -0.00061566f, -0.00068551f, -0.00073043f, -0.00074352f, -0.00072720f, -0.00069138f, -0.00063867f,
-    -0.00055752f, -0.00045462f, -0.00036035f, -0.00023528f, -0.00011969f,  0.00000041f,  0.00011684f,  0.00022396f,
-     0.00032220f,  0.00040486f,  0.00047310f,  0.00052215f,  0.00055370f,  0.00056456f,  0.00055715f,  0.00052948f,
-     0.00048485f,  0.00042207f,  0.00034510f,  0.00025372f,  0.00015223f,  0.00004086f, -0.00007544f, -0.00019579f,
-    -0.00031466f, -0.00043000f, -0.00053506f, -0.00062648f, -0.00069558f, -0.00073641f, -0.00073739f, -0.00068889f,
-    -0.00057490f, -0.00038047f, -0.00008332f,  0.00033810f,  0.00091408f,  0.00167537f,  0.00266218f,  0.00391676f,
-    -0.00610107f};
-
-static const float lp_audio_taps[LP_AUDIO_FILT_TAPS] = {
-     0.00246253f,  0.00653798f,  0.00120876f, -0.00287389f,  0.00201971f, -0.00020231f, -0.00156764f,  0.00240512f,
-    -0.00176244f, -0.00011997f,  0.00217598f, -0.00304036f,  0.00192898f,  0.00069908f, -0.00325112f,  0.00393558f,
-    -0.00197824f, -0.00166413f,  0.00470662f, -0.00494003f,  0.00177669f,  0.00310013f, -0.00655946f,  0.00599165f,
-    -0.00119629f, -0.00513856f,  0.00886932f, -0.00703653f,  0.00007751f,  0.00798494f, -0.01177575f,  0.00803340f,
-     0.00184449f, -0.01203789f,  0.01558157f, -0.00892507f, -0.00509551f,  0.01811789f, -0.02096620f,  0.00967502f,
-     0.01086701f, -0.02840958f,  0.02996278f, -0.01023451f, -0.02310694f,  0.05094574f, -0.05120893f,  0.01058206f,
-     0.06674462f, -0.15844736f,  0.23238885f,  0.73929005f,  0.23238885f, -0.15844736f,  0.06674462f,  0.01058206f,
-    -0.05120893f,  0.05094574f, -0.02310694f, -0.01023451f,  0.02996278f, -0.02840958f,  0.01086701f,  0.00967502f,
-    -0.02096620f,  0.01811789f, -0.00509551f, -0.00892507f,  0.01558157f, -0.01203789f,  0.00184449f,  0.00803340f,
-    -0.01177575f,  0.00798494f,  0.00007751f, -0.00703653f,  0.00886932f, -0.00513856f, -0.00119629f,  0.00599165f,
-    -0.00655946f,  0.00310013f,  0.00177669f, -0.00494003f,  0.00470662f, -0.00166413f, -0.00197824f,  0.00393558f,
-    -0.00325112f,  0.00069908f,  0.00192898f, -0.00304036f,  0.00217598f, -0.00011997f, -0.00176244f,  0.00240512f,
-    -0.00156764f, -0.00020231f,  0.00201971f, -0.00287389f,  0.00120876f,  0.00653798f,  0.00246253f};
+static size_t chan_bufs_size(proc_chain_t *chain) {
+  return sizeof(ch_buff_mat_t) + (chain->args.plan.num_channels *
+                                  chain->chan_buf_size * sizeof(complex float));
+}
 
-#ifdef APP_FIR_DEEMPH
-static const float deemph_taps[DEEMPH_FILT_TAPS] = {
-    -0.00051465f, -0.00099186f, -0.00159733f, -0.00227851f, -0.00310069f, -0.00400507f, -0.00506042f, -0.00620048f,
-    -0.00749764f, -0.00887676f, -0.01041414f, -0.01202419f, -0.01378760f, -0.01560654f, -0.01756678f, -0.01955631f,
-    -0.02166702f, -0.02377038f, -0.02596587f, -0.02810578f, -0.03029920f, -0.03237594f, -0.03445746f, -0.03634694f,
-    -0.03818191f, -0.03973361f, -0.04116047f, -0.04219463f, -0.04302200f, -0.04332560f, -0.04332773f, -0.04264781f,
-    -0.04155682f, -0.03958890f, -0.03708117f, -0.03344847f, -0.02911980f, -0.02333449f, -0.01665294f, -0.00803967f,
-     0.00174917f,  0.01421623f,  0.02829790f,  0.04638760f,  0.06690555f,  0.09427435f,  0.12599297f,  0.17284975f,
-     0.23109142f,  0.35660140f,  0.62006398f,  0.35660140f,  0.23109142f,  0.17284975f,  0.12599297f,  0.09427435f,
-     0.06690555f,  0.04638760f,  0.02829790f,  0.01421623f,  0.00174917f, -0.00803967f, -0.01665294f, -0.02333449f,
-    -0.02911980f, -0.03344847f, -0.03708117f, -0.03958890f, -0.04155682f, -0.04264781f, -0.04332773f, -0.04332560f,
-    -0.04302200f, -0.04219463f, -0.04116047f, -0.03973361f, -0.03818191f, -0.03634694f, -0.03445746f, -0.03237594f,
-    -0.03029920f, -0.02810578f, -0.02596587f, -0.02377038f, -0.02166702f, -0.01955631f, -0.01756678f, -0.01560654f,
-    -0.01378760f, -0.01202419f, -0.01041414f, -0.00887676f, -0.00749764f, -0.00620048f, -0.00506042f, -0.00400507f,
-    -0.00310069f, -0.00227851f, -0.00159733f, -0.00099186f, -0.00051465f};
-#endif
+static complex float *chan_samples(proc_chain_t *chain,
+                                   ch_buff_mat_t *chan_bufs,
+                                   const channel_t *ch) {
+  return &chan_bufs->samples[ch->index * chain->chan_buf_size];
+}
 
-static const float ctcss_freqs[CTCSS_NUM_FREQS] = {
-    67.0f, 71.9f, 74.4f, 77.0f, 79.7f, 82.5f, 85.4f, 88.5f, 91.5f, 94.8f, 97.4f, 100.0f, 103.5f, 107.2f,
-    110.9f, 114.8f, 118.8f, 123.0f, 127.3f, 131.8f, 136.5f, 141.3f, 146.2f, 151.4f, 156.7f, 162.2f,
-    167.9f, 173.8f, 179.9f, 186.2f, 192.8f, 203.5f, 210.7f, 218.1f, 225.7f, 233.6f, 241.8f, 250.3f};
-// clang-format on
 
 static proc_chain_t g_chain = {
     .state = proc_scanning,
     .active_chan = -1,
-    .ctcss_freq = -1.0,
-    .args = {.frequency = SDR_FREQUENCY,
-             .gain = SDR_DEFAULT_GAIN,
+    .args = {.gain = SDR_DEFAULT_GAIN,
              .audio_gain = SDR_DEFAULT_AUDIO_GAIN,
              .audio_api = RTAUDIO_API_UNSPECIFIED,
              .squelch_level = SDR_DEFAULT_SQUELCH_LEVEL,
+             .squelch_block_ms = SDR_DEFAULT_SQUELCH_BLOCK_MS,
              .waterfall = 0,
+             .waterfall_fps = SDR_DEFAULT_WATERFALL_FPS,
+             .waterfall_bins = 0,
              .lowpass = false,
              .channel_mask = UINT64_MAX,
-             .lock_mode = lock_mode_start}};
-
-static pthread_mutex_t lock;
-static bool exit_via_sig;
+             .lock_mode = lock_mode_start,
+             .pipeline = false,
+             .queue_depth = SDR_DEFAULT_QUEUE_DEPTH,
+             .chunk_ms = SDR_DEFAULT_CHUNK_MS,
+             .audio_latency_ms = AUDIO_AUTO_MS,
+             .audio_target_ms = AUDIO_AUTO_MS,
+             .monitor_all = false,
+             .num_workers = 0,
+             .sample_rate = SDR_DEFAULT_SAMPLERATE,
+             .hugepages = false,
+             .mlock = false,
+             .input = NULL,
+             .input_format = IQ_FORMAT_CU8,
+             .realtime = false,
+             .audio_out = NULL,
+             .profile = false,
+             .fill_gaps = false,
+             .record_dir = NULL,
+             .preroll_ms = SDR_DEFAULT_PREROLL_MS,
+             .iq_capture = NULL,
+             .iq_capture_format = IQ_FORMAT_CS16,
+             .iq_rotate_mb = 0,
+             .iq_rotate_s = 0,
+             .net_stream = NULL}};
+
+static volatile sig_atomic_t exit_via_sig;
+static volatile sig_atomic_t dump_profile;
 
 static char doc[] = "rtl_pmr446 -- a PMR446 band scanner/receiver";
 
@@ -169,8 +184,20 @@ static struct argp_option options[] = {
     {"squelch", 's', "SQ", 0,
      "The relative squelch level in [dB] (default: " xstr(
          SDR_DEFAULT_SQUELCH_LEVEL) "dB)"},
+    {"squelch-block", 'B', "MS", 0,
+     "The squelch decides on blocks of this many [ms] of the channel "
+     "signal, 0 = on whole chunks (default: " xstr(
+         SDR_DEFAULT_SQUELCH_BLOCK_MS) "ms)"},
     {"waterfall", 'w', "WT", 0,
      "If specified an ASCII waterfall is printed on the screen"},
+    {"waterfall-fps", 'f', "FPS", 0,
+     "The waterfall frame rate, frames due while the terminal is still "
+     "busy with the previous one are dropped (default: " xstr(
+         SDR_DEFAULT_WATERFALL_FPS) ")"},
+    {"waterfall-channels", 'W', "BINS", 0,
+     "Draw the waterfall from the channelizer output, BINS per channel "
+     "(up to " xstr(WATERFALL_MAX_BINS) "), instead of an FFT of the "
+     "band, for a lower CPU load"},
     {"lowpass", 'l', 0, 0,
      "Turn on 4.5kHz lowpass audio filter (might reduce noise)"},
     {"mask", 'm', "CM", 0,
@@ -183,6 +210,79 @@ static struct argp_option options[] = {
      "search for one)"},
     {"lock-mode", 'p', "LM", 0,
      "Channel lock mode, 'start', or 'max' (default: 'start')"},
+    {"chunk", 'C', "MS", 0,
+     "The length of the chunks of samples processed at once in [ms], "
+     "shorter ones lower the latency at a higher CPU load (default: " xstr(
+         SDR_DEFAULT_CHUNK_MS) "ms)"},
+    {"audio-latency", 'L', "MS", 0,
+     "The audio buffer latency target in [ms] (default: the fill target "
+     "plus " xstr(AUDIO_CHUNKS_ABOVE_TARGET) " chunks)"},
+    {"audio-target", 'A', "MS", 0,
+     "The audio buffer fill to steer the audio resampling rate to, "
+     "compensating for the SDR and sound card clock difference, in [ms] "
+     "(default: a chunk plus " xstr(
+         AUDIO_TARGET_MARGIN_MS) "ms, 0 = disabled)"},
+    {"monitor-all", 'M', 0, 0,
+     "Demodulate all the channels with an open squelch at once and mix "
+     "their audio"},
+    {"workers", 'j', "NW", 0,
+     "The number of threads demodulating the channels in '-M' mode "
+     "(default: 0 = one per available CPU)"},
+    {"pipeline", 'P', 0, 0,
+     "Run capture, front-end, channelizer and demodulator on separate "
+     "threads"},
+    {"queue-depth", 'q', "QD", 0,
+     "The number of chunks buffered between the pipeline stages "
+     "(default: " xstr(SDR_DEFAULT_QUEUE_DEPTH) ")"},
+    {"hugepages", 'H', 0, 0,
+     "Back the sample buffers with huge pages (if there are any reserved)"},
+    {"mlock", 'K', 0, 0, "Lock the sample buffers in RAM"},
+    {"input", 'i', "FILE", 0,
+     "Read recorded IQ samples from FILE (at the '-r' sample rate) instead "
+     "of the SDR"},
+    {"input-format", 'F', "FMT", 0,
+     "The format of the '-i' file: cf32, cs16, or cu8 (default: cu8)"},
+    {"realtime", 'R', 0, 0,
+     "Pace the '-i' file to its sample rate, instead of processing it as "
+     "fast as possible"},
+    {"audio-out", 'o', "FILE", 0,
+     "Write the audio (raw 32-bit floats, at the channel width rate, e.g. "
+     "12500S/s for PMR446) to FILE instead of the sound card"},
+    {"profile", 'T', 0, 0,
+     "Time the processing stages, the statistics are logged on SIGUSR1 "
+     "and on exit"},
+    {"fill-gaps", 'Z', 0, 0,
+     "Fill the gaps in the SDR timestamps with zeros, so the filters "
+     "stay aligned with the sample clock"},
+    {"record", 'd', "DIR", 0,
+     "Record every transmission to a WAV file in DIR, named after the "
+     "channel, the CTCSS code and the time"},
+    {"preroll", 'D', "MS", 0,
+     "The audio from before the squelch opened included in the '-d' "
+     "recordings and the '-N' streams, in [ms] (default: " xstr(
+         SDR_DEFAULT_PREROLL_MS) "ms)"},
+    {"iq-capture", 'I', "PREFIX", 0,
+     "Write the raw SDR samples to PREFIX-NNNN.sigmf-data files, each one "
+     "with a SigMF metadata file"},
+    {"iq-format", 'X', "FMT", 0,
+     "The format of the '-I' files: cf32, cs16, or cu8 (default: cs16)"},
+    {"iq-rotate-size", 'S', "MB", 0,
+     "Start a new '-I' file after this many [MB] (default: 0 = never)"},
+    {"iq-rotate-time", 'U', "S", 0,
+     "Start a new '-I' file after this many [s] of samples (default: 0 = "
+     "never)"},
+    {"net-stream", 'N', "URL", 0,
+     "Stream the audio of every channel as 16-bit PCM packets, to "
+     "udp://HOST:PORT, or to the clients of tcp://[HOST]:PORT"},
+    {"sample-rate", 'r', "SR", 0,
+     "The SDR (or IQ file) sample rate in [S/s], at least the channel plan "
+     "bandwidth (200000 for PMR446), and 1024000 with an SDR. Integer "
+     "multiples of the bandwidth are decimated without resampling "
+     "(default: " xstr(SDR_DEFAULT_SAMPLERATE) ")"},
+    {"channel-plan", 'c', "PLAN", 0,
+     "The channels to receive: 'pmr446', 'pmr446-8', 'dpmr446', or a "
+     "custom band as START_HZ,WIDTH_HZ,COUNT, e.g. 446.1e6,6250,16 "
+     "(default: '" SDR_DEFAULT_CHANNEL_PLAN "')"},
     {0}};
 
 static struct argp argp = {options, parse_opt, args_doc, doc};
@@ -191,6 +291,7 @@ static void sighandler(int signum) {
   if (signum == SIGPIPE) {
     signal(SIGPIPE, SIG_IGN);
   } else if (signum == SIGUSR1) {
+    dump_profile = true;
     return;
   } else {
     fprintf(stderr, "Signal caught, exiting!\n");
@@ -207,6 +308,24 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       arguments->waterfall = atoll(arg);
       break;
 
+    case 'f':
+      ret = sscanf(arg, "%u", &arguments->waterfall_fps);
+      if ((ret != 1) || (arguments->waterfall_fps == 0)) {
+        LOG(ERROR, "Failed to parse the waterfall frame rate");
+        argp_usage(state);
+      }
+      break;
+
+    case 'W':
+      ret = sscanf(arg, "%u", &arguments->waterfall_bins);
+      if ((ret != 1) || (arguments->waterfall_bins == 0) ||
+          (arguments->waterfall_bins > WATERFALL_MAX_BINS)) {
+        LOG(ERROR, "The waterfall bins per channel have to be 1 to %d",
+            WATERFALL_MAX_BINS);
+        argp_usage(state);
+      }
+      break;
+
     case 's':
       ret = sscanf(arg, "%f", &arguments->squelch_level);
       if (ret != 1) {
@@ -215,6 +334,14 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       break;
 
+    case 'B':
+      ret = sscanf(arg, "%u", &arguments->squelch_block_ms);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the squelch block length");
+        argp_usage(state);
+      }
+      break;
+
     case 'g':
       ret = sscanf(arg, "%f", &arguments->gain);
       if (ret != 1) {
@@ -311,234 +438,430 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
       }
       break;
 
-    case ARGP_KEY_ARG:
-      if (state->arg_num >= 0) argp_usage(state);
+    case 'L':
+      ret = sscanf(arg, "%u", &arguments->audio_latency_ms);
+      if ((ret != 1) || (arguments->audio_latency_ms < 10)) {
+        LOG(ERROR,
+            "Failed to parse the audio latency (should be at least 10ms)");
+        argp_usage(state);
+      }
+      break;
 
-      arguments->args[state->arg_num] = arg;
+    case 'C':
+      ret = sscanf(arg, "%u", &arguments->chunk_ms);
+      if ((ret != 1) || (arguments->chunk_ms < SDR_MIN_CHUNK_MS) ||
+          (arguments->chunk_ms > SDR_MAX_CHUNK_MS)) {
+        LOG(ERROR,
+            "Failed to parse the chunk length (should be "
+            "" xstr(SDR_MIN_CHUNK_MS) "-" xstr(SDR_MAX_CHUNK_MS) "ms)");
+        argp_usage(state);
+      }
       break;
 
-    case ARGP_KEY_END:
-      if (state->arg_num < 0) argp_usage(state);
+    case 'A':
+      ret = sscanf(arg, "%u", &arguments->audio_target_ms);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the audio buffer target");
+        argp_usage(state);
+      }
       break;
 
-    default:
-      return ARGP_ERR_UNKNOWN;
-  }
-  return 0;
-}
+    case 'M':
+      arguments->monitor_all = true;
+      break;
 
-static float average_power(complex float const *data, size_t len) {
-  float a = 0.0;
-  for (int i = 0; i < len; i++) {
-    a += cabsf(data[i]);
-  }
-  return 20 * log10f(a / len);
-}
+    case 'j':
+      ret = sscanf(arg, "%lu", &arguments->num_workers);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the number of workers");
+        argp_usage(state);
+      }
+      break;
 
-static void ctcss_detector_reset(ctcss_detector_t *ctcss) {
-  ctcss->samp_processed = 0;
-  ctcss->max_power = 0.0f;
-  ctcss->max_power_index = 0;
-  ctcss->tone_detected = false;
+    case 'P':
+      arguments->pipeline = true;
+      break;
 
-  for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-    ctcss->power[j] = ctcss->u0[j] = ctcss->u1[j] = 0.0f;
-  }
-}
+    case 'q':
+      ret = sscanf(arg, "%lu", &arguments->queue_depth);
+      if ((ret != 1) || (arguments->queue_depth < 2)) {
+        LOG(ERROR, "Failed to parse the queue depth (should be at least 2)");
+        argp_usage(state);
+      }
+      break;
 
-static ctcss_detector_t *ctcss_detector_create(void) {
-  ctcss_detector_t *self = calloc(1, sizeof(ctcss_detector_t));
-  if (!self) {
-    return NULL;
-  }
+    case 'H':
+      arguments->hugepages = true;
+      break;
 
-  ctcss_detector_reset(self);
+    case 'i':
+      arguments->input = arg;
+      break;
 
-  for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-    self->k[j] = 0.5 + ((double)CTCSS_BLOCK_SIZE * ctcss_freqs[j]) /
-                           (double)AUDIO_SAMPLERATE;
-    self->coef[j] =
-        2.0f * cosf((2.0 * M_PI * ctcss_freqs[j]) / (double)AUDIO_SAMPLERATE);
-  }
-  return self;
-}
+    case 'F':
+      if (!iq_format_parse(arg, &arguments->input_format)) {
+        LOG(ERROR,
+            "Failed to parse the input format (should be 'cf32', 'cs16', or "
+            "'cu8')");
+        argp_usage(state);
+      }
+      break;
 
-static void ctcss_detector_analyze(ctcss_detector_t *ctcss, float const *xs,
-                                   unsigned int nx) {
-  for (unsigned int i = 0; i < nx; i++) {
-    const float in = xs[i];
-    {
-      float t;
+    case 'I':
+      arguments->iq_capture = arg;
+      break;
 
-      for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-        t = ctcss->u0[j];
-        ctcss->u0[j] = in + (ctcss->coef[j] * ctcss->u0[j]) - ctcss->u1[j];
-        ctcss->u1[j] = t;
+    case 'X':
+      if (!iq_format_parse(arg, &arguments->iq_capture_format)) {
+        LOG(ERROR,
+            "Failed to parse the capture format (should be 'cf32', 'cs16', "
+            "or 'cu8')");
+        argp_usage(state);
       }
-    }
-    ctcss->samp_processed += 1;
+      break;
 
-    if (ctcss->samp_processed == CTCSS_BLOCK_SIZE) {
-      for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-        ctcss->power[j] = 0.0f;
+    case 'S':
+      ret = sscanf(arg, "%u", &arguments->iq_rotate_mb);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the capture file size");
+        argp_usage(state);
       }
-      for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-        ctcss->power[j] = (ctcss->u0[j] * ctcss->u0[j]) +
-                          (ctcss->u1[j] * ctcss->u1[j]) -
-                          (ctcss->coef[j] * ctcss->u0[j] * ctcss->u1[j]);
-        ctcss->u0[j] = ctcss->u1[j] = 0.0;
+      break;
+
+    case 'U':
+      ret = sscanf(arg, "%u", &arguments->iq_rotate_s);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the capture file length");
+        argp_usage(state);
       }
-      {
-        float avg_power = 0.0f;
+      break;
 
-        ctcss->max_power = 0.0f;
-        for (int j = 0; j < CTCSS_NUM_FREQS; ++j) {
-          avg_power += ctcss->power[j];
-          if (ctcss->power[j] > ctcss->max_power) {
-            ctcss->max_power = ctcss->power[j];
-            ctcss->max_power_index = j;
-          }
-        }
-        avg_power /= CTCSS_NUM_FREQS;
-        ctcss->tone_detected =
-            (avg_power > 120.0f) && ((ctcss->max_power / avg_power) > 10.0f);
+    case 'R':
+      arguments->realtime = true;
+      break;
+
+    case 'o':
+      arguments->audio_out = arg;
+      break;
+
+    case 'K':
+      arguments->mlock = true;
+      break;
+
+    case 'T':
+      arguments->profile = true;
+      break;
+
+    case 'Z':
+      arguments->fill_gaps = true;
+      break;
+
+    case 'd':
+      arguments->record_dir = arg;
+      break;
+
+    case 'D':
+      ret = sscanf(arg, "%u", &arguments->preroll_ms);
+      if (ret != 1) {
+        LOG(ERROR, "Failed to parse the pre-roll length");
+        argp_usage(state);
       }
-      ctcss->samp_processed = 0;
-    }
-  }
-}
+      break;
+
+    case 'N':
+      arguments->net_stream = arg;
+      break;
+
+    case 'r':
+      // Checked against the channel plan, and the SDR, later on
+      ret = sscanf(arg, "%lf", &arguments->sample_rate);
+      if ((ret != 1) || !(arguments->sample_rate > 0)) {
+        LOG(ERROR, "Failed to parse the sample rate");
+        argp_usage(state);
+      }
+      break;
+
+    case 'c':
+      if (!channel_plan_parse(arg, &arguments->plan)) {
+        LOG(ERROR,
+            "Failed to parse the channel plan (should be a preset, or "
+            "START_HZ,WIDTH_HZ,COUNT with an even COUNT of at most "
+            "%u channels), the presets:",
+            CHANNEL_PLAN_MAX_CHANNELS);
+        channel_plan_list();
+        argp_usage(state);
+      }
+      break;
+
+    case ARGP_KEY_ARG:
+      if (state->arg_num >= 0) argp_usage(state);
+
+      arguments->args[state->arg_num] = arg;
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 0) argp_usage(state);
+      break;
 
-static void ctcss_detector_destroy(ctcss_detector_t **ctcss_p) {
-  log_assert(ctcss_p);
-  if (*ctcss_p) {
-    ctcss_detector_t *ctcss = *ctcss_p;
-    free(ctcss);
-    *ctcss_p = NULL;
+    default:
+      return ARGP_ERR_UNKNOWN;
   }
+  return 0;
 }
 
-static bool init_liquid(proc_chain_t *chain, size_t asgram_len,
-                        size_t resamp_buf_size) {
+static bool init_liquid(proc_chain_t *chain, size_t resamp_buf_size) {
   chain->dcblock = iirfilt_crcf_create_dc_blocker(0.0005f);
   log_assert(chain->dcblock);
 
-  chain->resampler =
-      msresamp_crcf_create(((float)SDR_RESAMPLERATE) / SDR_SAMPLERATE, 60.0f);
-  log_assert(chain->resampler);
-  msresamp_crcf_print(chain->resampler);
+  // Integer ratios avoid the arbitrary rate resampler altogether, unless
+  // the decimator can't keep the band flat (e.g. odd ones, CIC only)
+  const unsigned long bandwidth = channel_plan_bandwidth(&chain->args.plan);
+  const double ratio = chain->sample_rate / bandwidth;
+  const unsigned int factor = (unsigned int)lround(ratio);
+  if (fabs(ratio - factor) < 1e-6) {
+    chain->decimator = decimator_create(factor, 60.0f, chain->input_chunk);
+  }
 
-  chain->nco = nco_crcf_create(LIQUID_VCO);
-  log_assert(chain->nco);
-  float offset =
-      -0.5f * (float)(NUM_CHANNELS - 1) / (float)NUM_CHANNELS * 2 * M_PI;
-  nco_crcf_set_frequency(chain->nco, offset);
+  if (chain->decimator) {
+    decimator_print(chain->decimator);
+  } else {
+    chain->resampler = msresamp_crcf_create(
+        (float)(bandwidth / chain->sample_rate), 60.0f);
+    log_assert(chain->resampler);
+    msresamp_crcf_print(chain->resampler);
+  }
 
-  chain->channelizer =
-      firpfbch_crcf_create_kaiser(LIQUID_ANALYZER, NUM_CHANNELS, 13, 80.0);
+  chain->channelizer = channelizer_create(chain->args.plan.num_channels, 13,
+                                          80.0f, resamp_buf_size);
   log_assert(chain->channelizer);
+  channelizer_print(chain->channelizer);
+  channelizer_set_energy_block(chain->channelizer, chain->squelch_block);
+  log_assert(channelizer_max_energy_blocks(chain->channelizer,
+                                           resamp_buf_size) <=
+             SQUELCH_MAX_BLOCKS);
+
+  return true;
+}
+
+static void destroy_liquid(proc_chain_t *chain) {
+  liquid_error_code err;
 
-  chain->fm_demod = freqdem_create(0.5f);
-  log_assert(chain->fm_demod);
+  rational_resampler_destroy(&chain->audio_src);
+  audio_sync_destroy(&chain->audio_sync);
+  audio_ring_destroy(&chain->audio_buf);
+  channelizer_destroy(&chain->channelizer);
+  if (chain->decimator) {
+    decimator_destroy(&chain->decimator);
+  } else {
+    err = msresamp_crcf_destroy(chain->resampler);
+    log_assert(err == LIQUID_OK);
+  }
+  err = iirfilt_crcf_destroy(chain->dcblock);
+  log_assert(err == LIQUID_OK);
+}
 
-  chain->ctcss_filt =
-      firfilt_rrrf_create((float *)hp_audio_taps, HP_AUDIO_FILT_TAPS);
-  log_assert(chain->ctcss_filt);
+static bool init_channel(proc_chain_t *chain, channel_t *ch, int index,
+                         audio_filters_t const *filters) {
+  const unsigned int rate = chain->args.plan.channel_width_hz;
+  const size_t window = lround(CTCSS_WINDOW_S * rate);
 
-  chain->ctcss_lp_delay = wdelayf_create((HP_AUDIO_FILT_TAPS - 1) / 2);
-  log_assert(chain->ctcss_filt);
+  ch->index = index;
+  ch->open = false;
+  ch->rssi = 0.0f;
+  ch->ctcss_freq = 0.0f;
 
-  chain->ctcss_dcblock = iirfilt_rrrf_create_dc_blocker(0.0005f);
-  log_assert(chain->ctcss_dcblock);
+  ch->fm_demod = freqdem_create(0.5f);
+  log_assert(ch->fm_demod);
 
-  chain->audio_filt =
-      firfilt_rrrf_create((float *)lp_audio_taps, LP_AUDIO_FILT_TAPS);
-  log_assert(chain->audio_filt);
+  ch->ctcss_filt = firfilt_rrrf_create(filters->hp, filters->hp_len);
+  log_assert(ch->ctcss_filt);
 
-#ifdef APP_FIR_DEEMPH
-  chain->deemph = firfilt_rrrf_create((float *)deemph_taps, DEEMPH_FILT_TAPS);
-#else
-  // 50us tau
-  chain->deemph =
-      iirfilt_rrrf_create((float[]){0.507301437230636, 0.507301437230636}, 2,
-                          (float[]){1.0, 0.014602874461272194}, 2);
-#endif
-  log_assert(chain->deemph);
+  ch->ctcss_lp_delay = wdelayf_create((filters->hp_len - 1) / 2);
+  log_assert(ch->ctcss_lp_delay);
 
-  chain->resamp_buf = cbuffercf_create(resamp_buf_size);
-  log_assert(chain->resamp_buf);
+  ch->ctcss_dcblock = iirfilt_rrrf_create_dc_blocker(0.0005f);
+  log_assert(ch->ctcss_dcblock);
 
-  chain->audio_buf = cbufferf_create(AUDIO_SAMPLERATE / 3);
-  log_assert(chain->audio_buf);
+  ch->audio_filt = firfilt_rrrf_create(filters->lp, filters->lp_len);
+  log_assert(ch->audio_filt);
 
-  if (chain->args.waterfall > 0) {
-    chain->asgram = asgramcf_create(asgram_len);
-    log_assert(chain->asgram);
-    asgramcf_set_scale(chain->asgram, -40.0f, 2.0f);
+#ifdef APP_FIR_DEEMPH
+  ch->deemph = firfilt_rrrf_create(filters->deemph, filters->deemph_len);
+#else
+  ch->deemph = iirfilt_rrrf_create(
+      (float *)filters->deemph_b, DEEMPH_IIR_ORDER + 1,
+      (float *)filters->deemph_a, DEEMPH_IIR_ORDER + 1);
+#endif
+  log_assert(ch->deemph);
+
+  ch->ctcss_detector = ctcss_detector_create(
+      rate, window, window / CTCSS_HOPS_PER_WINDOW);
+  log_assert(ch->ctcss_detector);
+
+  ch->ctcss_buf =
+      arena_alloc(chain->arena, chain->chan_buf_size * sizeof(float));
+  ch->audio = arena_alloc(chain->arena, chain->chan_buf_size * sizeof(float));
+  log_assert(ch->ctcss_buf && ch->audio);
+
+  if (chain->preroll_len > 0) {
+    complex float *buf =
+        arena_alloc(chain->arena, chain->preroll_len * sizeof(complex float));
+    ch->preroll_audio = arena_alloc(
+        chain->arena,
+        (chain->preroll_len + chain->chan_buf_size) * sizeof(float));
+    log_assert(buf && ch->preroll_audio);
+    preroll_init(&ch->preroll, buf, chain->preroll_len);
   }
 
   return true;
 }
 
-static void destroy_liquid(proc_chain_t *chain) {
+static void destroy_channel(channel_t *ch) {
   liquid_error_code err;
 
-  if (chain->args.waterfall > 0) {
-    err = asgramcf_destroy(chain->asgram);
-    log_assert(err == LIQUID_OK);
-  }
-
-  err = cbufferf_destroy(chain->audio_buf);
-  log_assert(err == LIQUID_OK);
-  err = cbuffercf_destroy(chain->resamp_buf);
-  log_assert(err == LIQUID_OK);
+  ctcss_detector_destroy(&ch->ctcss_detector);
 #ifdef APP_FIR_DEEMPH
-  err = firfilt_rrrf_destroy(chain->deemph);
+  err = firfilt_rrrf_destroy(ch->deemph);
 #else
-  err = iirfilt_rrrf_destroy(chain->deemph);
+  err = iirfilt_rrrf_destroy(ch->deemph);
 #endif
   log_assert(err == LIQUID_OK);
-  err = firfilt_rrrf_destroy(chain->audio_filt);
-  log_assert(err == LIQUID_OK);
-  err = iirfilt_rrrf_destroy(chain->ctcss_dcblock);
-  log_assert(err == LIQUID_OK);
-  err = wdelayf_destroy(chain->ctcss_lp_delay);
-  log_assert(err == LIQUID_OK);
-  err = firfilt_rrrf_destroy(chain->ctcss_filt);
+  err = firfilt_rrrf_destroy(ch->audio_filt);
   log_assert(err == LIQUID_OK);
-  err = freqdem_destroy(chain->fm_demod);
+  err = iirfilt_rrrf_destroy(ch->ctcss_dcblock);
   log_assert(err == LIQUID_OK);
-  err = firpfbch_crcf_destroy(chain->channelizer);
+  err = wdelayf_destroy(ch->ctcss_lp_delay);
   log_assert(err == LIQUID_OK);
-  err = nco_crcf_destroy(chain->nco);
+  err = firfilt_rrrf_destroy(ch->ctcss_filt);
   log_assert(err == LIQUID_OK);
-  err = msresamp_crcf_destroy(chain->resampler);
-  log_assert(err == LIQUID_OK);
-  err = iirfilt_crcf_destroy(chain->dcblock);
+  err = freqdem_destroy(ch->fm_demod);
   log_assert(err == LIQUID_OK);
 }
 
+static bool init_channels(proc_chain_t *chain) {
+  const unsigned int n = chain->args.plan.num_channels;
+  audio_filters_t filters;
+
+  chain->channels = calloc(n, sizeof(channel_t));
+  log_assert(chain->channels);
+
+  // The filter objects keep copies of the taps
+  bool ret = audio_filters_design(&filters, chain->args.plan.channel_width_hz);
+  log_assert(ret);
+  for (unsigned int i = 0; i < n; i++) {
+    ret = init_channel(chain, &chain->channels[i], i, &filters);
+    log_assert(ret);
+  }
+  audio_filters_free(&filters);
+
+  chain->mix_buf =
+      arena_alloc(chain->arena, chain->chan_buf_size * sizeof(float));
+  log_assert(chain->mix_buf);
+
+  // Only the '-M' mode can have more than one channel open
+  size_t num_workers = 1;
+  if (chain->args.monitor_all) {
+    num_workers = chain->args.num_workers;
+    if (num_workers == 0) {
+      long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+      // In the pipelined mode the other stages have their own cores
+      if (chain->args.pipeline) {
+        ncpu -= PIPELINE_NUM_STAGES - 1;
+      }
+      num_workers = ncpu > 1 ? ncpu : 1;
+    }
+    LOG(INFO, "Using %lu channel demodulator worker(s)", num_workers);
+  }
+  chain->workers = worker_pool_create(num_workers);
+  log_assert(chain->workers);
+
+  return true;
+}
+
+static void destroy_channels(proc_chain_t *chain) {
+  worker_pool_destroy(&chain->workers);
+
+  for (unsigned int i = 0; i < chain->args.plan.num_channels; i++) {
+    destroy_channel(&chain->channels[i]);
+  }
+  free(chain->channels);
+  chain->channels = NULL;
+}
+
+static void channel_open(proc_chain_t *chain, channel_t *ch) {
+  ch->open = true;
+  ch->preroll_pending = chain->preroll_len > 0;
+
+  for (size_t i = 0; i < chain->num_sinks; i++) {
+    channel_sink_t *sink = &chain->sinks[i];
+    if (sink->open) {
+      sink->open(sink->ctx, ch);
+    }
+  }
+}
+
+static void channel_close(proc_chain_t *chain, channel_t *ch) {
+  for (size_t i = 0; i < chain->num_sinks; i++) {
+    channel_sink_t *sink = &chain->sinks[i];
+    if (sink->close) {
+      sink->close(sink->ctx, ch);
+    }
+  }
+
+  ch->open = false;
+  ch->closing = false;
+  ch->ctcss_freq = 0.0;
+  // The next pre-roll starts from where this transmission ended
+  if (chain->preroll_len > 0) {
+    preroll_reset(&ch->preroll, ch->demod_end);
+  }
+  freqdem_reset(ch->fm_demod);
+  ctcss_detector_reset(ch->ctcss_detector);
+}
+
+static void record_open(void *ctx, const channel_t *ch) {
+  recorder_open(ctx, ch->index);
+}
+
+static void record_write(void *ctx, const channel_t *ch, float const *x,
+                         size_t n) {
+  const ctcss_detector_t *det = ch->ctcss_detector;
+  const int code = det->tone_detected ? det->max_power_index + 1 : 0;
+
+  recorder_write(ctx, ch->index, code, x, n);
+}
+
+static void record_close(void *ctx, const channel_t *ch) {
+  recorder_close(ctx, ch->index);
+}
+
+static void stream_open(void *ctx, const channel_t *ch) {
+  net_sink_open(ctx, ch->index);
+}
+
+static void stream_write(void *ctx, const channel_t *ch, float const *x,
+                         size_t n) {
+  const ctcss_detector_t *det = ch->ctcss_detector;
+  const int code = det->tone_detected ? det->max_power_index + 1 : 0;
+
+  net_sink_write(ctx, ch->index, code, x, n);
+}
+
+static void stream_close(void *ctx, const channel_t *ch) {
+  net_sink_close(ctx, ch->index);
+}
+
 static int audio_cb(void *outputBuffer, void *inputBuffer,
                     unsigned int nBufferFrames, double stream_time,
                     rtaudio_stream_status_t status, void *data) {
   float *buffer = (float *)outputBuffer;
-  cbufferf inBuffer = data;
-  unsigned int num_read;
-  float *rp;
+  proc_chain_t *chain = data;
+  uint64_t capture_ns;
 
-  pthread_mutex_lock(&lock);
-  liquid_error_code err =
-      cbufferf_read(inBuffer, nBufferFrames, &rp, &num_read);
-  log_assert(err == LIQUID_OK);
-  for (size_t i = 0; i < nBufferFrames; i++) {
-    if (i < num_read) {
-      buffer[i] = rp[i];
-    } else {
-      buffer[i] = 0.0;
-    }
+  audio_ring_read(chain->audio_buf, buffer, nBufferFrames);
+  if (audio_ring_take_tag(chain->audio_buf, &capture_ns)) {
+    profiler_record(chain->latency.hist, 0, capture_ns, 0);
   }
-  err = cbufferf_release(inBuffer, num_read);
-  log_assert(err == LIQUID_OK);
-  pthread_mutex_unlock(&lock);
 
   return 0;
 }
@@ -547,9 +870,56 @@ static void error_cb(rtaudio_error_t err, const char *msg) {
   LOG(ERROR, "Error type: %d message: %s", err, msg);
 }
 
-static bool init_rtaudio(proc_chain_t *chain) {
-  unsigned int bufferFrames = AUDIO_SAMPLERATE / 10;
+// The sound card runs at its native rate, the audio is brought
+// to it here rather than by the audio server
+static bool init_audio_rate(proc_chain_t *chain, unsigned int rate) {
+  if ((rate == 0) || (rate > AUDIO_MAX_DEVICE_RATE)) {
+    LOG(WARN, "Unusable native audio rate (%u S/s), using %u S/s", rate,
+        AUDIO_DEFAULT_DEVICE_RATE);
+    rate = AUDIO_DEFAULT_DEVICE_RATE;
+  }
+  chain->audio_rate = rate;
+  const unsigned int chan_rate = chain->args.plan.channel_width_hz;
+  const size_t chan_buf_size = chain->chan_buf_size;
+
+  if (rate != chan_rate) {
+    chain->audio_src =
+        rational_resampler_create(chan_rate, rate, 60.0f, chan_buf_size);
+    log_assert(chain->audio_src);
+    rational_resampler_print(chain->audio_src);
+    chain->audio_src_buf = arena_alloc(
+        chain->arena,
+        rational_resampler_max_output(chain->audio_src, chan_buf_size) *
+            sizeof(float));
+    log_assert(chain->audio_src_buf);
+  }
+
+  chain->audio_buf =
+      audio_ring_create(((size_t)rate * chain->args.audio_latency_ms) / 1000);
+  log_assert(chain->audio_buf);
+
+  if (chain->args.audio_target_ms > 0) {
+    const size_t target = ((size_t)rate * chain->args.audio_target_ms) / 1000;
+    const size_t max_block =
+        chain->audio_src
+            ? rational_resampler_max_output(chain->audio_src, chan_buf_size)
+            : chan_buf_size;
+    // Room for the target plus a whole chunk on top of it
+    if (target + max_block > audio_ring_capacity(chain->audio_buf)) {
+      LOG(ERROR,
+          "The audio buffer target (%ums) doesn't fit in the %ums "
+          "audio latency",
+          chain->args.audio_target_ms, chain->args.audio_latency_ms);
+      return false;
+    }
+    chain->audio_sync = audio_sync_create(target, max_block);
+    log_assert(chain->audio_sync);
+  }
+
+  return true;
+}
 
+static bool init_rtaudio(proc_chain_t *chain) {
   chain->dac = rtaudio_create(chain->args.audio_api);
   log_assert(chain->dac);
   const rtaudio_api_t api = rtaudio_current_api(chain->dac);
@@ -566,10 +936,31 @@ static bool init_rtaudio(proc_chain_t *chain) {
   }
 
   const unsigned int def_id = rtaudio_get_default_output_device(chain->dac);
+  unsigned int native_rate = 0;
   for (int i = 0; i < n; i++) {
     unsigned int dev_id = rtaudio_get_device_id(chain->dac, i);
     rtaudio_device_info_t info = rtaudio_get_device_info(chain->dac, dev_id);
     LOG(INFO, "\t\"%s\"%s", info.name, def_id == dev_id ? " (default)" : "");
+    if (def_id == dev_id) {
+      native_rate = info.preferred_sample_rate;
+    }
+  }
+
+  if (!init_audio_rate(chain, native_rate)) {
+    return false;
+  }
+  LOG(INFO, "Audio output rate: %u S/s", chain->audio_rate);
+
+  // At least two callback periods have to fit in the audio buffer
+  unsigned int bufferFrames = chain->audio_rate / 10;
+  if (bufferFrames > audio_ring_capacity(chain->audio_buf) / 2) {
+    bufferFrames = audio_ring_capacity(chain->audio_buf) / 2;
+  }
+  // and with a fill target the callback has to come often enough
+  const unsigned int max_frames =
+      (chain->audio_rate * chain->args.audio_target_ms) / 2000;
+  if (chain->audio_sync && (bufferFrames > max_frames)) {
+    bufferFrames = max_frames;
   }
 
   rtaudio_show_warnings(chain->dac, true);
@@ -581,10 +972,16 @@ static bool init_rtaudio(proc_chain_t *chain) {
                                                RTAUDIO_FLAGS_MINIMIZE_LATENCY |
                                                RTAUDIO_FLAGS_NONINTERLEAVED};
 
+  chain->latency.hist = profiler_create(latency_stage_names, 1);
+  log_assert(chain->latency.hist);
+
   rtaudio_error_t err = rtaudio_open_stream(
-      chain->dac, &o_params, NULL, RTAUDIO_FORMAT_FLOAT32, AUDIO_SAMPLERATE,
-      &bufferFrames, &audio_cb, (void *)chain->audio_buf, &options, &error_cb);
+      chain->dac, &o_params, NULL, RTAUDIO_FORMAT_FLOAT32, chain->audio_rate,
+      &bufferFrames, &audio_cb, (void *)chain, &options, &error_cb);
   log_assert(err == 0);
+  chain->latency.device_frames = rtaudio_get_stream_latency(chain->dac);
+  LOG(INFO, "Audio period: %u samples, output latency: %ld samples",
+      bufferFrames, chain->latency.device_frames);
 
   err = rtaudio_start_stream(chain->dac);
   log_assert(err == 0);
@@ -602,26 +999,29 @@ static void destroy_rtaudio(proc_chain_t *chain) {
   rtaudio_destroy(chain->dac);
 }
 
-void ctcss_execute(proc_chain_t *chain, float *x, unsigned int n) {
-  iirfilt_rrrf_execute_block(chain->ctcss_dcblock, x, n, x);
-  const bool prev_status = chain->ctcss_detector->tone_detected;
-  const int prev_code = chain->ctcss_detector->max_power_index;
+static void ctcss_execute(proc_chain_t *chain, channel_t *ch, float *x,
+                          unsigned int n) {
+  iirfilt_rrrf_execute_block(ch->ctcss_dcblock, x, n, x);
+  const bool prev_status = ch->ctcss_detector->tone_detected;
+  const int prev_code = ch->ctcss_detector->max_power_index;
 
-  ctcss_detector_analyze(chain->ctcss_detector, x, n);
-  chain->ctcss_freq = ctcss_freqs[chain->ctcss_detector->max_power_index];
+  ctcss_detector_analyze(ch->ctcss_detector, x, n);
+  ch->ctcss_freq = ctcss_freqs[ch->ctcss_detector->max_power_index];
 
   if (chain->args.waterfall == 0) {
-    if (chain->ctcss_detector->tone_detected) {
+    if (ch->ctcss_detector->tone_detected) {
       if (!prev_status) {
-        LOG(INFO, "Acquired CTCSS code: %d (frequency: %3.2fHz)",
-            chain->ctcss_detector->max_power_index + 1, chain->ctcss_freq);
-      } else if (prev_code != chain->ctcss_detector->max_power_index) {
-        LOG(INFO, "CTCSS code change: %d (frequency: %3.2fHz)",
-            chain->ctcss_detector->max_power_index + 1, chain->ctcss_freq);
+        LOG(INFO, "Channel %d acquired CTCSS code: %d (frequency: %3.2fHz)",
+            ch->index + 1, ch->ctcss_detector->max_power_index + 1,
+            ch->ctcss_freq);
+      } else if (prev_code != ch->ctcss_detector->max_power_index) {
+        LOG(INFO, "Channel %d CTCSS code change: %d (frequency: %3.2fHz)",
+            ch->index + 1, ch->ctcss_detector->max_power_index + 1,
+            ch->ctcss_freq);
       }
     } else {
       if (prev_status) {
-        LOG(INFO, "Lost CTCSS code");
+        LOG(INFO, "Channel %d lost CTCSS code", ch->index + 1);
       }
     }
   }
@@ -629,12 +1029,13 @@ void ctcss_execute(proc_chain_t *chain, float *x, unsigned int n) {
 
 static void refresh_footer(proc_chain_t *chain, char *const footer,
                            size_t w_len) {
-  float ch_width = (float)w_len / (NUM_CHANNELS);
+  const unsigned int n = chain->args.plan.num_channels;
+  float ch_width = (float)w_len / n;
 
-  for (size_t i = 0; i < NUM_CHANNELS; i++) {
+  for (size_t i = 0; i < n; i++) {
     int pos;
     size_t rpos = roundf((i * ch_width) + (ch_width / 2) + 2);
-    if (chain->active_chan == i) {
+    if (chain->channels[i].open) {
       log_assert(chain->args.channel_mask & (1ULL << i));
       pos = snprintf(&footer[rpos], w_len, "%s", "^^");
     } else {
@@ -647,38 +1048,61 @@ static void refresh_footer(proc_chain_t *chain, char *const footer,
     footer[rpos + pos] = ' ';
   }
 
-  if (chain->active_chan >= 0) {
-    if (chain->ctcss_detector->tone_detected) {
-      const int ctcss_code = chain->ctcss_detector->max_power_index + 1;
+  if (chain->args.monitor_all) {
+    int num_open = 0;
+    for (size_t i = 0; i < n; i++) {
+      num_open += chain->channels[i].open;
+    }
+    snprintf(&footer[w_len + 6], w_len + FOOTER_TAIL_LEN,
+             "%8.3f MHz [%d open]", chain->args.frequency * 1e-6f, num_open);
+  } else if (chain->active_chan >= 0) {
+    const channel_t *ch = &chain->channels[chain->active_chan];
+    if (ch->ctcss_detector->tone_detected) {
+      const int ctcss_code = ch->ctcss_detector->max_power_index + 1;
       snprintf(&footer[w_len + 6], w_len + FOOTER_TAIL_LEN,
                "%8.3f MHz [%d]  [CTCSS:  %02d (%3.2fHz)]",
-               SDR_FREQUENCY * 1e-6f, chain->active_chan + 1, ctcss_code,
-               chain->ctcss_freq);
+               chain->args.frequency * 1e-6f, chain->active_chan + 1,
+               ctcss_code, ch->ctcss_freq);
 
     } else {
       snprintf(&footer[w_len + 6], w_len + FOOTER_TAIL_LEN, "%8.3f MHz [%d]",
-               SDR_FREQUENCY * 1e-6f, chain->active_chan + 1);
+               chain->args.frequency * 1e-6f, chain->active_chan + 1);
     }
   } else {
     snprintf(&footer[w_len + 6], w_len + FOOTER_TAIL_LEN, "%8.3f MHz",
-             SDR_FREQUENCY * 1e-6f);
+             chain->args.frequency * 1e-6f);
   }
 }
 
-static int find_max_rssi_channel(proc_chain_t *chain, ch_buff_mat_t *chan_bufs,
-                                 size_t ns, float *max_rssi) {
-  int max_i = -1;
-  float rssi_max = 0.0f;
+// `energy` of each channel over a block of `ns` samples
+static float measure_channels(proc_chain_t *chain, float const *energy,
+                              size_t ns, float *power) {
   float rssi_avg = 0.0f;
   int ch_en = 0;
 
-  for (size_t i = 0; i < NUM_CHANNELS; i++) {
+  for (size_t i = 0; i < chain->args.plan.num_channels; i++) {
     // Only take into consideration the channels
     // enabled in mask
     if (chain->args.channel_mask & (1ULL << i)) {
       ++ch_en;
-      float rssi = average_power((*chan_bufs)[i], ns);
-      rssi_avg += rssi;
+      power[i] = 10 * log10f(energy[i] / ns);
+      rssi_avg += power[i];
+    }
+  }
+
+  return ch_en > 0 ? rssi_avg / ch_en : 0.0f;
+}
+
+static int find_max_rssi_channel(proc_chain_t *chain, float const *energy,
+                                 size_t ns, float *max_rssi) {
+  int max_i = -1;
+  float rssi_max = 0.0f;
+  float power[MAX_CHANNELS];
+  float rssi_avg = measure_channels(chain, energy, ns, power);
+
+  for (size_t i = 0; i < chain->args.plan.num_channels; i++) {
+    if (chain->args.channel_mask & (1ULL << i)) {
+      float rssi = power[i];
       if (max_i >= 0) {
         if (rssi > rssi_max) {
           rssi_max = rssi;
@@ -692,250 +1116,1270 @@ static int find_max_rssi_channel(proc_chain_t *chain, ch_buff_mat_t *chan_bufs,
   }
 
   if (max_i >= 0) {
-    rssi_avg /= ch_en;
     *max_rssi = rssi_max - rssi_avg;
   }
 
   return max_i;
 }
 
-int main(int argc, char *argv[]) {
-  bool ret;
-  struct sigaction sigact;
+// Counts the overflows and the discontinuities of the SDR timestamps.
+// Returns the number of zeros to insert before the chunk just read.
+static size_t track_stream(proc_chain_t *chain, int read, int flags,
+                           long long time_ns) {
+  sample_loss_t *loss = &chain->loss;
+  const bool quiet = chain->args.waterfall > 0;
+  size_t fill = 0;
+
+  if (read < 0) {
+    if (read == SOAPY_SDR_OVERFLOW) {
+      __atomic_fetch_add(&loss->overflows, 1, __ATOMIC_RELAXED);
+      if (!quiet) {
+        LOG(WARN, "SDR overflow, samples lost");
+      }
+    } else {
+      __atomic_fetch_add(&loss->errors, 1, __ATOMIC_RELAXED);
+      LOG(ERROR, "Reading stream failed with error code: %d", read);
+    }
+    return 0;
+  }
 
-  int read, flags;
-  long long timeNs;
-  unsigned int ny;
-  proc_chain_t *chain = &g_chain;
+  if (!(flags & SOAPY_SDR_HAS_TIME)) {
+    return 0;
+  }
 
-  logging_init();
+  if (loss->has_time) {
+    const long long missing =
+        llround((time_ns - loss->next_time_ns) * chain->sample_rate * 1e-9);
+    if (missing > 0) {
+      __atomic_fetch_add(&loss->gaps, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&loss->gap_samples, missing, __ATOMIC_RELAXED);
+      if (!quiet) {
+        LOG(WARN, "Gap of %lld samples in the SDR stream", missing);
+      }
+      if (chain->args.fill_gaps) {
+        if (missing <= (SDR_MAX_GAP_FILL_S * chain->sample_rate)) {
+          fill = missing;
+        } else if (!quiet) {
+          LOG(WARN, "The gap is too long to be filled");
+        }
+      }
+    } else if (missing < 0) {
+      LOG(DEBUG, "SDR timestamp went back by %lld samples", -missing);
+    }
+  }
+  loss->has_time = true;
+  loss->next_time_ns = time_ns + llround(read * 1e9 / chain->sample_rate);
 
-  argp_parse(&argp, argc, argv, 0, 0, &chain->args);
+  return fill;
+}
 
-  LOG(INFO,
-      "gain: %5.2f dB, audio_gain: %5.2f, relative squelch level: %5.2f dB, "
-      "waterfall: "
-      "%ld",
-      chain->args.gain, chain->args.audio_gain, chain->args.squelch_level,
-      chain->args.waterfall);
+static uint64_t host_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
 
-  LOG(INFO, "audio lowpass: %s, channel mask: 0x%04lX",
-      chain->args.lowpass ? "enabled" : "disabled", chain->args.channel_mask);
+// Host clock time the first of the `read` samples just read was taken
+// at. The SDR timestamps are mapped to the host clock by the smallest
+// offset seen between the two, i.e. of the read that returned the soonest
+// after its samples were taken, let to grow slowly to follow the drift.
+// Without timestamps the samples are taken to have just arrived.
+static uint64_t capture_time(proc_chain_t *chain, int read, int flags,
+                             long long time_ns) {
+  latency_t *lat = &chain->latency;
+  const long long now = host_time_ns();
+  const long long duration = llround(read * 1e9 / chain->sample_rate);
+
+  if (!(flags & SOAPY_SDR_HAS_TIME)) {
+    return now - duration;
+  }
 
-  if (chain->args.channel_mask == 0) {
-    LOG(ERROR, "No channels enabled in channel mask !");
-    exit(EXIT_FAILURE);
+  const long long offset = now - (time_ns + duration);
+  if (lat->has_offset) {
+    lat->offset_ns += llround(duration * LATENCY_MAX_DRIFT);
+  }
+  if (!lat->has_offset || (offset < lat->offset_ns)) {
+    lat->offset_ns = offset;
+    lat->has_offset = true;
   }
 
-  size_t res_size = (size_t)ceilf(
-      1 + 2 * SDR_INPUT_CHUNK * ((float)SDR_RESAMPLERATE / SDR_SAMPLERATE));
-  size_t chan_size = (size_t)ceilf(res_size / NUM_CHANNELS);
-  LOG(INFO, "SDR_RESAMP_BUF_SIZE=%ld, SDR_CHANNEL_BUF_SIZE=%ld", res_size,
-      chan_size);
-  log_assert(res_size == SDR_RESAMP_BUF_SIZE);
-  log_assert(chan_size == SDR_CHANNEL_BUF_SIZE);
+  return time_ns + lat->offset_ns;
+}
 
-  complex float buffp[SDR_INPUT_CHUNK];
-  complex float resamp_buf[SDR_RESAMP_BUF_SIZE];
-  complex float tmp_chan_buf_out[NUM_CHANNELS];
+// `fill` is set to the number of samples missing before
+// this chunk, to be replaced with zeros
+static int proc_capture(proc_chain_t *chain, complex float *buffp, int *flags,
+                        long long *timeNs, uint64_t *capture_ns,
+                        size_t *fill) {
   void *buffs[] = {buffp};
+  // Room for a whole chunk to arrive, and then some
+  const long timeout_us = 100000 + (2000L * chain->args.chunk_ms);
+  const uint64_t t = profiler_start(chain->profiler);
+  int n;
+
+  if (chain->iq_src) {
+    *flags = 0;
+    n = iq_source_read(chain->iq_src, buffp, chain->input_chunk, timeNs);
+    // The end of a recording ends the run just like a signal
+    if (n == 0) {
+      exit_via_sig = true;
+    }
+  } else {
+    n = SoapySDRDevice_readStream(chain->sdr, chain->rxStream, buffs,
+                                  chain->input_chunk, flags, timeNs,
+                                  timeout_us);
+  }
+  const uint64_t lost = __atomic_load_n(&chain->loss.overflows,
+                                        __ATOMIC_RELAXED) +
+                        __atomic_load_n(&chain->loss.gaps, __ATOMIC_RELAXED);
+  *fill = chain->iq_src ? 0 : track_stream(chain, n, *flags, *timeNs);
+  *capture_ns = n > 0 ? capture_time(chain, n, *flags, *timeNs) : 0;
+
+  // Raw, before the front-end modifies the samples in place
+  if (chain->iq_writer) {
+    if ((__atomic_load_n(&chain->loss.overflows, __ATOMIC_RELAXED) +
+         __atomic_load_n(&chain->loss.gaps, __ATOMIC_RELAXED)) != lost) {
+      iq_writer_discontinuity(chain->iq_writer);
+    }
+    if (n > 0) {
+      iq_writer_write(chain->iq_writer, buffp, n);
+    }
+  }
+
+  profiler_record(chain->profiler, PROF_CAPTURE, t, n > 0 ? n : 0);
+  return n;
+}
 
-  ch_buff_mat_t chan_bufs;
-  float tmp_buf1[SDR_CHANNEL_BUF_SIZE];
-  float tmp_buf2[SDR_CHANNEL_BUF_SIZE];
+static unsigned int proc_frontend(proc_chain_t *chain, complex float *buffp,
+                                  size_t n, complex float *resamp_buf) {
+  unsigned int ny;
+  uint64_t t = profiler_start(chain->profiler);
 
-  // assemble footer
-  unsigned int footer_len = chain->args.waterfall + FOOTER_TAIL_LEN;
-  char footer[footer_len + 1];
+  iirfilt_crcf_execute_block(chain->dcblock, buffp, n, buffp);
+  profiler_record(chain->profiler, PROF_DCBLOCK, t, n);
 
-  if (chain->args.waterfall > 0) {
-    for (size_t i = 0; i < footer_len; i++) footer[i] = ' ';
-    footer[1] = '[';
-    footer[chain->args.waterfall + 4] = ']';
-    refresh_footer(chain, footer, chain->args.waterfall);
+  t = profiler_start(chain->profiler);
+  if (chain->decimator) {
+    ny = decimator_execute(chain->decimator, buffp, n, resamp_buf);
+  } else {
+    msresamp_crcf_execute(chain->resampler, buffp, n, resamp_buf, &ny);
   }
+  profiler_record(chain->profiler, PROF_RESAMPLER, t, n);
 
-  float maxval;
-  float maxfreq;
-  char ascii[chain->args.waterfall + 1];
-  ascii[chain->args.waterfall] = '\0';
-
-  read = pthread_mutex_init(&lock, NULL);
-  log_assert(read == 0);
+  return ny;
+}
 
-  ret = init_liquid(chain, chain->args.waterfall, SDR_RESAMP_BUF_SIZE);
-  log_assert(ret);
+static size_t proc_channelize(proc_chain_t *chain, complex float *resamp_buf,
+                              unsigned int ny, uint64_t capture_ns,
+                              ch_buff_mat_t *chan_bufs) {
+  const uint64_t t = profiler_start(chain->profiler);
+  chan_bufs->capture_ns = capture_ns;
+  channelizer_energy_t stats = {.energy = chan_bufs->energy,
+                                .end = chan_bufs->block_end,
+                                .max_blocks = SQUELCH_MAX_BLOCKS};
+  size_t ns =
+      channelizer_execute(chain->channelizer, resamp_buf, ny,
+                          chan_bufs->samples, chain->chan_buf_size, &stats);
+  log_assert(ns <= chain->chan_buf_size);
+  chan_bufs->num_blocks = stats.num_blocks;
+  profiler_record(chain->profiler, PROF_CHANNELIZER, t, ny);
+
+  return ns;
+}
 
-  ret = init_soapy(chain);
-  if (!ret) {
-    exit(EXIT_FAILURE);
+// Opens the channel from sample `at` of the chunk on. Reopening one
+// closed earlier in the same chunk just keeps it open.
+static void squelch_open(proc_chain_t *chain, channel_t *ch, size_t at,
+                         size_t ns) {
+  if (ch->closing) {
+    ch->closing = false;
+  } else {
+    ch->demod_start = at;
+    channel_open(chain, ch);
   }
+  ch->demod_end = ns;
+}
 
-  ret = init_rtaudio(chain);
-  log_assert(ret);
-
-  chain->ctcss_detector = ctcss_detector_create();
+// The channel is demodulated up to sample `at` and closed after that
+static void squelch_close(channel_t *ch, size_t at) {
+  ch->closing = true;
+  ch->demod_end = at;
+}
 
-  sigact.sa_handler = sighandler;
-  sigemptyset(&sigact.sa_mask);
-  sigact.sa_flags = 0;
-  sigaction(SIGINT, &sigact, NULL);
-  sigaction(SIGTERM, &sigact, NULL);
-  sigaction(SIGQUIT, &sigact, NULL);
-  sigaction(SIGPIPE, &sigact, NULL);
-  sigaction(SIGUSR1, &sigact, NULL);
+// Every enabled channel has a squelch of its own, relative
+// to the average level of all the enabled channels
+static void proc_scan_all(proc_chain_t *chain, float const *energy,
+                          size_t len, size_t at, size_t ns) {
+  float power[MAX_CHANNELS];
+  float rssi_avg = measure_channels(chain, energy, len, power);
 
-  while (!exit_via_sig) {
-    read = SoapySDRDevice_readStream(chain->sdr, chain->rxStream, buffs,
-                                     SDR_INPUT_CHUNK, &flags, &timeNs, 200000);
-    if (read < 0) {
-      LOG(ERROR, "Reading stream failed with error code: %d", read);
+  chain->rssi = 0.0f;
+  for (size_t i = 0; i < chain->args.plan.num_channels; i++) {
+    if (!(chain->args.channel_mask & (1ULL << i))) {
       continue;
     }
-    iirfilt_crcf_execute_block(chain->dcblock, buffp, read, buffp);
-    msresamp_crcf_execute(chain->resampler, buffp, read, resamp_buf, &ny);
-    liquid_error_code err = cbuffercf_write(chain->resamp_buf, resamp_buf, ny);
-    log_assert(err == LIQUID_OK);
-
-    size_t ns = 0;
-    unsigned int num_read;
-    complex float *rpc;
 
-    while (cbuffercf_size(chain->resamp_buf) >= NUM_CHANNELS) {
-      cbuffercf_read(chain->resamp_buf, NUM_CHANNELS, &rpc, &num_read);
-      log_assert(num_read == NUM_CHANNELS);
+    channel_t *ch = &chain->channels[i];
+    const bool open = ch->open && !ch->closing;
+    ch->rssi = power[i] - rssi_avg;
+    if (ch->rssi > chain->rssi) {
+      chain->rssi = ch->rssi;
+    }
 
-      for (int i = 0; i < NUM_CHANNELS; i++) {
-        complex float *x = &rpc[i];
-        nco_crcf_mix_down(chain->nco, *x, x);
-        nco_crcf_step(chain->nco);
+    if (!open && (ch->rssi > chain->args.squelch_level)) {
+      if (chain->args.waterfall == 0) {
+        LOG(INFO, "Opened channel %d (RSSI: %4.2fdB)", ch->index + 1,
+            ch->rssi);
       }
-
-      firpfbch_crcf_analyzer_execute(chain->channelizer, rpc, tmp_chan_buf_out);
-      err = cbuffercf_release(chain->resamp_buf, num_read);
-      log_assert(err == LIQUID_OK);
-
-      // transpose channels
-      for (size_t i = 0; i < NUM_CHANNELS; i++) {
-        chan_bufs[i][ns] = tmp_chan_buf_out[i];
+      squelch_open(chain, ch, at, ns);
+    } else if (open && (ch->rssi < (chain->args.squelch_level - 5.0))) {
+      if (chain->args.waterfall == 0) {
+        LOG(INFO, "Closed channel %d", ch->index + 1);
       }
-      ns++;
+      squelch_close(ch, at);
     }
+  }
+}
 
-    log_assert(ns <= SDR_CHANNEL_BUF_SIZE);
-
-    // Update chain state
-    switch (chain->state) {
-      case proc_scanning: {
-        float max_rssi;
-        int max_ch = find_max_rssi_channel(chain, &chan_bufs, ns, &max_rssi);
+// Follows the strongest of the enabled channels
+static void proc_scan_single(proc_chain_t *chain, float const *energy,
+                             size_t len, size_t at, size_t ns) {
+  switch (chain->state) {
+    case proc_scanning: {
+      float max_rssi = 0.0f;
+      int max_ch = find_max_rssi_channel(chain, energy, len, &max_rssi);
+
+      chain->rssi = max_rssi;
+      if (chain->rssi > chain->args.squelch_level) {
+        chain->active_chan = max_ch;
+        chain->state = proc_tuned;
+        squelch_open(chain, &chain->channels[max_ch], at, ns);
+        if (chain->args.waterfall == 0) {
+          LOG(INFO, "Tuned to channel %d (RSSI: %4.2fdB)",
+              chain->active_chan + 1, chain->rssi);
+        }
+      }
+    } break;
 
+    case proc_tuned: {
+      float max_rssi = 0.0f;
+      int max_ch = find_max_rssi_channel(chain, energy, len, &max_rssi);
+      chain->rssi = max_rssi;
+      if (chain->args.lock_mode == lock_mode_max) {
         chain->rssi = max_rssi;
-        if (chain->rssi > chain->args.squelch_level) {
-          chain->active_chan = max_ch;
-          chain->state = proc_tuned;
+        if (chain->active_chan != max_ch) {
           if (chain->args.waterfall == 0) {
-            LOG(INFO, "Tuned to channel %d (RSSI: %4.2fdB)",
-                chain->active_chan + 1, chain->rssi);
+            LOG(INFO, "Changed active channel from %d to %d",
+                chain->active_chan + 1, max_ch + 1);
           }
+          squelch_close(&chain->channels[chain->active_chan], at);
+          chain->active_chan = max_ch;
+          squelch_open(chain, &chain->channels[max_ch], at, ns);
         }
-      } break;
+      }
 
-      case proc_tuned: {
-        float max_rssi;
-        int max_ch = find_max_rssi_channel(chain, &chan_bufs, ns, &max_rssi);
-        chain->rssi = max_rssi;
-        if (chain->args.lock_mode == lock_mode_max) {
-          chain->rssi = max_rssi;
-          if (chain->active_chan != max_ch) {
-            if (chain->args.waterfall == 0) {
-              LOG(INFO, "Changed active channel from %d to %d",
-                  chain->active_chan + 1, max_ch + 1);
-            }
-            chain->active_chan = max_ch;
-          }
+      if (chain->rssi < (chain->args.squelch_level - 5.0)) {
+        if (chain->args.waterfall == 0) {
+          LOG(INFO, "Detuned from channel %d", chain->active_chan + 1);
         }
+        squelch_close(&chain->channels[chain->active_chan], at);
+        chain->active_chan = -1;
+        chain->state = proc_scanning;
+      }
+    } break;
 
-        if (chain->rssi < (chain->args.squelch_level - 5.0)) {
-          if (chain->args.waterfall == 0) {
-            LOG(INFO, "Detuned from channel %d", chain->active_chan + 1);
-          }
-          chain->active_chan = -1;
-          chain->state = proc_scanning;
-          chain->ctcss_freq = 0.0;
-          freqdem_reset(chain->fm_demod);
-          ctcss_detector_reset(chain->ctcss_detector);
-        }
-      } break;
+    default:
+      log_assert(0);
+      break;
+  }
+}
 
-      default:
-        log_assert(0);
-        break;
+// The squelch decides once per block, so a channel opening in the
+// middle of a chunk gets demodulated from the block it opened in
+static void proc_scan(proc_chain_t *chain, ch_buff_mat_t *chan_bufs,
+                      size_t ns) {
+  const uint64_t t = profiler_start(chain->profiler);
+  const unsigned int n = chain->args.plan.num_channels;
+
+  // The open channels carry on from the previous chunk
+  for (unsigned int i = 0; i < n; i++) {
+    channel_t *ch = &chain->channels[i];
+    if (ch->open) {
+      ch->demod_start = 0;
+      ch->demod_end = ns;
     }
+  }
 
-    for (size_t i = 0; i < NUM_CHANNELS; i++) {
-      if (chain->active_chan == i) {
-        float tmp;
-        liquid_error_code err;
+  for (size_t b = 0; b < chan_bufs->num_blocks; b++) {
+    // The first block can have started in the previous chunk
+    const size_t len = chain->squelch_block > 0 ? chain->squelch_block : ns;
+    const size_t end = chan_bufs->block_end[b];
+    const size_t at = end > len ? end - len : 0;
+    float const *energy = &chan_bufs->energy[b * n];
 
-        freqdem_demodulate_block(chain->fm_demod, chan_bufs[i], ns, tmp_buf1);
-        firfilt_rrrf_execute_block(chain->ctcss_filt, tmp_buf1, ns, tmp_buf2);
+    if (chain->args.monitor_all) {
+      proc_scan_all(chain, energy, len, at, ns);
+    } else {
+      proc_scan_single(chain, energy, len, at, ns);
+    }
+  }
 
-        for (size_t k = 0; k < ns; k++) {
-          err = wdelayf_push(chain->ctcss_lp_delay, tmp_buf1[k]);
-          log_assert(err == LIQUID_OK);
-          err = wdelayf_read(chain->ctcss_lp_delay, &tmp);
-          log_assert(err == LIQUID_OK);
-          tmp_buf1[k] = tmp - tmp_buf2[k];
-          tmp_buf2[k] *= chain->args.audio_gain;
-        }
+  profiler_record(chain->profiler, PROF_SQUELCH, t, n * ns);
+}
+
+static void channel_demod(proc_chain_t *chain, channel_t *ch,
+                          complex float *x, size_t ns) {
+  float tmp;
+  liquid_error_code err;
+  float *tmp_buf1 = ch->ctcss_buf;
+  float *tmp_buf2 = ch->audio;
+
+  freqdem_demodulate_block(ch->fm_demod, x, ns, tmp_buf1);
+  firfilt_rrrf_execute_block(ch->ctcss_filt, tmp_buf1, ns, tmp_buf2);
+
+  for (size_t k = 0; k < ns; k++) {
+    err = wdelayf_push(ch->ctcss_lp_delay, tmp_buf1[k]);
+    log_assert(err == LIQUID_OK);
+    err = wdelayf_read(ch->ctcss_lp_delay, &tmp);
+    log_assert(err == LIQUID_OK);
+    tmp_buf1[k] = tmp - tmp_buf2[k];
+    tmp_buf2[k] *= chain->args.audio_gain;
+  }
 
-        ctcss_execute(chain, tmp_buf1, ns);
+  ctcss_execute(chain, ch, tmp_buf1, ns);
 
 #ifdef APP_FIR_DEEMPH
-        firfilt_rrrf_execute_block(chain->deemph, tmp_buf2, ns, tmp_buf2);
+  firfilt_rrrf_execute_block(ch->deemph, tmp_buf2, ns, tmp_buf2);
 #else
-        iirfilt_rrrf_execute_block(chain->deemph, tmp_buf2, ns, tmp_buf2);
+  iirfilt_rrrf_execute_block(ch->deemph, tmp_buf2, ns, tmp_buf2);
 #endif
-        if (chain->args.lowpass) {
-          firfilt_rrrf_execute_block(chain->audio_filt, tmp_buf2, ns, tmp_buf2);
-        }
-        pthread_mutex_lock(&lock);
-        err = cbufferf_write(chain->audio_buf, tmp_buf2, ns);
-        log_assert(err == LIQUID_OK);
-        pthread_mutex_unlock(&lock);
+  if (chain->args.lowpass) {
+    firfilt_rrrf_execute_block(ch->audio_filt, tmp_buf2, ns, tmp_buf2);
+  }
+}
+
+static void preroll_demod(proc_chain_t *chain, channel_t *ch,
+                          complex float *x, size_t ns) {
+  if (ns > 0) {
+    channel_demod(chain, ch, x, ns);
+    memcpy(&ch->preroll_audio[ch->preroll_audio_len], ch->audio,
+           ns * sizeof(float));
+    ch->preroll_audio_len += ns;
+  }
+}
+
+// The samples from before the squelch opened, up to the start of the
+// demodulated part of the chunk `x`, are demodulated for the sinks only.
+// The live audio doesn't get delayed, and the demodulator and the CTCSS
+// detector are already warmed up by the time it starts.
+static void channel_preroll(proc_chain_t *chain, channel_t *ch,
+                            complex float *x) {
+  complex float *part[2];
+  size_t part_len[2];
+  const size_t num_parts = preroll_get(&ch->preroll, part, part_len);
+
+  ch->preroll_audio_len = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    for (size_t j = 0; j < part_len[i]; j += chain->chan_buf_size) {
+      const size_t n = part_len[i] - j < chain->chan_buf_size
+                           ? part_len[i] - j
+                           : chain->chan_buf_size;
+      preroll_demod(chain, ch, &part[i][j], n);
+    }
+  }
+  preroll_demod(chain, ch, x, ch->demod_start);
+}
+
+// Keeps the last samples of the closed channels
+static void proc_preroll(proc_chain_t *chain, ch_buff_mat_t *chan_bufs,
+                         size_t ns) {
+  if (chain->preroll_len == 0) {
+    return;
+  }
+
+  for (unsigned int i = 0; i < chain->args.plan.num_channels; i++) {
+    channel_t *ch = &chain->channels[i];
+    if (!ch->open && (chain->args.channel_mask & (1ULL << i))) {
+      preroll_push(&ch->preroll, chan_samples(chain, chan_bufs, ch), ns);
+    }
+  }
+}
+
+typedef struct {
+  proc_chain_t *chain;
+  ch_buff_mat_t *chan_bufs;
+  size_t ns;
+  channel_t *open[MAX_CHANNELS];
+} demod_job_t;
+
+static void demod_job_execute(void *ctx, size_t item) {
+  demod_job_t *job = ctx;
+  channel_t *ch = job->open[item];
+  complex float *x = chan_samples(job->chain, job->chan_bufs, ch);
+
+  if (ch->preroll_pending) {
+    channel_preroll(job->chain, ch, x);
+  }
+
+  channel_demod(job->chain, ch, &x[ch->demod_start],
+                ch->demod_end - ch->demod_start);
+}
+
+// Raw float samples to a file, the sound card, or nowhere at all
+// (when processing a recording without an audio output file)
+static void proc_audio_out(proc_chain_t *chain, float const *x, size_t ns,
+                           uint64_t capture_ns) {
+  const uint64_t t = profiler_start(chain->profiler);
+
+  if (chain->audio_out) {
+    size_t written = fwrite(x, sizeof(float), ns, chain->audio_out);
+    if (written != ns) {
+      LOG(ERROR, "Failed to write the audio output file");
+    }
+  } else if (chain->dac) {
+    // To the sound card's rate first, in one batch per chunk
+    if (chain->audio_src) {
+      const uint64_t t_src = profiler_start(chain->profiler);
+      const size_t n = rational_resampler_execute(chain->audio_src, x, ns,
+                                                  chain->audio_src_buf);
+      profiler_record(chain->profiler, PROF_AUDIO_SRC, t_src, ns);
+      x = chain->audio_src_buf;
+      ns = n;
+    }
+
+    // Timed by the audio callback. A drained buffer is refilled with
+    // silence first, so it's left out, the next chunk gets the tag.
+    if ((capture_ns > 0) && (audio_ring_size(chain->audio_buf) > 0)) {
+      audio_ring_tag(chain->audio_buf, capture_ns);
+    }
+
+    if (chain->audio_sync) {
+      audio_sync_write(chain->audio_sync, chain->audio_buf, x, ns);
+    } else {
+      audio_ring_write(chain->audio_buf, x, ns);
+    }
+  }
+
+  profiler_record(chain->profiler, PROF_AUDIO, t, ns);
+}
+
+static void proc_demod(proc_chain_t *chain, ch_buff_mat_t *chan_bufs,
+                       size_t ns) {
+  size_t num_open = 0;
+  demod_job_t job = {.chain = chain, .chan_bufs = chan_bufs, .ns = ns};
+
+  // Only the open channels cost anything
+  for (size_t i = 0; i < chain->args.plan.num_channels; i++) {
+    if (chain->channels[i].open) {
+      job.open[num_open++] = &chain->channels[i];
+    }
+  }
+
+  if (num_open == 0) {
+    // Silence keeps a recording continuous, and the audio buffer at its
+    // fill, so only a genuine shortfall counts as an underrun
+    memset(chain->mix_buf, 0, ns * sizeof(float));
+    proc_audio_out(chain, chain->mix_buf, ns, chan_bufs->capture_ns);
+    return;
+  }
+
+  const uint64_t t = profiler_start(chain->profiler);
+  worker_pool_run(chain->workers, demod_job_execute, &job, num_open);
+
+  // Only a part of the chunk, for the channels opened
+  // or closed by the squelch in the middle of it
+  size_t demod_samples = 0;
+  memset(chain->mix_buf, 0, ns * sizeof(float));
+  for (size_t i = 0; i < num_open; i++) {
+    channel_t *ch = job.open[i];
+    const size_t n = ch->demod_end - ch->demod_start;
+    float *mix = &chain->mix_buf[ch->demod_start];
+
+    for (size_t j = 0; j < chain->num_sinks; j++) {
+      channel_sink_t *sink = &chain->sinks[j];
+      if (sink->write && ch->preroll_pending &&
+          (ch->preroll_audio_len > 0)) {
+        sink->write(sink->ctx, ch, ch->preroll_audio, ch->preroll_audio_len);
       }
+      if (sink->write && (n > 0)) {
+        sink->write(sink->ctx, ch, ch->audio, n);
+      }
+    }
+    ch->preroll_pending = false;
+
+    for (size_t k = 0; k < n; k++) {
+      mix[k] += ch->audio[k];
+    }
+    demod_samples += n;
+
+    if (ch->closing) {
+      channel_close(chain, ch);
     }
+  }
+  profiler_record(chain->profiler, PROF_DEMOD, t, demod_samples);
+
+  proc_audio_out(chain, chain->mix_buf, ns, chan_bufs->capture_ns);
+}
 
-    if (chain->args.waterfall > 0) {
-      asgramcf_write(chain->asgram, resamp_buf, ny);
-      asgramcf_execute(chain->asgram, ascii, &maxval, &maxfreq);
+// The spectrum and the terminal output are left to the waterfall
+// thread, only the samples of the chunk (or the channel energies
+// of the channelizer) are copied over here
+static void proc_waterfall(proc_chain_t *chain,
+                           complex float const *resamp_buf, unsigned int ny,
+                           ch_buff_mat_t *chan_bufs, size_t ns, char *footer) {
+  const unsigned int n = chain->args.plan.num_channels;
 
-      printf(" > %s < pk%5.1fdB [%5.2f] [max SNR: %5.1fdB]        \n", ascii,
-             maxval, maxfreq, chain->rssi);
-      refresh_footer(chain, footer, chain->args.waterfall);
-      printf("%s\r", footer);
-      fflush(stdout);
+  // No squelch block completed, nothing to show
+  if ((chain->args.waterfall_bins == 1) && (chan_bufs->num_blocks == 0)) {
+    return;
+  }
+  if (!waterfall_frame_due(chain->waterfall)) {
+    return;
+  }
+
+  const uint64_t t = profiler_start(chain->profiler);
+  refresh_footer(chain, footer, chain->args.waterfall);
+  if (chain->args.waterfall_bins > 0) {
+    float power[MAX_CHANNELS] = {0};
+    for (size_t b = 0; b < chan_bufs->num_blocks; b++) {
+      for (size_t k = 0; k < n; k++) {
+        power[k] += chan_bufs->energy[(b * n) + k];
+      }
     }
+    waterfall_submit_channels(chain->waterfall, power, chan_bufs->samples,
+                              chain->chan_buf_size, ns, chain->rssi, footer);
+  } else {
+    waterfall_submit(chain->waterfall, resamp_buf, ny, chain->rssi, footer);
+  }
+  profiler_record(chain->profiler, PROF_WATERFALL, t, ny);
+}
+
+static void log_audio_buf_usage(proc_chain_t *chain) {
 #ifndef NDEBUG
+  if ((chain->args.waterfall == 0) && chain->audio_buf) {
+    size_t s = audio_ring_size(chain->audio_buf);
+    if (s > 0) {
+      LOG(DEBUG, "%lu samples in audio buffer (%3.1f%% used)", s,
+          100 * (float)s / audio_ring_capacity(chain->audio_buf));
+    }
+  }
+#endif
+}
+
+static void report_latency(proc_chain_t *chain) {
+  profiler_stats_t st;
+  profiler_get_stats(chain->latency.hist, 0, &st);
+  if (st.count == 0) {
+    return;
+  }
+
+  LOG(INFO,
+      "End-to-end latency: avg %.1fms, p50 %.1fms, p99 %.1fms, max %.1fms "
+      "(%lu chunks), plus %.1fms in the sound card",
+      st.avg_ns * 1e-6, st.p50_ns * 1e-6, st.p99_ns * 1e-6, st.max_ns * 1e-6,
+      st.count, (1e3 * chain->latency.device_frames) / chain->audio_rate);
+}
+
+static void report_audio_stats(proc_chain_t *chain) {
+  audio_ring_stats_t st;
+  audio_ring_get_stats(chain->audio_buf, &st);
+  LOG(INFO,
+      "Audio buffer: %lu/%lu samples used, underruns: %lu (%lu samples), "
+      "overruns: %lu (%lu samples)",
+      st.used, st.capacity, st.underruns, st.underrun_samples, st.overruns,
+      st.overrun_samples);
+  if (chain->audio_sync) {
+    LOG(INFO, "Audio resampling: %+.0f ppm, average buffer fill: %.0f samples",
+        (audio_sync_rate(chain->audio_sync) - 1.0) * 1e6,
+        audio_sync_fill(chain->audio_sync));
+  }
+  report_latency(chain);
+}
+
+static void report_sample_loss(proc_chain_t *chain) {
+  sample_loss_t *loss = &chain->loss;
+  uint64_t audio_overruns = 0;
+
+  if (chain->dac) {
+    audio_ring_stats_t st;
+    audio_ring_get_stats(chain->audio_buf, &st);
+    audio_overruns = st.overrun_samples;
+  }
+
+  LOG(INFO,
+      "Sample loss: SDR overflows: %lu, errors: %lu, gaps: %lu (%lu "
+      "samples, %lu zero-filled), front-end drops: %lu samples, audio "
+      "drops: %lu samples",
+      __atomic_load_n(&loss->overflows, __ATOMIC_RELAXED),
+      __atomic_load_n(&loss->errors, __ATOMIC_RELAXED),
+      __atomic_load_n(&loss->gaps, __ATOMIC_RELAXED),
+      __atomic_load_n(&loss->gap_samples, __ATOMIC_RELAXED),
+      __atomic_load_n(&loss->filled_samples, __ATOMIC_RELAXED),
+      __atomic_load_n(&loss->dropped_samples, __ATOMIC_RELAXED),
+      audio_overruns);
+}
+
+// All the sample buffers, in both run modes, come from one arena
+static size_t sample_buffers_size(proc_chain_t *chain) {
+  const size_t input =
+      arena_block_size(chain->input_chunk * sizeof(complex float));
+  const size_t resamp =
+      arena_block_size(chain->resamp_buf_size * sizeof(complex float));
+  const size_t chans = arena_block_size(chan_bufs_size(chain));
+  const size_t audio = arena_block_size(chain->chan_buf_size * sizeof(float));
+
+  // CTCSS and audio buffers of each channel, plus the mix buffer
+  size_t size = ((2 * chain->args.plan.num_channels) + 1) * audio;
+
+  // The pre-roll samples and their audio
+  if (chain->preroll_len > 0) {
+    size += chain->args.plan.num_channels *
+            (arena_block_size(chain->preroll_len * sizeof(complex float)) +
+             arena_block_size((chain->preroll_len + chain->chan_buf_size) *
+                              sizeof(float)));
+  }
+
+  // The mix at the sound card rate, for the highest one there is
+  if (!chain->args.audio_out && !chain->args.input) {
+    const size_t max_src =
+        ((chain->chan_buf_size + 1) * AUDIO_MAX_DEVICE_RATE) /
+        chain->args.plan.channel_width_hz;
+    size += arena_block_size((max_src + 1) * sizeof(float));
+  }
+
+  if (chain->args.pipeline) {
+    // Plus the buffer the capture stage drops chunks into
+    size += (chain->args.queue_depth * (input + resamp + chans)) + input;
+  } else {
+    size += input + resamp + chans;
+    // and the one the gaps are filled from
+    if (chain->args.fill_gaps) {
+      size += input;
+    }
+  }
+
+  return size;
+}
+
+// Requested with SIGUSR1, the statistics are logged
+// from the processing loop, never from the handler
+static void check_profile_dump(proc_chain_t *chain) {
+  if (dump_profile) {
+    dump_profile = false;
+    if (chain->profiler) {
+      profiler_print(chain->profiler);
+    } else {
+      LOG(WARN, "Stage timing is disabled, run with '-T' to enable it");
+    }
+    if (chain->latency.hist) {
+      report_latency(chain);
+    }
+  }
+}
+
+static void proc_chunk(proc_chain_t *chain, complex float *buffp, size_t n,
+                       uint64_t capture_ns, complex float *resamp_buf,
+                       ch_buff_mat_t *chan_bufs, char *footer) {
+  unsigned int ny = proc_frontend(chain, buffp, n, resamp_buf);
+  size_t ns = proc_channelize(chain, resamp_buf, ny, capture_ns, chan_bufs);
+
+  proc_scan(chain, chan_bufs, ns);
+  proc_demod(chain, chan_bufs, ns);
+  proc_preroll(chain, chan_bufs, ns);
+
+  if (chain->args.waterfall > 0) {
+    proc_waterfall(chain, resamp_buf, ny, chan_bufs, ns, footer);
+  }
+}
+
+static void run_single_threaded(proc_chain_t *chain, char *footer) {
+  int read, flags;
+  long long timeNs;
+  uint64_t capture_ns;
+  size_t fill;
+
+  complex float *buffp =
+      arena_alloc(chain->arena, chain->input_chunk * sizeof(complex float));
+  complex float *resamp_buf = arena_alloc(
+      chain->arena, chain->resamp_buf_size * sizeof(complex float));
+  ch_buff_mat_t *chan_bufs = arena_alloc(chain->arena, chan_bufs_size(chain));
+  log_assert(buffp && resamp_buf && chan_bufs);
+
+  complex float *fill_buf = NULL;
+  if (chain->args.fill_gaps) {
+    fill_buf =
+        arena_alloc(chain->arena, chain->input_chunk * sizeof(complex float));
+    log_assert(fill_buf);
+  }
+
+  while (!exit_via_sig) {
+    read = proc_capture(chain, buffp, &flags, &timeNs, &capture_ns, &fill);
+    if (read < 0) {
+      continue;
+    }
+
+    // The zeros go through the whole chain ahead of the chunk
+    while (fill > 0) {
+      const size_t n = fill < chain->input_chunk ? fill : chain->input_chunk;
+      memset(fill_buf, 0, n * sizeof(complex float));
+      proc_chunk(chain, fill_buf, n, 0, resamp_buf, chan_bufs, footer);
+      __atomic_fetch_add(&chain->loss.filled_samples, n, __ATOMIC_RELAXED);
+      fill -= n;
+    }
+
+    proc_chunk(chain, buffp, read, capture_ns, resamp_buf, chan_bufs, footer);
+    log_audio_buf_usage(chain);
+    check_profile_dump(chain);
+  }
+}
+
+static void pipeline_start_stage(pipeline_t *pl, pthread_t *thread,
+                                 void *(*fn)(void *), const char *name,
+                                 size_t stage) {
+  int ret = pthread_create(thread, NULL, fn, pl);
+  log_assert(ret == 0);
+  pthread_setname_np(*thread, name);
+
+  // Give each stage a core of its own when there are enough of them,
+  // otherwise leave the placement to the scheduler
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu >= PIPELINE_NUM_STAGES) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(stage % ncpu, &cpus);
+    ret = pthread_setaffinity_np(*thread, sizeof(cpus), &cpus);
+    if (ret != 0) {
+      LOG(WARN, "Failed to pin '%s' stage to CPU %ld", name, stage % ncpu);
+    }
+  }
+}
+
+// Pushes zeros in place of the samples missing before `time_ns`, in
+// chunks of their own. Never waits, whatever doesn't fit is dropped.
+static void pipeline_fill_gap(pipeline_t *pl, size_t fill, long long time_ns) {
+  proc_chain_t *chain = pl->chain;
+  long long t = time_ns - llround(fill * 1e9 / chain->sample_rate);
+
+  while (fill > 0) {
+    chunk_t *c = chunk_queue_acquire(pl->capture_q, false);
+    if (!c) {
+      chunk_queue_count_drop(pl->capture_q);
+      __atomic_fetch_add(&chain->loss.dropped_samples, fill, __ATOMIC_RELAXED);
+      return;
+    }
+
+    const size_t n = fill < chain->input_chunk ? fill : chain->input_chunk;
+    memset(c->data, 0, n * sizeof(complex float));
+    c->len = n;
+    c->flags = 0;
+    c->time_ns = t;
+    c->capture_ns = 0;
+    chunk_queue_push(pl->capture_q, c);
+    __atomic_fetch_add(&chain->loss.filled_samples, n, __ATOMIC_RELAXED);
+
+    t += llround(n * 1e9 / chain->sample_rate);
+    fill -= n;
+  }
+}
+
+static void *pipeline_capture_thread(void *arg) {
+  pipeline_t *pl = arg;
+  proc_chain_t *chain = pl->chain;
+
+  while (!exit_via_sig) {
+    int read, flags;
+    long long timeNs;
+    uint64_t capture_ns;
+    size_t fill;
+    // Never wait for the downstream stages here - the SDR has to be
+    // drained at its own pace, so a missing buffer means a dropped chunk.
+    // A recording on the other hand can wait, nothing gets lost then.
+    chunk_t *c = chunk_queue_acquire(pl->capture_q, chain->iq_src != NULL);
+    complex float *buffp = c ? c->data : pl->drop_buf;
+
+    read = proc_capture(chain, buffp, &flags, &timeNs, &capture_ns, &fill);
+    if (read < 0) {
+      if (c) {
+        chunk_queue_release(pl->capture_q, c);
+      }
+      continue;
+    }
+
+    if (c) {
+      pipeline_fill_gap(pl, fill, timeNs);
+      c->len = read;
+      c->flags = flags;
+      c->time_ns = timeNs;
+      c->capture_ns = capture_ns;
+      chunk_queue_push(pl->capture_q, c);
+    } else {
+      // The zeros for the gap before it go with it, just as in
+      // pipeline_fill_gap(), so '-Z' accounts for every missing sample
+      chunk_queue_count_drop(pl->capture_q);
+      __atomic_fetch_add(&chain->loss.dropped_samples, read + fill,
+                         __ATOMIC_RELAXED);
+    }
+  }
+
+  chunk_queue_close(pl->capture_q);
+  return NULL;
+}
+
+static void *pipeline_frontend_thread(void *arg) {
+  pipeline_t *pl = arg;
+  chunk_t *in;
+
+  while ((in = chunk_queue_pop(pl->capture_q))) {
+    chunk_t *out = chunk_queue_acquire(pl->resamp_q, true);
+    log_assert(out);
+
+    out->len = proc_frontend(pl->chain, in->data, in->len, out->data);
+    out->flags = in->flags;
+    out->time_ns = in->time_ns;
+    out->capture_ns = in->capture_ns;
+    chunk_queue_release(pl->capture_q, in);
+    chunk_queue_push(pl->resamp_q, out);
+  }
+
+  chunk_queue_close(pl->resamp_q);
+  return NULL;
+}
+
+static void *pipeline_channelizer_thread(void *arg) {
+  pipeline_t *pl = arg;
+  chunk_t *in;
+
+  while ((in = chunk_queue_pop(pl->resamp_q))) {
+    chunk_t *out = chunk_queue_acquire(pl->chan_q, true);
+    log_assert(out);
+
+    out->len = proc_channelize(pl->chain, in->data, in->len, in->capture_ns,
+                               out->data);
+    out->flags = in->flags;
+    out->time_ns = in->time_ns;
+    out->capture_ns = in->capture_ns;
+    // The waterfall is rendered from the resampled signal,
+    // so keep it until the last stage is done with the chunk
+    if ((pl->chain->args.waterfall > 0) &&
+        (pl->chain->args.waterfall_bins == 0)) {
+      out->ref = in;
+    } else {
+      chunk_queue_release(pl->resamp_q, in);
+    }
+    chunk_queue_push(pl->chan_q, out);
+  }
+
+  chunk_queue_close(pl->chan_q);
+  return NULL;
+}
+
+static void pipeline_report(pipeline_t *pl) {
+  chunk_queue_t *queues[] = {pl->capture_q, pl->resamp_q, pl->chan_q};
+
+  for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); i++) {
+    chunk_queue_stats_t st;
+    chunk_queue_get_stats(queues[i], &st);
+    LOG(INFO,
+        "Queue '%s': %lu/%lu chunks used (%3.1f%%), high watermark: %lu, "
+        "pushed: %lu, dropped: %lu",
+        st.name, st.used, st.depth, 100.0f * st.used / st.depth,
+        st.high_watermark, st.pushed, st.dropped);
+  }
+  if (pl->chain->dac) {
+    report_audio_stats(pl->chain);
+  }
+  report_sample_loss(pl->chain);
+  if (pl->chain->iq_writer) {
+    iq_writer_print_stats(pl->chain->iq_writer);
+  }
+  if (pl->chain->net_sink) {
+    net_sink_print_stats(pl->chain->net_sink);
+  }
+}
+
+static void run_pipelined(proc_chain_t *chain, char *footer) {
+  pthread_t capture_th, frontend_th, channelizer_th;
+  const size_t depth = chain->args.queue_depth;
+  struct timespec last_report;
+  chunk_t *c;
+
+  pipeline_t pl = {
+      .chain = chain,
+      .capture_q = chunk_queue_create(
+          "capture", depth, chain->input_chunk * sizeof(complex float),
+          chain->arena),
+      .resamp_q = chunk_queue_create(
+          "frontend", depth, chain->resamp_buf_size * sizeof(complex float),
+          chain->arena),
+      .chan_q = chunk_queue_create("channelizer", depth, chan_bufs_size(chain),
+                                   chain->arena),
+      .drop_buf = arena_alloc(chain->arena,
+                              chain->input_chunk * sizeof(complex float)),
+  };
+  log_assert(pl.capture_q && pl.resamp_q && pl.chan_q && pl.drop_buf);
+
+  LOG(INFO, "Starting %d stage pipeline (queue depth: %lu)",
+      PIPELINE_NUM_STAGES, depth);
+
+  // The demodulator stage runs on the main thread
+  pipeline_start_stage(&pl, &capture_th, pipeline_capture_thread, "capture",
+                       0);
+  pipeline_start_stage(&pl, &frontend_th, pipeline_frontend_thread, "frontend",
+                       1);
+  pipeline_start_stage(&pl, &channelizer_th, pipeline_channelizer_thread,
+                       "channelizer", 2);
+
+  clock_gettime(CLOCK_MONOTONIC, &last_report);
+
+  while ((c = chunk_queue_pop(pl.chan_q))) {
+    ch_buff_mat_t *chan_bufs = c->data;
+
+    proc_scan(chain, chan_bufs, c->len);
+    proc_demod(chain, chan_bufs, c->len);
+    proc_preroll(chain, chan_bufs, c->len);
+
+    if (chain->waterfall) {
+      proc_waterfall(chain, c->ref ? c->ref->data : NULL,
+                     c->ref ? c->ref->len : 0, chan_bufs, c->len, footer);
+    }
+    if (c->ref) {
+      chunk_queue_release(pl.resamp_q, c->ref);
+    }
+    chunk_queue_release(pl.chan_q, c);
+    log_audio_buf_usage(chain);
+    check_profile_dump(chain);
+
     if (chain->args.waterfall == 0) {
-      pthread_mutex_lock(&lock);
-      unsigned int s = cbufferf_size(chain->audio_buf);
-      pthread_mutex_unlock(&lock);
-      if (s > 0) {
-        LOG(DEBUG, "%d samples in audio buffer (%3.1f%% used)", s,
-            100 * (float)s / cbufferf_max_size(chain->audio_buf));
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - last_report.tv_sec) >= PIPELINE_REPORT_INTERVAL_S) {
+        pipeline_report(&pl);
+        last_report = now;
       }
     }
-#endif
   }
 
-  destroy_rtaudio(chain);
-  destroy_soapy(chain);
-  destroy_liquid(chain);
-  ctcss_detector_destroy(&chain->ctcss_detector);
+  pthread_join(channelizer_th, NULL);
+  pthread_join(frontend_th, NULL);
+  pthread_join(capture_th, NULL);
+
+  pipeline_report(&pl);
+
+  chunk_queue_destroy(&pl.chan_q);
+  chunk_queue_destroy(&pl.resamp_q);
+  chunk_queue_destroy(&pl.capture_q);
+}
 
-  pthread_mutex_destroy(&lock);
+int main(int argc, char *argv[]) {
+  bool ret;
+  struct sigaction sigact;
+  proc_chain_t *chain = &g_chain;
+
+  logging_init();
+
+  argp_parse(&argp, argc, argv, 0, 0, &chain->args);
+
+  LOG(INFO,
+      "gain: %5.2f dB, audio_gain: %5.2f, relative squelch level: %5.2f dB, "
+      "waterfall: "
+      "%ld",
+      chain->args.gain, chain->args.audio_gain, chain->args.squelch_level,
+      chain->args.waterfall);
+
+  channel_plan_t *plan = &chain->args.plan;
+  if (plan->num_channels == 0) {
+    ret = channel_plan_parse(SDR_DEFAULT_CHANNEL_PLAN, plan);
+    log_assert(ret);
+  }
+  channel_plan_print(plan);
+  chain->args.frequency = channel_plan_center_hz(plan);
+
+  const unsigned long bandwidth = channel_plan_bandwidth(plan);
+  if (chain->args.sample_rate < bandwidth) {
+    LOG(ERROR,
+        "The sample rate (%g S/s) is lower than the channel plan "
+        "bandwidth (%lu Hz)",
+        chain->args.sample_rate, bandwidth);
+    exit(EXIT_FAILURE);
+  }
+
+  // Channels past the end of the plan are never enabled
+  if (plan->num_channels < MAX_CHANNELS) {
+    chain->args.channel_mask &= (1ULL << plan->num_channels) - 1;
+  }
+
+  LOG(INFO, "audio lowpass: %s, channel mask: 0x%04lX",
+      chain->args.lowpass ? "enabled" : "disabled", chain->args.channel_mask);
+
+  if (chain->args.channel_mask == 0) {
+    LOG(ERROR, "No channels enabled in channel mask !");
+    exit(EXIT_FAILURE);
+  }
+
+  // The audio buffer is sized for the chunks written into it
+  if (chain->args.audio_target_ms == AUDIO_AUTO_MS) {
+    chain->args.audio_target_ms =
+        chain->args.chunk_ms + AUDIO_TARGET_MARGIN_MS;
+  }
+  if (chain->args.audio_latency_ms == AUDIO_AUTO_MS) {
+    const unsigned int base =
+        chain->args.audio_target_ms > 0
+            ? chain->args.audio_target_ms
+            : chain->args.chunk_ms + AUDIO_TARGET_MARGIN_MS;
+    chain->args.audio_latency_ms =
+        base + (AUDIO_CHUNKS_ABOVE_TARGET * chain->args.chunk_ms);
+  }
+
+  // assemble footer
+  unsigned int footer_len = chain->args.waterfall + FOOTER_TAIL_LEN;
+  char footer[footer_len + 1];
+
+  if (chain->args.input) {
+    chain->iq_src =
+        iq_source_create(chain->args.input, chain->args.input_format,
+                         chain->args.sample_rate, chain->args.realtime);
+    if (!chain->iq_src) {
+      exit(EXIT_FAILURE);
+    }
+    chain->sample_rate = chain->args.sample_rate;
+  } else {
+    // Only the SDR has a minimum, IQ files come at whatever rate
+    if (chain->args.sample_rate < SDR_SAMPLERATE) {
+      LOG(ERROR, "The SDR sample rate (%g S/s) is lower than %lu S/s",
+          chain->args.sample_rate, SDR_SAMPLERATE);
+      exit(EXIT_FAILURE);
+    }
+    ret = init_soapy(chain, chain->args.sample_rate);
+    if (!ret) {
+      exit(EXIT_FAILURE);
+    }
+
+    chain->sample_rate =
+        SoapySDRDevice_getSampleRate(chain->sdr, SOAPY_SDR_RX, 0);
+    const double min_rate =
+        bandwidth > SDR_SAMPLERATE ? bandwidth : SDR_SAMPLERATE;
+    if (chain->sample_rate < min_rate) {
+      LOG(ERROR, "The SDR sample rate (%g S/s) is lower than %g S/s",
+          chain->sample_rate, min_rate);
+      destroy_soapy(chain);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Everything per chunk follows from its length at the actual rate
+  chain->input_chunk =
+      (size_t)lround((chain->sample_rate * chain->args.chunk_ms) / 1000);
+  chain->resamp_buf_size = (size_t)ceil(
+      1 + 2 * chain->input_chunk * ((double)bandwidth / chain->sample_rate));
+  chain->chan_buf_size =
+      (chain->resamp_buf_size + plan->num_channels - 1) / plan->num_channels;
+  LOG(INFO,
+      "Chunk: %ums (%lu samples), resampled buffer: %lu samples, channel "
+      "buffers: %lu samples",
+      chain->args.chunk_ms, chain->input_chunk, chain->resamp_buf_size,
+      chain->chan_buf_size);
+
+  // Whole chunks, or blocks of the channel signal fitting in a chunk
+  chain->squelch_block =
+      (plan->channel_width_hz * chain->args.squelch_block_ms) / 1000;
+  if (chain->args.squelch_block_ms > 0) {
+    const size_t min_block =
+        (chain->chan_buf_size + SQUELCH_MAX_BLOCKS - 2) /
+        (SQUELCH_MAX_BLOCKS - 1);
+    if (chain->squelch_block < min_block) {
+      chain->squelch_block = min_block;
+      LOG(WARN, "The squelch block is too short, using %lu samples",
+          min_block);
+    }
+    LOG(INFO, "Squelch block: %lu samples (%.1fms)", chain->squelch_block,
+        (1e3 * chain->squelch_block) / plan->channel_width_hz);
+  }
+
+  // Only the recordings and the streams have any use for it
+  if (chain->args.record_dir || chain->args.net_stream) {
+    chain->preroll_len =
+        (plan->channel_width_hz * chain->args.preroll_ms) / 1000;
+  }
+
+  chain->arena = arena_create(
+      sample_buffers_size(chain),
+      (chain->args.hugepages ? ARENA_HUGEPAGES : 0) |
+          (chain->args.mlock ? ARENA_MLOCK : 0));
+  log_assert(chain->arena);
+
+  ret = init_liquid(chain, chain->resamp_buf_size);
+  log_assert(ret);
+
+  if (chain->args.audio_out) {
+    chain->audio_out = fopen(chain->args.audio_out, "wb");
+    if (!chain->audio_out) {
+      LOG(ERROR, "Failed to open '%s': %s", chain->args.audio_out,
+          strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  } else if (!chain->iq_src) {
+    ret = init_rtaudio(chain);
+    if (!ret) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ret = init_channels(chain);
+  log_assert(ret);
+
+  if (chain->args.record_dir) {
+    chain->recorder = recorder_create(chain->args.record_dir,
+                                      plan->channel_width_hz,
+                                      chain->chan_buf_size);
+    log_assert(chain->recorder);
+    chain->sinks[chain->num_sinks++] = (channel_sink_t){
+        .ctx = chain->recorder,
+        .open = record_open,
+        .write = record_write,
+        .close = record_close,
+    };
+    LOG(INFO, "Recording the transmissions to '%s' (%ums pre-roll)",
+        chain->args.record_dir, chain->args.preroll_ms);
+  }
+
+  if (chain->args.net_stream) {
+    chain->net_sink = net_sink_create(chain->args.net_stream,
+                                      plan->channel_width_hz,
+                                      chain->chan_buf_size);
+    if (!chain->net_sink) {
+      exit(EXIT_FAILURE);
+    }
+    chain->sinks[chain->num_sinks++] = (channel_sink_t){
+        .ctx = chain->net_sink,
+        .open = stream_open,
+        .write = stream_write,
+        .close = stream_close,
+    };
+    LOG(INFO, "Streaming the audio to '%s'", chain->args.net_stream);
+  }
+
+  if (chain->args.iq_capture) {
+    const iq_writer_config_t config = {
+        .prefix = chain->args.iq_capture,
+        .format = chain->args.iq_capture_format,
+        .sample_rate = chain->sample_rate,
+        .frequency = chain->args.frequency,
+        .gain = chain->args.gain,
+        .max_file_bytes = chain->args.iq_rotate_mb * 1000000ULL,
+        .max_file_s = chain->args.iq_rotate_s,
+        .arena_flags = (chain->args.hugepages ? ARENA_HUGEPAGES : 0) |
+                       (chain->args.mlock ? ARENA_MLOCK : 0),
+    };
+    chain->iq_writer = iq_writer_create(&config);
+    log_assert(chain->iq_writer);
+  }
+
+  // The footer shows the state of the channels
+  if (chain->args.waterfall > 0) {
+    for (size_t i = 0; i < footer_len; i++) footer[i] = ' ';
+    footer[1] = '[';
+    footer[chain->args.waterfall + 4] = ']';
+    refresh_footer(chain, footer, chain->args.waterfall);
+    footer[footer_len] = '\0';
+
+    if (chain->args.waterfall_bins > 0) {
+      chain->waterfall = waterfall_create_channels(
+          chain->args.waterfall, plan->num_channels, chain->args.waterfall_bins,
+          chain->chan_buf_size, footer_len, chain->args.waterfall_fps);
+    } else {
+      chain->waterfall =
+          waterfall_create(chain->args.waterfall, chain->resamp_buf_size,
+                           footer_len, chain->args.waterfall_fps);
+    }
+    log_assert(chain->waterfall);
+  }
+
+  if (chain->args.profile) {
+    chain->profiler = profiler_create(prof_stage_names, PROF_NUM_STAGES);
+    log_assert(chain->profiler);
+  }
+
+  sigact.sa_handler = sighandler;
+  sigemptyset(&sigact.sa_mask);
+  sigact.sa_flags = 0;
+  sigaction(SIGINT, &sigact, NULL);
+  sigaction(SIGTERM, &sigact, NULL);
+  sigaction(SIGQUIT, &sigact, NULL);
+  sigaction(SIGPIPE, &sigact, NULL);
+  sigaction(SIGUSR1, &sigact, NULL);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (chain->args.pipeline) {
+    run_pipelined(chain, footer);
+  } else {
+    run_single_threaded(chain, footer);
+    report_sample_loss(chain);
+  }
+
+  if (chain->iq_src) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed =
+        (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) * 1e-9);
+    const double duration =
+        iq_source_num_samples(chain->iq_src) / chain->sample_rate;
+    LOG(INFO, "Processed %.1fs of IQ samples in %.1fs (%.1fx real time)",
+        duration, elapsed, duration / elapsed);
+  }
+
+  if (chain->iq_writer) {
+    iq_writer_finish(chain->iq_writer);
+    iq_writer_print_stats(chain->iq_writer);
+    iq_writer_destroy(&chain->iq_writer);
+  }
+
+  if (chain->waterfall) {
+    waterfall_stats_t st;
+    waterfall_get_stats(chain->waterfall, &st);
+    waterfall_destroy(&chain->waterfall);
+    printf("\n");
+    LOG(INFO, "Waterfall: %lu frames, %lu dropped", st.frames, st.dropped);
+  }
+
+  if (chain->recorder) {
+    recorder_stats_t st;
+    recorder_finish(chain->recorder);
+    recorder_get_stats(chain->recorder, &st);
+    recorder_destroy(&chain->recorder);
+    LOG(INFO,
+        "Recorder: %lu files, %lu bytes written, %lu samples dropped, "
+        "%lu errors",
+        st.files, st.bytes, st.dropped_samples, st.errors);
+  }
+
+  if (chain->net_sink) {
+    net_sink_finish(chain->net_sink);
+    net_sink_print_stats(chain->net_sink);
+    net_sink_destroy(&chain->net_sink);
+  }
+
+  if (chain->profiler) {
+    profiler_print(chain->profiler);
+    profiler_destroy(&chain->profiler);
+  }
+
+  if (chain->audio_out) {
+    fclose(chain->audio_out);
+  } else if (chain->dac) {
+    destroy_rtaudio(chain);
+    report_audio_stats(chain);
+    profiler_destroy(&chain->latency.hist);
+  }
+  if (chain->iq_src) {
+    iq_source_destroy(&chain->iq_src);
+  } else {
+    destroy_soapy(chain);
+  }
+  destroy_liquid(chain);
+  destroy_channels(chain);
+  arena_print(chain->arena);
+  arena_destroy(&chain->arena);
 
   LOG(INFO, "Exiting");
   exit(EXIT_SUCCESS);
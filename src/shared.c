@@ -8,7 +8,7 @@
 
 #include "logging.h"
 
-bool init_soapy(proc_chain_t *chain)
+bool init_soapy(proc_chain_t *chain, double sample_rate)
 {
     int ret;
     size_t length;
@@ -49,8 +49,10 @@ bool init_soapy(proc_chain_t *chain)
         LOG(INFO, "Rx num channels: %lu", num_rxch);
         log_assert(num_rxch == 1);
 
-        ret = SoapySDRDevice_setSampleRate(chain->sdr, SOAPY_SDR_RX, 0, SDR_SAMPLERATE);
+        ret = SoapySDRDevice_setSampleRate(chain->sdr, SOAPY_SDR_RX, 0, sample_rate);
         log_assert(ret == 0);
+        LOG(INFO, "Rx sample rate: %g S/s (requested %g S/s)",
+            SoapySDRDevice_getSampleRate(chain->sdr, SOAPY_SDR_RX, 0), sample_rate);
         ret = SoapySDRDevice_setFrequency(chain->sdr, SOAPY_SDR_RX, 0, chain->args.frequency, NULL);
         log_assert(ret == 0);
         int err = SoapySDRDevice_setGain(chain->sdr, SOAPY_SDR_RX, 0, chain->args.gain);
@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+
+#include "waterfall.h"
+
+#include <errno.h>
+#include <liquid/liquid.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+// The spectrum line decorations
+#define WATERFALL_LINE_EXTRA (96)
+
+// The same levels as the liquid-dsp ASCII spectrogram,
+// from the channel median up, in steps of WATERFALL_LEVEL_DB
+static const char levels[] = " .,-+*&NM#";
+#define WATERFALL_NUM_LEVELS (sizeof(levels) - 1)
+#define WATERFALL_LEVEL_DB (2.0f)
+
+struct _waterfall_t
+{
+    size_t width;
+    size_t max_samples;
+    size_t footer_len;
+    uint64_t period_ns;
+    uint64_t next_frame_ns;
+    // Spectrum of the band, NULL when drawn from the channels
+    asgramcf asgram;
+    unsigned int num_channels;
+    unsigned int bins;
+    size_t chan_len;
+    pthread_t thread;
+    bool started;
+    // Set by the receiver thread when it fills the slot,
+    // cleared by the renderer once the frame is written
+    atomic_bool busy;
+    atomic_bool exit;
+    sem_t ready;
+    // The slot handed over
+    complex float *samples;
+    size_t num_samples;
+    float *chan_power;
+    float rssi;
+    char *footer;
+    // Renderer only
+    char *ascii;
+    // `num_channels` * `bins`, the bins of each channel from the lowest
+    // frequency up, the DFT twiddles and a scratch copy for the median
+    float *power;
+    float *sorted;
+    complex float twiddle[WATERFALL_MAX_BINS * WATERFALL_MAX_BINS];
+    char *frame;
+    size_t frame_size;
+    bool failed;
+    atomic_uint_fast64_t frames;
+    atomic_uint_fast64_t dropped;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// The whole frame in one system call, so it is never torn
+// by the terminal, and there's only one place to block in
+static bool write_frame(const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG(WARN, "Failed to write the waterfall: %s", strerror(errno));
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// |X[m]|^2 summed over consecutive DFTs of `bins` samples, bin m
+// stored at (m + bins / 2) % bins, so the negative frequencies come first
+static void channel_bins(waterfall_t *q, complex float const *x, size_t n,
+                         float *power)
+{
+    const unsigned int s = q->bins;
+
+    for (unsigned int m = 0; m < s; m++)
+    {
+        power[m] = 0.0f;
+    }
+    for (size_t i = 0; i + s <= n; i += s)
+    {
+        for (unsigned int m = 0; m < s; m++)
+        {
+            complex float const *w = &q->twiddle[m * s];
+            complex float acc = 0.0f;
+            for (unsigned int j = 0; j < s; j++)
+            {
+                acc += x[i + j] * w[j];
+            }
+            power[(m + (s / 2)) % s] +=
+                (crealf(acc) * crealf(acc)) + (cimagf(acc) * cimagf(acc));
+        }
+    }
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    const float x = *(const float *)a;
+    const float y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static void render_channels(waterfall_t *q, float *maxval, float *maxfreq)
+{
+    const size_t num_bins = (size_t)q->num_channels * q->bins;
+
+    if (q->bins == 1)
+    {
+        memcpy(q->power, q->chan_power, num_bins * sizeof(float));
+    }
+    else
+    {
+        for (unsigned int k = 0; k < q->num_channels; k++)
+        {
+            channel_bins(q, &q->samples[k * q->chan_len], q->num_samples,
+                         &q->power[k * q->bins]);
+        }
+    }
+
+    // Most of the band is noise most of the time
+    memcpy(q->sorted, q->power, num_bins * sizeof(float));
+    qsort(q->sorted, num_bins, sizeof(float), compare_float);
+    const float floor_db = 10.0f * log10f(q->sorted[num_bins / 2] + 1e-20f);
+
+    size_t max_bin = 0;
+    for (size_t i = 1; i < num_bins; i++)
+    {
+        if (q->power[i] > q->power[max_bin])
+        {
+            max_bin = i;
+        }
+    }
+    *maxval = (10.0f * log10f(q->power[max_bin] + 1e-20f)) - floor_db;
+    *maxfreq = (((float)max_bin + 0.5f) / num_bins) - 0.5f;
+
+    // Each character shows the strongest of the bins under it
+    for (size_t c = 0; c < q->width; c++)
+    {
+        const size_t first = (c * num_bins) / q->width;
+        size_t last = ((c + 1) * num_bins) / q->width;
+        if (last <= first)
+        {
+            last = first + 1;
+        }
+        float p = q->power[first];
+        for (size_t i = first + 1; i < last; i++)
+        {
+            p = fmaxf(p, q->power[i]);
+        }
+
+        const float db = (10.0f * log10f(p + 1e-20f)) - floor_db;
+        long level = lroundf(db / WATERFALL_LEVEL_DB);
+        if (level < 0)
+        {
+            level = 0;
+        }
+        else if (level >= (long)WATERFALL_NUM_LEVELS)
+        {
+            level = WATERFALL_NUM_LEVELS - 1;
+        }
+        q->ascii[c] = levels[level];
+    }
+}
+
+static void render(waterfall_t *q)
+{
+    float maxval;
+    float maxfreq;
+
+    if (q->asgram)
+    {
+        asgramcf_write(q->asgram, q->samples, q->num_samples);
+        asgramcf_execute(q->asgram, q->ascii, &maxval, &maxfreq);
+    }
+    else
+    {
+        render_channels(q, &maxval, &maxfreq);
+    }
+
+    const int len = snprintf(
+        q->frame, q->frame_size,
+        " > %s < pk%5.1fdB [%5.2f] [max SNR: %5.1fdB]        \n%s\r", q->ascii,
+        maxval, maxfreq, q->rssi, q->footer);
+    log_assert((len > 0) && ((size_t)len < q->frame_size));
+
+    if (!write_frame(q->frame, len))
+    {
+        // Every frame from now on gets dropped
+        q->failed = true;
+        return;
+    }
+    atomic_fetch_add_explicit(&q->frames, 1, memory_order_relaxed);
+}
+
+static void *render_thread(void *arg)
+{
+    waterfall_t *q = arg;
+    struct sched_param sp = {0};
+
+    // Only gets the CPU time nobody else wants
+    int ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+    if (ret != 0)
+    {
+        LOG(WARN, "Failed to lower the waterfall thread priority: %s",
+            strerror(ret));
+    }
+
+    while (true)
+    {
+        while ((sem_wait(&q->ready) != 0) && (errno == EINTR))
+        {
+        }
+        if (atomic_load(&q->exit))
+        {
+            break;
+        }
+
+        render(q);
+        if (!q->failed)
+        {
+            atomic_store_explicit(&q->busy, false, memory_order_release);
+        }
+    }
+
+    return NULL;
+}
+
+static waterfall_t *waterfall_alloc(size_t width, size_t max_samples,
+                                    size_t footer_len, unsigned int fps)
+{
+    log_assert((width > 0) && (fps > 0));
+
+    waterfall_t *self = calloc(1, sizeof(waterfall_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->width = width;
+    self->max_samples = max_samples;
+    self->footer_len = footer_len;
+    self->period_ns = 1000000000ULL / fps;
+    self->frame_size = width + footer_len + WATERFALL_LINE_EXTRA;
+    atomic_init(&self->busy, false);
+    atomic_init(&self->exit, false);
+    atomic_init(&self->frames, 0);
+    atomic_init(&self->dropped, 0);
+
+    self->samples = malloc(max_samples * sizeof(complex float));
+    self->footer = calloc(footer_len + 1, 1);
+    self->ascii = calloc(width + 1, 1);
+    self->frame = malloc(self->frame_size);
+    if (!self->samples || !self->footer || !self->ascii || !self->frame)
+    {
+        waterfall_destroy(&self);
+        return NULL;
+    }
+
+    return self;
+}
+
+static waterfall_t *waterfall_start(waterfall_t *self)
+{
+    if (sem_init(&self->ready, 0, 0) != 0)
+    {
+        waterfall_destroy(&self);
+        return NULL;
+    }
+    int ret = pthread_create(&self->thread, NULL, render_thread, self);
+    if (ret != 0)
+    {
+        LOG(ERROR, "Failed to start the waterfall thread: %s", strerror(ret));
+        sem_destroy(&self->ready);
+        waterfall_destroy(&self);
+        return NULL;
+    }
+    pthread_setname_np(self->thread, "waterfall");
+    self->started = true;
+
+    return self;
+}
+
+waterfall_t *waterfall_create(size_t width, size_t max_samples,
+                              size_t footer_len, unsigned int fps)
+{
+    waterfall_t *self = waterfall_alloc(width, max_samples, footer_len, fps);
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->asgram = asgramcf_create(width);
+    if (!self->asgram)
+    {
+        waterfall_destroy(&self);
+        return NULL;
+    }
+    asgramcf_set_scale(self->asgram, -40.0f, 2.0f);
+
+    return waterfall_start(self);
+}
+
+waterfall_t *waterfall_create_channels(size_t width, unsigned int num_channels,
+                                       unsigned int bins, size_t chan_len,
+                                       size_t footer_len, unsigned int fps)
+{
+    log_assert((num_channels > 0) && (bins > 0) &&
+               (bins <= WATERFALL_MAX_BINS));
+
+    // Only the channel energies are copied with a single bin
+    const size_t max_samples = bins > 1 ? num_channels * chan_len : 1;
+    waterfall_t *self = waterfall_alloc(width, max_samples, footer_len, fps);
+    if (!self)
+    {
+        return NULL;
+    }
+
+    self->num_channels = num_channels;
+    self->bins = bins;
+    self->chan_len = chan_len;
+    self->chan_power = calloc(num_channels, sizeof(float));
+    self->power = calloc(num_channels * bins, sizeof(float));
+    self->sorted = calloc(num_channels * bins, sizeof(float));
+    if (!self->chan_power || !self->power || !self->sorted)
+    {
+        waterfall_destroy(&self);
+        return NULL;
+    }
+
+    for (unsigned int m = 0; m < bins; m++)
+    {
+        for (unsigned int j = 0; j < bins; j++)
+        {
+            self->twiddle[(m * bins) + j] =
+                cexpf(-2.0f * I * (float)M_PI * ((m * j) % bins) / bins);
+        }
+    }
+
+    return waterfall_start(self);
+}
+
+void waterfall_destroy(waterfall_t **q_p)
+{
+    log_assert(q_p);
+    if (*q_p)
+    {
+        waterfall_t *q = *q_p;
+        if (q->started)
+        {
+            atomic_store(&q->exit, true);
+            sem_post(&q->ready);
+            pthread_join(q->thread, NULL);
+            sem_destroy(&q->ready);
+        }
+        if (q->asgram)
+        {
+            asgramcf_destroy(q->asgram);
+        }
+        free(q->sorted);
+        free(q->power);
+        free(q->chan_power);
+        free(q->frame);
+        free(q->ascii);
+        free(q->footer);
+        free(q->samples);
+        free(q);
+        *q_p = NULL;
+    }
+}
+
+bool waterfall_frame_due(waterfall_t *q)
+{
+    const uint64_t now = now_ns();
+
+    if (now < q->next_frame_ns)
+    {
+        return false;
+    }
+    // A fixed rate, unless it fell behind by more than a frame
+    q->next_frame_ns += q->period_ns;
+    if (q->next_frame_ns <= now)
+    {
+        q->next_frame_ns = now + q->period_ns;
+    }
+
+    if (atomic_load_explicit(&q->busy, memory_order_acquire))
+    {
+        atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void waterfall_submit(waterfall_t *q, complex float const *x, size_t n,
+                      float rssi, const char *footer)
+{
+    log_assert(!atomic_load(&q->busy));
+    if (n > q->max_samples)
+    {
+        n = q->max_samples;
+    }
+
+    memcpy(q->samples, x, n * sizeof(complex float));
+    q->num_samples = n;
+    q->rssi = rssi;
+    strncpy(q->footer, footer, q->footer_len);
+
+    atomic_store_explicit(&q->busy, true, memory_order_release);
+    sem_post(&q->ready);
+}
+
+void waterfall_submit_channels(waterfall_t *q, float const *power,
+                               complex float const *y, size_t stride,
+                               size_t ns, float rssi, const char *footer)
+{
+    log_assert(!atomic_load(&q->busy) && !q->asgram);
+
+    memcpy(q->chan_power, power, q->num_channels * sizeof(float));
+    if (q->bins > 1)
+    {
+        if (ns > q->chan_len)
+        {
+            ns = q->chan_len;
+        }
+        for (unsigned int k = 0; k < q->num_channels; k++)
+        {
+            memcpy(&q->samples[k * q->chan_len], &y[k * stride],
+                   ns * sizeof(complex float));
+        }
+    }
+    q->num_samples = ns;
+    q->rssi = rssi;
+    strncpy(q->footer, footer, q->footer_len);
+
+    atomic_store_explicit(&q->busy, true, memory_order_release);
+    sem_post(&q->ready);
+}
+
+void waterfall_get_stats(waterfall_t *q, waterfall_stats_t *stats)
+{
+    stats->frames = atomic_load_explicit(&q->frames, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&q->dropped, memory_order_relaxed);
+}
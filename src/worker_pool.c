@@ -0,0 +1,176 @@
+#include "worker_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "logging.h"
+
+struct _worker_pool_t
+{
+    pthread_t *threads;
+    size_t num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    uint64_t generation;
+    size_t pending;
+    bool exit;
+    worker_fn_t fn;
+    void *ctx;
+    size_t num_items;
+    atomic_size_t next_item;
+};
+
+static void worker_pool_drain(worker_pool_t *pool, worker_fn_t fn, void *ctx,
+                              size_t num_items)
+{
+    size_t i;
+
+    while ((i = atomic_fetch_add_explicit(&pool->next_item, 1,
+                                          memory_order_relaxed)) < num_items)
+    {
+        fn(ctx, i);
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    worker_pool_t *pool = arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (!pool->exit && (pool->generation == seen))
+        {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->exit)
+        {
+            break;
+        }
+        seen = pool->generation;
+        worker_fn_t fn = pool->fn;
+        void *ctx = pool->ctx;
+        size_t num_items = pool->num_items;
+        pthread_mutex_unlock(&pool->lock);
+
+        worker_pool_drain(pool, fn, ctx, num_items);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+        {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+worker_pool_t *worker_pool_create(size_t num_workers)
+{
+    log_assert(num_workers > 0);
+
+    worker_pool_t *self = calloc(1, sizeof(worker_pool_t));
+    if (!self)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->work_cond, NULL);
+    pthread_cond_init(&self->done_cond, NULL);
+    atomic_init(&self->next_item, 0);
+
+    if (num_workers > 1)
+    {
+        self->threads = calloc(num_workers - 1, sizeof(pthread_t));
+        if (!self->threads)
+        {
+            worker_pool_destroy(&self);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < num_workers - 1; i++)
+        {
+            int ret = pthread_create(&self->threads[i], NULL, worker_thread, self);
+            if (ret != 0)
+            {
+                LOG(ERROR, "Failed to start worker thread #%lu", i);
+                worker_pool_destroy(&self);
+                return NULL;
+            }
+            self->num_threads++;
+        }
+    }
+
+    return self;
+}
+
+void worker_pool_destroy(worker_pool_t **pool_p)
+{
+    log_assert(pool_p);
+    if (*pool_p)
+    {
+        worker_pool_t *pool = *pool_p;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->exit = true;
+        pthread_cond_broadcast(&pool->work_cond);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (size_t i = 0; i < pool->num_threads; i++)
+        {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->done_cond);
+        pthread_cond_destroy(&pool->work_cond);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->threads);
+        free(pool);
+        *pool_p = NULL;
+    }
+}
+
+void worker_pool_run(worker_pool_t *pool, worker_fn_t fn, void *ctx,
+                     size_t num_items)
+{
+    // Not worth waking anyone up
+    if ((pool->num_threads == 0) || (num_items < 2))
+    {
+        for (size_t i = 0; i < num_items; i++)
+        {
+            fn(ctx, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->num_items = num_items;
+    atomic_store_explicit(&pool->next_item, 0, memory_order_relaxed);
+    pool->pending = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    worker_pool_drain(pool, fn, ctx, num_items);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t worker_pool_size(worker_pool_t *pool)
+{
+    return pool->num_threads + 1;
+}